@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <sstream>
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "boost/filesystem.hpp"
+
+#include "core/affinity.h"
+#include "glog/logging.h"
+
+namespace proxy {
+namespace core {
+
+bool ProxyAffinity::parse_cpu_list(const std::string &list, std::vector<int> &cpus) {
+
+    cpus.clear();
+
+    std::istringstream iss(list);
+    std::string item;
+    while(std::getline(iss, item, ',')) {
+
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        if(item.empty()) {
+            continue;
+        }
+
+        char *end = nullptr;
+        long first = strtol(item.c_str(), &end, 10);
+        long last = first;
+        if(end == item.c_str()) {
+            return false;
+        }
+        if(*end == '-') {
+            const char *p = end + 1;
+            last = strtol(p, &end, 10);
+            if(end == p) {
+                return false;
+            }
+        }
+        if(*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+            return false;
+        }
+
+        for(long c = first; c <= last; ++c) {
+            cpus.push_back(static_cast<int>(c));
+        }
+
+    }
+
+    return !cpus.empty();
+
+}
+
+bool ProxyAffinity::irq_cpus(const std::string &iface, std::vector<int> &cpus) {
+
+    /*
+     * the queue interrupts are named after the interface, e.g.
+     *   eth0-TxRx-0, eth0-rx-1, mlx5_comp0@pci:... (not matched)
+     */
+
+    cpus.clear();
+
+    std::ifstream interrupts("/proc/interrupts");
+    if(!interrupts) {
+        LOG(ERROR) << "open /proc/interrupts error: " << strerror(errno);
+        return false;
+    }
+
+    std::string line;
+    while(std::getline(interrupts, line)) {
+
+        std::istringstream iss(line);
+        std::string irq;
+        iss >> irq;
+        if(irq.empty() || irq.back() != ':') {
+            continue;
+        }
+        irq.pop_back();
+
+        std::string name;
+        std::string token;
+        while(iss >> token) {
+            name = token;
+        }
+
+        std::string lower(name);
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        if(name.compare(0, iface.size(), iface) || lower.find("rx") == std::string::npos) {
+            continue;
+        }
+
+        std::ifstream affinity("/proc/irq/" + irq + "/smp_affinity_list");
+        std::string list;
+        std::vector<int> irq_cpus;
+        if(!affinity || !std::getline(affinity, list) || !parse_cpu_list(list, irq_cpus)) {
+            continue;
+        }
+        cpus.push_back(irq_cpus.front());
+
+    }
+
+    return !cpus.empty();
+
+}
+
+int ProxyAffinity::node_of_cpu(int cpu) {
+
+    boost::filesystem::path dir("/sys/devices/system/cpu/cpu" + std::to_string(cpu));
+
+    try {
+        for(boost::filesystem::directory_iterator it(dir), end; it != end; ++it) {
+            std::string name = it->path().filename().string();
+            if(name.compare(0, 4, "node") == 0 && name.size() > 4) {
+                return atoi(name.c_str() + 4);
+            }
+        }
+    } catch (const std::exception &ex) {
+        LOG(WARNING) << "read the numa node of the cpu " << cpu << " error: " << ex.what();
+    }
+
+    return -1;
+
+}
+
+bool ProxyAffinity::pin(pthread_t thread, const std::vector<int> &cpus) {
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int c : cpus) {
+        CPU_SET(c, &set);
+    }
+
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if(err) {
+        errno = err;
+        return false;
+    }
+
+    return true;
+
+}
+
+}
+}
@@ -0,0 +1,31 @@
+#ifndef PROXY_CORE_AFFINITY_H_H_H
+#define PROXY_CORE_AFFINITY_H_H_H
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+namespace proxy {
+namespace core {
+
+class ProxyAffinity {
+
+public:
+    // parse the list such as "0-3,8,10-11"
+    static bool parse_cpu_list(const std::string &, std::vector<int> &);
+
+    // the cpus serving the rx queue interrupts of the interface, in the order of the queues
+    static bool irq_cpus(const std::string &, std::vector<int> &);
+
+    // -1 when the cpu belongs to no known numa node
+    static int node_of_cpu(int);
+
+    static bool pin(pthread_t, const std::vector<int> &);
+
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "core/arena.h"
+#include "glog/logging.h"
+
+namespace proxy {
+namespace core {
+
+const size_t ProxyArena::CHUNK_SIZE = 4 * 1024 * 1024;
+const size_t ProxyArena::ALIGNMENT = 64;
+const size_t ProxyArena::HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+std::mutex ProxyArena::_mutex;
+bool ProxyArena::_enabled = false;
+int ProxyArena::_node = -1;
+void (*ProxyArena::_hook)(void *, size_t) = nullptr;
+char *ProxyArena::_cur = nullptr;
+char *ProxyArena::_end = nullptr;
+size_t ProxyArena::_mapped = 0;
+bool ProxyArena::_huge_pages = false;
+size_t ProxyArena::_huge_mapped = 0;
+size_t ProxyArena::_thp_mapped = 0;
+std::unordered_map<size_t, std::vector<void *>> ProxyArena::_free;
+
+bool ProxyArena::setup(int node) {
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _enabled = true;
+
+    if(node >= static_cast<int>(sizeof(unsigned long) * 8)) {
+        _node = -1;
+        return false;
+    }
+
+    _node = node;
+
+    return true;
+
+}
+
+void ProxyArena::map_hook(void (*hook)(void *, size_t)) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _hook = hook;
+}
+
+void ProxyArena::huge_pages(bool on) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _huge_pages = on;
+}
+
+void *ProxyArena::_map_huge(size_t size) {
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_2MB
+    flags |= MAP_HUGE_2MB;
+#endif
+
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if(p != MAP_FAILED) {
+        _huge_mapped += size;
+        return p;
+    }
+
+    // no reserved huge pages: map one more page to cut an aligned region out of it, so the
+    // khugepaged can back it with the transparent huge pages
+    char *raw = static_cast<char *>(mmap(NULL, size + ProxyArena::HUGE_PAGE_SIZE,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(raw == MAP_FAILED) {
+        return nullptr;
+    }
+
+    uintptr_t addr = reinterpret_cast<uintptr_t>(raw);
+    char *aligned = reinterpret_cast<char *>((addr + ProxyArena::HUGE_PAGE_SIZE - 1) &
+        ~(ProxyArena::HUGE_PAGE_SIZE - 1));
+    size_t head = static_cast<size_t>(aligned - raw);
+    if(head) {
+        munmap(raw, head);
+    }
+    if(ProxyArena::HUGE_PAGE_SIZE - head) {
+        munmap(aligned + size, ProxyArena::HUGE_PAGE_SIZE - head);
+    }
+
+    if(madvise(aligned, size, MADV_HUGEPAGE) == 0) {
+        _thp_mapped += size;
+    }
+
+    return aligned;
+
+}
+
+void *ProxyArena::_map(size_t size) {
+
+    void *p = nullptr;
+    if(_huge_pages && size % ProxyArena::HUGE_PAGE_SIZE == 0) {
+        p = _map_huge(size);
+    } else {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) {
+            p = nullptr;
+        }
+    }
+    if(!p) {
+        return nullptr;
+    }
+
+    // preferred rather than bound, a full node falls back to the others instead of failing
+    if(_node >= 0) {
+        unsigned long mask = 1UL << _node;
+        if(syscall(SYS_mbind, p, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) < 0) {
+            LOG(WARNING) << "bind the arena memory to the numa node " << _node << " error: "
+                << strerror(errno);
+        }
+    }
+
+    _mapped += size;
+
+    if(_hook) {
+        _hook(p, size);
+    }
+
+    return p;
+
+}
+
+void *ProxyArena::allocate(size_t size) {
+
+    if(!_enabled) {
+        return ::operator new(size);
+    }
+
+    size = (size + ProxyArena::ALIGNMENT - 1) & ~(ProxyArena::ALIGNMENT - 1);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::vector<void *> &blocks = _free[size];
+    if(!blocks.empty()) {
+        void *p = blocks.back();
+        blocks.pop_back();
+        return p;
+    }
+
+    // the blocks larger than a quarter chunk get their own mapping, which are kept in the
+    // free lists like the others
+    if(size > ProxyArena::CHUNK_SIZE / 4) {
+        void *p = _map(size);
+        if(!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    if(static_cast<size_t>(_end - _cur) < size) {
+        char *chunk = static_cast<char *>(_map(ProxyArena::CHUNK_SIZE));
+        if(!chunk) {
+            throw std::bad_alloc();
+        }
+        // the tail of the old chunk is lost, which is less than a quarter chunk
+        _cur = chunk;
+        _end = chunk + ProxyArena::CHUNK_SIZE;
+    }
+
+    void *p = _cur;
+    _cur += size;
+
+    return p;
+
+}
+
+void ProxyArena::deallocate(void *p, size_t size) {
+
+    if(!p) {
+        return;
+    }
+
+    if(!_enabled) {
+        ::operator delete(p);
+        return;
+    }
+
+    size = (size + ProxyArena::ALIGNMENT - 1) & ~(ProxyArena::ALIGNMENT - 1);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free[size].push_back(p);
+
+}
+
+}
+}
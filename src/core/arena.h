@@ -0,0 +1,119 @@
+#ifndef PROXY_CORE_ARENA_H_H_H
+#define PROXY_CORE_ARENA_H_H_H
+
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace proxy {
+namespace core {
+
+/*
+ * the memory of the worker bound to its numa node: the blocks are carved from the
+ * large mappings with the node preferred, and kept in the free lists by size after use
+ *
+ * with the huge pages the mappings come from the 2MiB pages of hugetlbfs, or are aligned
+ * and advised to the transparent huge pages when the pool of the huge pages is empty
+ */
+class ProxyArena {
+
+public:
+    // node < 0 enables the arena without binding it to a numa node, the blocks come from
+    // the heap until the arena is set up
+    static bool setup(int);
+
+    // called before the first mapping
+    static void huge_pages(bool);
+
+    // called with every new mapping, e.g. to register it as an io_uring fixed buffer
+    static void map_hook(void (*)(void *, size_t));
+
+    static bool enabled() {
+        return _enabled;
+    }
+
+    static void *allocate(size_t);
+    static void deallocate(void *, size_t);
+
+    static int node() {
+        return _node;
+    }
+
+    static size_t mapped() {
+        return _mapped;
+    }
+
+    static bool huge_pages() {
+        return _huge_pages;
+    }
+
+    // the bytes mapped from hugetlbfs and the ones advised to the transparent huge pages
+    static size_t huge_mapped() {
+        return _huge_mapped;
+    }
+
+    static size_t thp_mapped() {
+        return _thp_mapped;
+    }
+
+    static const size_t CHUNK_SIZE;
+    static const size_t ALIGNMENT;
+    static const size_t HUGE_PAGE_SIZE;
+
+private:
+    static void *_map(size_t);
+    static void *_map_huge(size_t);
+
+    static std::mutex _mutex;
+    static bool _enabled;
+    static int _node;
+    static void (*_hook)(void *, size_t);
+    static char *_cur;
+    static char *_end;
+    static size_t _mapped;
+    static bool _huge_pages;
+    static size_t _huge_mapped;
+    static size_t _thp_mapped;
+    static std::unordered_map<size_t, std::vector<void *>> _free;
+
+};
+
+// for std::allocate_shared, so the objects live in the arena of the worker
+template<typename T>
+class ProxyArenaAllocator {
+
+public:
+    typedef T value_type;
+
+    ProxyArenaAllocator() =default;
+
+    template<typename U>
+    ProxyArenaAllocator(const ProxyArenaAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(ProxyArena::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        ProxyArena::deallocate(p, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const ProxyArenaAllocator<U> &) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const ProxyArenaAllocator<U> &) const {
+        return false;
+    }
+
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,34 @@
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "core/balance.h"
+
+namespace proxy {
+namespace core {
+
+ProxyLoadBoard::ProxyLoadBoard(size_t n) : _loads(nullptr), _size(n) {
+
+    void *p = mmap(NULL, sizeof(ProxyWorkerLoad) * n, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED) {
+        throw std::runtime_error(std::string("map the load board error: ") + strerror(errno));
+    }
+
+    // the anonymous mapping is zero filled, which is a valid state of the lock-free atomics
+    _loads = reinterpret_cast<ProxyWorkerLoad *>(p);
+
+}
+
+ProxyLoadBoard::~ProxyLoadBoard() {
+    if(_loads) {
+        munmap(_loads, sizeof(ProxyWorkerLoad) * _size);
+    }
+}
+
+}
+}
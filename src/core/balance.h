@@ -0,0 +1,55 @@
+#ifndef PROXY_CORE_BALANCE_H_H_H
+#define PROXY_CORE_BALANCE_H_H_H
+
+#include <atomic>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace proxy {
+namespace core {
+
+// the load published by one relay worker, one cache line per worker
+class alignas(64) ProxyWorkerLoad {
+
+public:
+    std::atomic<int64_t> bytes_rate;    // bytes per second over the last interval
+    std::atomic<int64_t> cpu;           // permille of one cpu over the last interval
+    std::atomic<int64_t> tunnels;
+    std::atomic<int64_t> updated;       // the time of the last update, 0 means never
+
+};
+
+/*
+ * the shared memory mapped by the master before forking, so every relay worker sees the
+ * load of the others without any message
+ */
+class ProxyLoadBoard {
+
+public:
+    ProxyLoadBoard(size_t);
+    ProxyLoadBoard(const ProxyLoadBoard &) = delete;
+    ~ProxyLoadBoard();
+
+    size_t size() const {
+        return _size;
+    }
+
+    ProxyWorkerLoad &at(size_t i) {
+        return _loads[i];
+    }
+
+    const ProxyWorkerLoad &at(size_t i) const {
+        return _loads[i];
+    }
+
+private:
+    ProxyWorkerLoad *_loads;
+    size_t _size;
+
+};
+
+}
+}
+
+#endif
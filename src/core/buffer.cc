@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "core/buffer.h"
 
 namespace proxy {
@@ -5,6 +7,133 @@ namespace core {
 
 size_t ProxyBuffer::PROXY_BUFFER_DEFAULT_SIZE = 4096;
 
+// from 64B to 256KiB
+const size_t ProxyBufferPool::MIN_CLASS_SHIFT = 6;
+const size_t ProxyBufferPool::MAX_CLASS_SHIFT = 18;
+const size_t ProxyBufferPool::MAX_CACHED_BYTES = 32 * 1024 * 1024;
+
+std::atomic<uint64_t> ProxyBufferPool::_hits(0);
+std::atomic<uint64_t> ProxyBufferPool::_misses(0);
+std::atomic<uint64_t> ProxyBufferPool::_resident(0);
+std::atomic<uint64_t> ProxyBufferPool::_in_use(0);
+
+ProxyBufferPoolCache::ProxyBufferPoolCache() :
+    classes(ProxyBufferPool::MAX_CLASS_SHIFT - ProxyBufferPool::MIN_CLASS_SHIFT + 1), bytes(0) {}
+
+ProxyBufferPoolCache::~ProxyBufferPoolCache() {
+    for(size_t i = 0; i < classes.size(); ++i) {
+        size_t size = static_cast<size_t>(1) << (i + ProxyBufferPool::MIN_CLASS_SHIFT);
+        for(void *p : classes[i].blocks) {
+            ProxyArena::deallocate(p, size);
+        }
+    }
+    ProxyBufferPool::_resident.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+ProxyBufferPoolCache &ProxyBufferPool::_local() {
+    static thread_local ProxyBufferPoolCache cache;
+    return cache;
+}
+
+int ProxyBufferPool::_class_of(size_t size) {
+
+    if(size > (static_cast<size_t>(1) << ProxyBufferPool::MAX_CLASS_SHIFT)) {
+        return -1;
+    }
+
+    size_t shift = ProxyBufferPool::MIN_CLASS_SHIFT;
+    while((static_cast<size_t>(1) << shift) < size) {
+        ++shift;
+    }
+
+    return static_cast<int>(shift - ProxyBufferPool::MIN_CLASS_SHIFT);
+
+}
+
+void *ProxyBufferPool::acquire(size_t size) {
+
+    int c = _class_of(size);
+    if(c < 0) {
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        void *p = ProxyArena::allocate(size);
+        _in_use.fetch_add(size, std::memory_order_relaxed);
+        return p;
+    }
+
+    size_t csize = static_cast<size_t>(1) << (c + ProxyBufferPool::MIN_CLASS_SHIFT);
+    ProxyBufferPoolCache &cache = _local();
+    ProxyBufferPoolClass &cls = cache.classes[c];
+
+    if(cls.blocks.empty()) {
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        void *p = ProxyArena::allocate(csize);
+        _in_use.fetch_add(csize, std::memory_order_relaxed);
+        return p;
+    }
+
+    void *p = cls.blocks.back();
+    cls.blocks.pop_back();
+    cls.low = std::min(cls.low, cls.blocks.size());
+    cache.bytes -= csize;
+    _resident.fetch_sub(csize, std::memory_order_relaxed);
+    _in_use.fetch_add(csize, std::memory_order_relaxed);
+    _hits.fetch_add(1, std::memory_order_relaxed);
+
+    return p;
+
+}
+
+void ProxyBufferPool::release(void *p, size_t size) {
+
+    if(!p) {
+        return;
+    }
+
+    int c = _class_of(size);
+    if(c < 0) {
+        _in_use.fetch_sub(size, std::memory_order_relaxed);
+        ProxyArena::deallocate(p, size);
+        return;
+    }
+
+    size_t csize = static_cast<size_t>(1) << (c + ProxyBufferPool::MIN_CLASS_SHIFT);
+    _in_use.fetch_sub(csize, std::memory_order_relaxed);
+    ProxyBufferPoolCache &cache = _local();
+    if(cache.bytes + csize > ProxyBufferPool::MAX_CACHED_BYTES) {
+        ProxyArena::deallocate(p, csize);
+        return;
+    }
+
+    cache.classes[c].blocks.push_back(p);
+    cache.bytes += csize;
+    _resident.fetch_add(csize, std::memory_order_relaxed);
+
+}
+
+void ProxyBufferPool::trim() {
+
+    ProxyBufferPoolCache &cache = _local();
+
+    for(size_t i = 0; i < cache.classes.size(); ++i) {
+
+        ProxyBufferPoolClass &cls = cache.classes[i];
+        size_t csize = static_cast<size_t>(1) << (i + ProxyBufferPool::MIN_CLASS_SHIFT);
+
+        // the oldest blocks sit at the bottom of the stack
+        size_t n = std::min(cls.low, cls.blocks.size());
+        for(size_t j = 0; j < n; ++j) {
+            ProxyArena::deallocate(cls.blocks[j], csize);
+        }
+        cls.blocks.erase(cls.blocks.begin(), cls.blocks.begin() + n);
+        cache.bytes -= n * csize;
+        _resident.fetch_sub(n * csize, std::memory_order_relaxed);
+
+        cls.low = cls.blocks.size();
+
+    }
+
+}
+
 char *ProxyBuffer::get_charp_at(size_t n) {
 
     if(start + n >= cur) {
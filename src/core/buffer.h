@@ -1,19 +1,100 @@
 #ifndef PROXY_CORE_BUFFER_H_H_H
 #define PROXY_CORE_BUFFER_H_H_H
 
+#include <atomic>
+#include <vector>
+
+#include <stdint.h>
 #include <sys/types.h>
 
+#include "core/arena.h"
+
 namespace proxy {
 namespace core {
 
+// the free blocks of one size class cached by a thread
+class ProxyBufferPoolClass {
+
+public:
+    ProxyBufferPoolClass() : low(0) {}
+
+    std::vector<void *> blocks;
+
+    // the fewest cached blocks since the last trim, which were idle all the time
+    size_t low;
+
+};
+
+// the free lists of a thread
+class ProxyBufferPoolCache {
+
+public:
+    ProxyBufferPoolCache();
+    ~ProxyBufferPoolCache();
+
+    std::vector<ProxyBufferPoolClass> classes;
+    size_t bytes;
+
+};
+
+/*
+ * the memory of the buffers by the power of two size classes, the freed blocks stay in
+ * the free lists of the thread and the blocks idle for a whole trim interval are given
+ * back to the arena, the sizes above the largest class are not pooled
+ */
+class ProxyBufferPool {
+
+public:
+    static void *acquire(size_t);
+    static void release(void *, size_t);
+
+    // called by the scheduler thread periodically, for the free lists of the caller
+    static void trim();
+
+    static uint64_t hits() {
+        return _hits.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t misses() {
+        return _misses.load(std::memory_order_relaxed);
+    }
+
+    // the bytes cached in the free lists of all the threads
+    static uint64_t resident() {
+        return _resident.load(std::memory_order_relaxed);
+    }
+
+    // the bytes of the blocks held by the buffers
+    static uint64_t in_use() {
+        return _in_use.load(std::memory_order_relaxed);
+    }
+
+    static const size_t MIN_CLASS_SHIFT;
+    static const size_t MAX_CLASS_SHIFT;
+    static const size_t MAX_CACHED_BYTES;
+
+private:
+    friend class ProxyBufferPoolCache;
+
+    static int _class_of(size_t);
+    static ProxyBufferPoolCache &_local();
+
+    static std::atomic<uint64_t> _hits;
+    static std::atomic<uint64_t> _misses;
+    static std::atomic<uint64_t> _resident;
+    static std::atomic<uint64_t> _in_use;
+
+};
+
 class ProxyBuffer {
 
 public:
 
     ProxyBuffer(): ProxyBuffer(ProxyBuffer::PROXY_BUFFER_DEFAULT_SIZE) {}
-    ProxyBuffer(size_t sz) : start(0), cur(0), size(sz), buffer(new char[sz]) {}
+    ProxyBuffer(size_t sz) : start(0), cur(0), size(sz),
+        buffer(static_cast<char *>(ProxyBufferPool::acquire(sz))) {}
     virtual ~ProxyBuffer() {
-        delete []buffer;
+        ProxyBufferPool::release(buffer, size);
     }
 
     bool full() const {
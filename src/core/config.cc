@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <exception>
 #include <iostream>
 #include <sstream>
 
+#include <unistd.h>
+
+#include "core/affinity.h"
 #include "core/config.h"
 #include "glog/logging.h"
 
@@ -13,6 +17,27 @@ const size_t ProxyConfig::PASSWORD_MAX_LENGTH = 64;
 
 const size_t ProxyConfig::DEFAULT_STATISTIC_INTERVAL = 2;
 const size_t ProxyConfig::DEFAULT_MAX_IDLE_TIME = 120;
+const size_t ProxyConfig::DEFAULT_WORKERS = 1;
+const size_t ProxyConfig::DEFAULT_HANDSHAKE_WORKERS = 0;
+const int ProxyConfig::DEFAULT_REBALANCE = 0;
+const int ProxyConfig::DEFAULT_NUMA_ARENA = 0;
+const int ProxyConfig::DEFAULT_HUGE_PAGES = 0;
+const size_t ProxyConfig::DEFAULT_MEMORY_SOFT_LIMIT = 0;
+const size_t ProxyConfig::DEFAULT_MEMORY_HARD_LIMIT = 0;
+const size_t ProxyConfig::DEFAULT_RELAY_BUDGET = 262144;
+const size_t ProxyConfig::DEFAULT_RELAY_BUDGET_TIME = 2000;
+const int ProxyConfig::DEFAULT_IDLE_RELAY = 0;
+const size_t ProxyConfig::DEFAULT_RELAY_RING_SLOTS = 0;
+const size_t ProxyConfig::DEFAULT_IO_URING_ENTRIES = 4096;
+const int ProxyConfig::DEFAULT_IO_URING_SQPOLL = 0;
+const size_t ProxyConfig::DEFAULT_CRYPTO_OFFLOAD_THREADS = 0;
+const size_t ProxyConfig::DEFAULT_CRYPTO_OFFLOAD_THRESHOLD = 16384;
+const size_t ProxyConfig::DEFAULT_CRYPTO_RSA_THREADS = 0;
+const int ProxyConfig::DEFAULT_CRYPTO_CIPHER_BENCHMARK = 1;
+const std::string ProxyConfig::DEFAULT_CRYPTO_KEY_EXCHANGE = "rsa";
+const int ProxyConfig::DEFAULT_CRYPTO_RSA_KEY_CACHE = 0;
+const int ProxyConfig::DEFAULT_CRYPTO_RESUMPTION = 0;
+const size_t ProxyConfig::DEFAULT_CRYPTO_TICKET_LIFETIME = 3600;
 const int ProxyConfig::DEFAULT_LOG_MAX_SIZE = 512;
 const int ProxyConfig::DEFAULT_LOG_FULL_STOP = 0;
 
@@ -156,6 +181,210 @@ bool ProxyConfig::_extract_and_validate(const boost::property_tree::ptree &pt) {
         _max_idle_time = pt.get<size_t>("proxy.max_idle_time",
             ProxyConfig::DEFAULT_MAX_IDLE_TIME);
 
+        // workers=0 means one worker per online cpu
+        _workers = pt.get<size_t>("proxy.workers", ProxyConfig::DEFAULT_WORKERS);
+        if(!_workers) {
+            long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+            _workers = (ncpu > 0) ? static_cast<size_t>(ncpu) : 1;
+        }
+
+        // the decryption server may run the handshakes in dedicated workers, which pass
+        // the established tunnels to the relay workers
+        _handshake_workers = 0;
+        if(_mode == ProxyServerType::Decryption) {
+            _handshake_workers = pt.get<size_t>("proxy.handshake_workers",
+                ProxyConfig::DEFAULT_HANDSHAKE_WORKERS);
+        }
+
+        // move the heavy tunnels from the busy relay workers to the idle ones
+        _rebalance = pt.get<int>("proxy.rebalance", ProxyConfig::DEFAULT_REBALANCE) ? true : false;
+
+        // the worker i is pinned to the i-th cpu of the list, or to the cpu serving the i-th
+        // rx queue of the interface, and allocates from its numa node when numa_arena=1
+        _cpu_affinity_list = pt.get<std::string>("proxy.cpu_affinity", "");
+        if(!_cpu_affinity_list.empty() &&
+            !ProxyAffinity::parse_cpu_list(_cpu_affinity_list, _cpu_affinity)) {
+            std::cerr << "bad cpu list of proxy.cpu_affinity: " << _cpu_affinity_list << std::endl;
+            return false;
+        }
+        _irq_affinity = pt.get<std::string>("proxy.irq_affinity", "");
+        _numa_arena = pt.get<int>("proxy.numa_arena",
+            ProxyConfig::DEFAULT_NUMA_ARENA) ? true : false;
+
+        // the buffers are carved from the 2MiB pages, the transparent huge pages are used
+        // when no huge page is reserved
+        _huge_pages = pt.get<int>("proxy.huge_pages",
+            ProxyConfig::DEFAULT_HUGE_PAGES) ? true : false;
+
+        // the memory budget of every worker in MiB, 0 disables the limit: the relays
+        // shrink their buffers and pause their reads above the soft limit, and the worker
+        // stops accepting above the hard one
+        _memory_soft_limit = pt.get<size_t>("proxy.memory_soft_limit",
+            ProxyConfig::DEFAULT_MEMORY_SOFT_LIMIT);
+        _memory_hard_limit = pt.get<size_t>("proxy.memory_hard_limit",
+            ProxyConfig::DEFAULT_MEMORY_HARD_LIMIT);
+        if(_memory_soft_limit && _memory_hard_limit &&
+            _memory_soft_limit > _memory_hard_limit) {
+            std::cerr << "proxy.memory_soft_limit is larger than proxy.memory_hard_limit"
+                << std::endl;
+            return false;
+        }
+
+        // the chunks not less than the threshold are encrypted/decrypted by the crypto
+        // threads, 0 threads means all of the chunks are handled inline
+        _crypto_offload_threads = 0;
+        _crypto_offload_threshold = ProxyConfig::DEFAULT_CRYPTO_OFFLOAD_THRESHOLD;
+        if(_mode == ProxyServerType::Encryption || _mode == ProxyServerType::Decryption) {
+            _crypto_offload_threads = pt.get<size_t>("crypto.offload_threads",
+                ProxyConfig::DEFAULT_CRYPTO_OFFLOAD_THREADS);
+            _crypto_offload_threshold = pt.get<size_t>("crypto.offload_threshold",
+                ProxyConfig::DEFAULT_CRYPTO_OFFLOAD_THRESHOLD);
+        }
+
+        // only the decryption server owns the rsa private key
+        _crypto_rsa_threads = 0;
+        if(_mode == ProxyServerType::Decryption) {
+            _crypto_rsa_threads = pt.get<size_t>("crypto.rsa_threads",
+                ProxyConfig::DEFAULT_CRYPTO_RSA_THREADS);
+        }
+
+        // the stream ciphers allowed for the relay in the order of preference, the
+        // encryption server offers them and the decryption server picks the first of its
+        // own list in the offer, aes-128-cfb alone is the wire format of the old peers, so
+        // the encryption server offers nothing unless the list is set
+        _crypto_ciphers.clear();
+        _crypto_cipher_benchmark = false;
+        if(_mode == ProxyServerType::Encryption || _mode == ProxyServerType::Decryption) {
+            std::string ciphers = pt.get<std::string>("crypto.ciphers", "");
+            if(_mode == ProxyServerType::Decryption && ciphers.empty()) {
+                _crypto_cipher_benchmark = pt.get<int>("crypto.cipher_benchmark",
+                    ProxyConfig::DEFAULT_CRYPTO_CIPHER_BENCHMARK) ? true : false;
+            }
+            // the measure takes a while, so the master runs it once before the workers are
+            // forked and the result is kept from then on
+            if(_crypto_cipher_benchmark && _crypto_benchmark.empty()) {
+                _crypto_benchmark = proxy::crypto::ProxyCryptoAes::benchmark();
+            }
+            if(!ciphers.empty()) {
+                if(!proxy::crypto::ProxyCryptoCipher::parse_list(ciphers, _crypto_ciphers)) {
+                    std::cerr << "bad cipher list of crypto.ciphers: " << ciphers << std::endl;
+                    return false;
+                }
+            } else if(_mode == ProxyServerType::Encryption) {
+                _crypto_ciphers.push_back(proxy::crypto::ProxyCryptoCipherSuite::AES_128_CFB);
+            } else if(_crypto_cipher_benchmark && !_crypto_benchmark.empty()) {
+                // the fastest suite of this host first, an explicit list always wins
+                std::vector<proxy::crypto::ProxyCryptoCipherSpeed> speeds = _crypto_benchmark;
+                std::stable_sort(speeds.begin(), speeds.end(),
+                    [](const proxy::crypto::ProxyCryptoCipherSpeed &a,
+                        const proxy::crypto::ProxyCryptoCipherSpeed &b) {
+                        return a.small + a.large > b.small + b.large;
+                    });
+                for(const proxy::crypto::ProxyCryptoCipherSpeed &speed : speeds) {
+                    _crypto_ciphers.push_back(speed.suite);
+                }
+            } else {
+                _crypto_ciphers = proxy::crypto::ProxyCryptoCipher::defaults();
+            }
+        }
+
+        // the encryption server opens the tunnels with the rsa exchange of the old peers, or
+        // with an x25519 exchange which settles the keys in one round trip once every peer
+        // is upgraded, the decryption server answers both
+        _crypto_x25519 = false;
+        if(_mode == ProxyServerType::Encryption) {
+            std::string kex = pt.get<std::string>("crypto.key_exchange",
+                ProxyConfig::DEFAULT_CRYPTO_KEY_EXCHANGE);
+            if(kex != "x25519" && kex != "rsa") {
+                std::cerr << "unknown crypto.key_exchange: " << kex << std::endl;
+                return false;
+            }
+            _crypto_x25519 = kex == "x25519";
+        }
+
+        // with the rsa exchange the encryption server keeps the public key of the peer and
+        // sends the aes material at once, the peer answers with its new key after a restart,
+        // off by default since the old peers reject the fingerprint
+        _crypto_rsa_key_cache = false;
+        if(_mode == ProxyServerType::Encryption) {
+            _crypto_rsa_key_cache = pt.get<int>("crypto.rsa_key_cache",
+                ProxyConfig::DEFAULT_CRYPTO_RSA_KEY_CACHE) ? true : false;
+        }
+
+        // the decryption server issues resumption tickets valid for ticket_lifetime seconds
+        // to the authenticated peers, 0 issues none, and the encryption server presents them
+        // instead of the key exchange and the identification when resumption is on, which
+        // is off by default since the old peers reject the ticket request
+        _crypto_resumption = false;
+        _crypto_ticket_lifetime = 0;
+        if(_mode == ProxyServerType::Encryption) {
+            _crypto_resumption = pt.get<int>("crypto.resumption",
+                ProxyConfig::DEFAULT_CRYPTO_RESUMPTION) ? true : false;
+        }
+        if(_mode == ProxyServerType::Decryption) {
+            _crypto_ticket_lifetime = pt.get<size_t>("crypto.ticket_lifetime",
+                ProxyConfig::DEFAULT_CRYPTO_TICKET_LIFETIME);
+        }
+
+        // a relay coroutine yields after moving relay_budget bytes or running
+        // relay_budget_time microseconds without being parked, 0 disables the limit
+        _relay_budget = pt.get<size_t>("proxy.relay_budget", ProxyConfig::DEFAULT_RELAY_BUDGET);
+        _relay_budget_time = pt.get<size_t>("proxy.relay_budget_time",
+            ProxyConfig::DEFAULT_RELAY_BUDGET_TIME);
+
+        // a drained relay direction gives back its coroutine and buffers, and waits for
+        // the socket in the idle poller
+        _idle_relay = pt.get<int>("proxy.idle_relay",
+            ProxyConfig::DEFAULT_IDLE_RELAY) ? true : false;
+
+        // every relay direction reads into a ring of relay_ring_slots chunks drained by its
+        // own writer coroutine, so a slow peer only stops the reader once the ring is full,
+        // 0 keeps the single buffer of the direction
+        _relay_ring_slots = pt.get<size_t>("proxy.relay_ring_slots",
+            ProxyConfig::DEFAULT_RELAY_RING_SLOTS);
+
+        // the socket io goes through the coroutine framework (epoll) or an io_uring of
+        // every worker, sqpoll=1 lets a kernel thread submit the requests
+        std::string io_backend = pt.get<std::string>("proxy.io_backend", "epoll");
+        if(io_backend == "epoll") {
+            _io_uring = false;
+        } else if(io_backend == "io_uring") {
+            _io_uring = true;
+        } else {
+            std::cerr << "unknown io backend: " << io_backend << std::endl;
+            return false;
+        }
+        _io_uring_entries = pt.get<size_t>("proxy.io_uring_entries",
+            ProxyConfig::DEFAULT_IO_URING_ENTRIES);
+        _io_uring_sqpoll = pt.get<int>("proxy.io_uring_sqpoll",
+            ProxyConfig::DEFAULT_IO_URING_SQPOLL) ? true : false;
+
+        // a request of io_uring may have consumed the data when the tunnel is migrated
+        if(_io_uring && _rebalance) {
+            std::cerr << "proxy.rebalance is not supported by the io_uring backend, "
+                "and is disabled" << std::endl;
+            _rebalance = false;
+        }
+
+        // the chunks in the ring are neither parked nor carried by a migration
+        if(_relay_ring_slots && _rebalance) {
+            std::cerr << "proxy.rebalance is not supported with proxy.relay_ring_slots, "
+                "and is disabled" << std::endl;
+            _rebalance = false;
+        }
+        if(_relay_ring_slots && _idle_relay) {
+            std::cerr << "proxy.idle_relay is not supported with proxy.relay_ring_slots, "
+                "and is disabled" << std::endl;
+            _idle_relay = false;
+        }
+
+        // the rebalancer moves a tunnel only while its other direction waits in the idle
+        // poller, which can take the socket out of its epoll
+        if(_rebalance && !_idle_relay) {
+            std::cerr << "proxy.rebalance needs proxy.idle_relay, and is disabled" << std::endl;
+            _rebalance = false;
+        }
+
         _log_dir = pt.get<std::string>("log.dir");
         _log_max_size = pt.get<int>("log.max_size", ProxyConfig::DEFAULT_LOG_MAX_SIZE);
         _log_full_stop = pt.get<int>("log.full_stop",
@@ -231,6 +460,61 @@ std::string ProxyConfig::to_string() const {
         oss << "proxy.remote_port:" << _remote_port << "\n";
     }
     oss << "proxy.listen_backlog:" << _listen_backlog << "\n";
+    oss << "proxy.workers:" << _workers << "\n";
+    if(_mode == ProxyServerType::Decryption) {
+        oss << "proxy.handshake_workers:" << _handshake_workers << "\n";
+    }
+    oss << "proxy.rebalance:" << _rebalance << "\n";
+    oss << "proxy.cpu_affinity:" << _cpu_affinity_list << "\n";
+    oss << "proxy.irq_affinity:" << _irq_affinity << "\n";
+    oss << "proxy.numa_arena:" << _numa_arena << "\n";
+    oss << "proxy.huge_pages:" << _huge_pages << "\n";
+    oss << "proxy.memory_soft_limit:" << _memory_soft_limit << "\n";
+    oss << "proxy.memory_hard_limit:" << _memory_hard_limit << "\n";
+    oss << "proxy.relay_budget:" << _relay_budget << "\n";
+    oss << "proxy.relay_budget_time:" << _relay_budget_time << "\n";
+    oss << "proxy.idle_relay:" << _idle_relay << "\n";
+    oss << "proxy.relay_ring_slots:" << _relay_ring_slots << "\n";
+    oss << "proxy.io_backend:" << (_io_uring ? "io_uring" : "epoll") << "\n";
+    if(_io_uring) {
+        oss << "proxy.io_uring_entries:" << _io_uring_entries << "\n";
+        oss << "proxy.io_uring_sqpoll:" << _io_uring_sqpoll << "\n";
+    }
+
+    if(_mode == ProxyServerType::Encryption || _mode == ProxyServerType::Decryption) {
+        oss << "crypto.offload_threads:" << _crypto_offload_threads << "\n";
+        oss << "crypto.offload_threshold:" << _crypto_offload_threshold << "\n";
+    }
+    if(_mode == ProxyServerType::Decryption) {
+        oss << "crypto.rsa_threads:" << _crypto_rsa_threads << "\n";
+    }
+    if(_mode == ProxyServerType::Encryption) {
+        oss << "crypto.key_exchange:" << (_crypto_x25519 ? "x25519" : "rsa") << "\n";
+        oss << "crypto.rsa_key_cache:" << _crypto_rsa_key_cache << "\n";
+        oss << "crypto.resumption:" << _crypto_resumption << "\n";
+    }
+    if(_mode == ProxyServerType::Decryption) {
+        oss << "crypto.ticket_lifetime:" << _crypto_ticket_lifetime << "\n";
+    }
+    if(_mode == ProxyServerType::Encryption || _mode == ProxyServerType::Decryption) {
+        oss << "crypto.ciphers:"
+            << proxy::crypto::ProxyCryptoCipher::list_string(_crypto_ciphers) << "\n";
+        oss << "crypto.cipher_benchmark:" << _crypto_cipher_benchmark << "\n";
+        if(!_crypto_benchmark.empty()) {
+            oss << "crypto.benchmark:";
+            oss.setf(std::ios::fixed);
+            oss.precision(1);
+            for(const proxy::crypto::ProxyCryptoCipherSpeed &speed : _crypto_benchmark) {
+                oss << proxy::crypto::ProxyCryptoCipher::name(speed.suite)
+                    << "[" << proxy::crypto::ProxyCryptoAes::BENCHMARK_SMALL / 1024 << "K:"
+                    << speed.small << "MB/s]["
+                    << proxy::crypto::ProxyCryptoAes::BENCHMARK_LARGE / 1024 << "K:"
+                    << speed.large << "MB/s]";
+            }
+            oss.unsetf(std::ios::fixed);
+            oss << "\n";
+        }
+    }
 
     oss << "log.dir:" << log_abs_dir() << "\n";
     oss << "log.max_size:" << _log_max_size << "\n";
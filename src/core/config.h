@@ -2,11 +2,15 @@
 #define PROXY_CORE_CONFIG_H_H_H
 
 #include <string>
+#include <vector>
 
 #include "boost/property_tree/ptree.hpp"
 #include "boost/property_tree/ini_parser.hpp"
 #include "boost/filesystem.hpp"
 
+#include "crypto/aes.h"
+#include "crypto/cipher.h"
+
 
 namespace proxy {
 namespace core {
@@ -64,6 +68,110 @@ public:
         return _max_idle_time;
     }
 
+    size_t workers() const {
+        return _workers;
+    }
+
+    size_t handshake_workers() const {
+        return _handshake_workers;
+    }
+
+    bool rebalance() const {
+        return _rebalance;
+    }
+
+    const std::vector<int> &cpu_affinity() const {
+        return _cpu_affinity;
+    }
+
+    const std::string &irq_affinity() const {
+        return _irq_affinity;
+    }
+
+    bool numa_arena() const {
+        return _numa_arena;
+    }
+
+    bool huge_pages() const {
+        return _huge_pages;
+    }
+
+    size_t memory_soft_limit() const {
+        return _memory_soft_limit;
+    }
+
+    size_t memory_hard_limit() const {
+        return _memory_hard_limit;
+    }
+
+    size_t relay_budget() const {
+        return _relay_budget;
+    }
+
+    size_t relay_budget_time() const {
+        return _relay_budget_time;
+    }
+
+    bool idle_relay() const {
+        return _idle_relay;
+    }
+
+    size_t relay_ring_slots() const {
+        return _relay_ring_slots;
+    }
+
+    bool io_uring() const {
+        return _io_uring;
+    }
+
+    size_t io_uring_entries() const {
+        return _io_uring_entries;
+    }
+
+    bool io_uring_sqpoll() const {
+        return _io_uring_sqpoll;
+    }
+
+    size_t crypto_offload_threads() const {
+        return _crypto_offload_threads;
+    }
+
+    size_t crypto_offload_threshold() const {
+        return _crypto_offload_threshold;
+    }
+
+    size_t crypto_rsa_threads() const {
+        return _crypto_rsa_threads;
+    }
+
+    const std::vector<proxy::crypto::ProxyCryptoCipherSuite> &crypto_ciphers() const {
+        return _crypto_ciphers;
+    }
+
+    bool crypto_x25519() const {
+        return _crypto_x25519;
+    }
+
+    bool crypto_rsa_key_cache() const {
+        return _crypto_rsa_key_cache;
+    }
+
+    bool crypto_resumption() const {
+        return _crypto_resumption;
+    }
+
+    size_t crypto_ticket_lifetime() const {
+        return _crypto_ticket_lifetime;
+    }
+
+    bool crypto_cipher_benchmark() const {
+        return _crypto_cipher_benchmark;
+    }
+
+    const std::vector<proxy::crypto::ProxyCryptoCipherSpeed> &crypto_benchmark() const {
+        return _crypto_benchmark;
+    }
+
     std::string log_dir() const {
         return _log_dir;
     }
@@ -111,6 +219,35 @@ private:
     int _listen_backlog;
     size_t _statistic_interval;
     size_t _max_idle_time;
+    size_t _workers;
+    size_t _handshake_workers;
+    bool _rebalance;
+    std::string _cpu_affinity_list;
+    std::vector<int> _cpu_affinity;
+    std::string _irq_affinity;
+    bool _numa_arena;
+    bool _huge_pages;
+    size_t _memory_soft_limit;
+    size_t _memory_hard_limit;
+    size_t _relay_budget;
+    size_t _relay_budget_time;
+    bool _idle_relay;
+    size_t _relay_ring_slots;
+    bool _io_uring;
+    size_t _io_uring_entries;
+    bool _io_uring_sqpoll;
+
+    // the config of the crypto
+    size_t _crypto_offload_threads;
+    size_t _crypto_offload_threshold;
+    size_t _crypto_rsa_threads;
+    std::vector<proxy::crypto::ProxyCryptoCipherSuite> _crypto_ciphers;
+    bool _crypto_cipher_benchmark;
+    bool _crypto_x25519;
+    bool _crypto_rsa_key_cache;
+    bool _crypto_resumption;
+    size_t _crypto_ticket_lifetime;
+    std::vector<proxy::crypto::ProxyCryptoCipherSpeed> _crypto_benchmark;
 
     // the config of the logger
     std::string _log_dir;
@@ -123,6 +260,27 @@ private:
 
     static const size_t DEFAULT_STATISTIC_INTERVAL;
     static const size_t DEFAULT_MAX_IDLE_TIME;
+    static const size_t DEFAULT_WORKERS;
+    static const size_t DEFAULT_HANDSHAKE_WORKERS;
+    static const int DEFAULT_REBALANCE;
+    static const int DEFAULT_NUMA_ARENA;
+    static const int DEFAULT_HUGE_PAGES;
+    static const size_t DEFAULT_MEMORY_SOFT_LIMIT;
+    static const size_t DEFAULT_MEMORY_HARD_LIMIT;
+    static const size_t DEFAULT_RELAY_BUDGET;
+    static const size_t DEFAULT_RELAY_BUDGET_TIME;
+    static const int DEFAULT_IDLE_RELAY;
+    static const size_t DEFAULT_RELAY_RING_SLOTS;
+    static const size_t DEFAULT_IO_URING_ENTRIES;
+    static const int DEFAULT_IO_URING_SQPOLL;
+    static const size_t DEFAULT_CRYPTO_OFFLOAD_THREADS;
+    static const size_t DEFAULT_CRYPTO_OFFLOAD_THRESHOLD;
+    static const size_t DEFAULT_CRYPTO_RSA_THREADS;
+    static const int DEFAULT_CRYPTO_CIPHER_BENCHMARK;
+    static const std::string DEFAULT_CRYPTO_KEY_EXCHANGE;
+    static const int DEFAULT_CRYPTO_RSA_KEY_CACHE;
+    static const int DEFAULT_CRYPTO_RESUMPTION;
+    static const size_t DEFAULT_CRYPTO_TICKET_LIFETIME;
     static const int DEFAULT_LOG_MAX_SIZE;
     static const int DEFAULT_LOG_FULL_STOP;
      
@@ -0,0 +1,60 @@
+#include <time.h>
+
+#include "core/counter.h"
+
+namespace proxy {
+namespace core {
+
+const size_t ProxyTraffic::MAX_SLOTS = 64;
+
+// the last slot is shared by the threads beyond MAX_SLOTS - 1
+ProxyTrafficSlot ProxyTraffic::_slots[ProxyTraffic::MAX_SLOTS];
+ProxyTrafficSlot *const ProxyTraffic::_overflow = &ProxyTraffic::_slots[ProxyTraffic::MAX_SLOTS - 1];
+std::atomic<size_t> ProxyTraffic::_next(0);
+thread_local ProxyTrafficSlot *ProxyTraffic::_slot = nullptr;
+
+ProxyTrafficTotal ProxyTrafficTotal::operator-(const ProxyTrafficTotal &o) const {
+    ProxyTrafficTotal d;
+    for(size_t i = 0; i < 2; ++i) {
+        d.bytes[i] = bytes[i] - o.bytes[i];
+        d.reads[i] = reads[i] - o.reads[i];
+        d.writes[i] = writes[i] - o.writes[i];
+        d.crypto_ns[i] = crypto_ns[i] - o.crypto_ns[i];
+    }
+    return d;
+}
+
+ProxyTrafficSlot *ProxyTraffic::_claim() {
+    size_t i = _next.fetch_add(1, std::memory_order_relaxed);
+    _slot = (i < ProxyTraffic::MAX_SLOTS - 1) ? &_slots[i] : _overflow;
+    return _slot;
+}
+
+ProxyTrafficTotal ProxyTraffic::total() {
+
+    ProxyTrafficTotal t;
+    // only the claimed slots, the overflow slot is the last one
+    size_t n = _next.load(std::memory_order_relaxed);
+    n = (n < ProxyTraffic::MAX_SLOTS) ? n : ProxyTraffic::MAX_SLOTS;
+
+    for(size_t i = 0; i < n; ++i) {
+        for(size_t j = 0; j < 2; ++j) {
+            t.bytes[j] += _slots[i].bytes[j].load(std::memory_order_relaxed);
+            t.reads[j] += _slots[i].reads[j].load(std::memory_order_relaxed);
+            t.writes[j] += _slots[i].writes[j].load(std::memory_order_relaxed);
+            t.crypto_ns[j] += _slots[i].crypto_ns[j].load(std::memory_order_relaxed);
+        }
+    }
+
+    return t;
+
+}
+
+uint64_t ProxyTraffic::now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+}
+}
@@ -0,0 +1,95 @@
+#ifndef PROXY_CORE_COUNTER_H_H_H
+#define PROXY_CORE_COUNTER_H_H_H
+
+#include <atomic>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace proxy {
+namespace core {
+
+/*
+ * the traffic counters of one thread, the index is 0 for the ep0-ep1 direction and 1 for
+ * the ep1-ep0 direction, exactly one cache line so no two threads share a line
+ */
+class alignas(64) ProxyTrafficSlot {
+
+public:
+    std::atomic<uint64_t> bytes[2];
+    std::atomic<uint64_t> reads[2];
+    std::atomic<uint64_t> writes[2];
+    std::atomic<uint64_t> crypto_ns[2];
+
+};
+
+// the plain copy of the counters summed over all of the threads
+class ProxyTrafficTotal {
+
+public:
+    ProxyTrafficTotal() : bytes{0, 0}, reads{0, 0}, writes{0, 0}, crypto_ns{0, 0} {}
+
+    ProxyTrafficTotal operator-(const ProxyTrafficTotal &) const;
+
+    uint64_t bytes[2];
+    uint64_t reads[2];
+    uint64_t writes[2];
+    uint64_t crypto_ns[2];
+
+};
+
+class ProxyTraffic {
+
+public:
+    // flag: true for the ep0-ep1 direction, false for the ep1-ep0 direction
+    static void add_bytes(bool flag, uint64_t n) {
+        _add(_local()->bytes[flag ? 0 : 1], n);
+    }
+
+    static void add_read(bool flag) {
+        _add(_local()->reads[flag ? 0 : 1], 1);
+    }
+
+    static void add_write(bool flag) {
+        _add(_local()->writes[flag ? 0 : 1], 1);
+    }
+
+    static void add_crypto_ns(bool flag, uint64_t ns) {
+        _add(_local()->crypto_ns[flag ? 0 : 1], ns);
+    }
+
+    // the counters only grow, the readers take the difference of two totals
+    static ProxyTrafficTotal total();
+
+    static uint64_t now_ns();
+
+    static const size_t MAX_SLOTS;
+
+private:
+    static ProxyTrafficSlot *_local() {
+        return _slot ? _slot : _claim();
+    }
+
+    static void _add(std::atomic<uint64_t> &c, uint64_t n) {
+        // a slot has a single writer except the shared overflow one, so a plain
+        // load and store is enough and avoids the locked instruction
+        if(_slot != _overflow) {
+            c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        } else {
+            c.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    static ProxyTrafficSlot *_claim();
+
+    static ProxyTrafficSlot _slots[];
+    static ProxyTrafficSlot *const _overflow;
+    static std::atomic<size_t> _next;
+    static thread_local ProxyTrafficSlot *_slot;
+
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include <exception>
+#include <stdexcept>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "core/event.h"
+
+namespace proxy {
+namespace core {
+
+ProxyEvent::ProxyEvent() : _waiter(std::make_shared<ProxyUdpSocket>(AF_UNIX, 0)),
+    _buf(std::make_shared<ProxyBuffer>(1)), _notifier(-1) {
+
+    // binding only the family makes the kernel pick a unique abstract name
+    struct sockaddr_un addr;
+    socklen_t addrlen = sizeof(sa_family_t);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(_waiter->bind(reinterpret_cast<const struct sockaddr *>(&addr), addrlen) < 0) {
+        throw std::runtime_error(std::string("bind the event socket error: ") + strerror(errno));
+    }
+
+    addrlen = sizeof(addr);
+    if(getsockname(_waiter->fileno(), reinterpret_cast<struct sockaddr *>(&addr),
+        &addrlen) < 0) {
+        throw std::runtime_error(std::string("get the event socket name error: ")
+            + strerror(errno));
+    }
+
+    if((_notifier = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        throw std::runtime_error(std::string("create the event notifier error: ")
+            + strerror(errno));
+    }
+
+    if(connect(_notifier, reinterpret_cast<const struct sockaddr *>(&addr), addrlen) < 0) {
+        int err = errno;
+        ::close(_notifier);
+        throw std::runtime_error(std::string("connect the event notifier error: ")
+            + strerror(err));
+    }
+
+}
+
+ProxyEvent::~ProxyEvent() {
+    if(_notifier >= 0) {
+        ::close(_notifier);
+    }
+}
+
+bool ProxyEvent::wait() {
+    _buf->clear();
+    return _waiter->recvfrom(_buf, 0, NULL, NULL) > 0;
+}
+
+void ProxyEvent::notify() {
+    char c = 0;
+    ::send(_notifier, &c, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+}
+}
@@ -0,0 +1,39 @@
+#ifndef PROXY_CORE_EVENT_H_H_H
+#define PROXY_CORE_EVENT_H_H_H
+
+#include <memory>
+
+#include "core/buffer.h"
+#include "core/socket.h"
+
+namespace proxy {
+namespace core {
+
+/*
+ * wake up a coroutine from any thread: the coroutine parks on a unix datagram socket
+ * and notify() sends one byte to it, so the scheduler never blocks on a lock
+ */
+class ProxyEvent {
+
+public:
+    ProxyEvent();
+    ProxyEvent(const ProxyEvent &) = delete;
+    ~ProxyEvent();
+
+    // called by the coroutine, returns false when the socket is broken
+    bool wait();
+
+    // called by any thread, at most one pending notification per wait
+    void notify();
+
+private:
+    std::shared_ptr<ProxySocket> _waiter;
+    std::shared_ptr<ProxyBuffer> _buf;
+    int _notifier;
+
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <sstream>
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "core/arena.h"
+#include "core/handoff.h"
+#include "core/server.h"
+#include "core/tunnel.h"
+#include "crypto/aes.h"
+
+#include "glog/logging.h"
+
+namespace proxy {
+namespace core {
+
+const uint32_t ProxyHandoff::VERSION = 2;
+int ProxyHandoff::_sender = -1;
+
+static socklen_t _abstract_address(const std::string &name, struct sockaddr_un &addr) {
+
+    // the linux abstract namespace: a leading '\0' and no file system entry
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    size_t len = std::min(name.size(), sizeof(addr.sun_path) - 1);
+    memcpy(addr.sun_path + 1, name.c_str(), len);
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + 1 + len);
+
+}
+
+static void _copy_field(char *dst, size_t cap, uint8_t &len, const std::string &src) {
+    len = static_cast<uint8_t>(std::min(src.size(), cap));
+    memcpy(dst, src.data(), len);
+}
+
+std::string ProxyHandoff::relay_address(pid_t master, size_t id) {
+    std::ostringstream oss;
+    oss << "proxy." << master << ".relay." << id;
+    return oss.str();
+}
+
+bool ProxyHandoff::send(const std::shared_ptr<ProxyTunnel> &tunnel, const std::string &dest) {
+
+    if(_sender < 0) {
+        if((_sender = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+            LOG(ERROR) << "create the handoff socket error: " << strerror(errno);
+            return false;
+        }
+    }
+
+    ProxyHandoffMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.version = ProxyHandoff::VERSION;
+    msg.state = static_cast<int32_t>(tunnel->state());
+
+    // the hosts are cut to the fields, and the memset above keeps them terminated
+    const std::string &ep0_host = tunnel->ep0()->host();
+    const std::string &ep1_host = tunnel->ep1()->host();
+    memcpy(msg.ep0_host, ep0_host.data(), std::min(ep0_host.size(), sizeof(msg.ep0_host) - 1));
+    msg.ep0_port = tunnel->ep0()->port();
+    memcpy(msg.ep1_host, ep1_host.data(), std::min(ep1_host.size(), sizeof(msg.ep1_host) - 1));
+    msg.ep1_port = tunnel->ep1()->port();
+
+    // the transmission mode tunnels have no aes contexts
+    if(tunnel->aes_ctx().ready() && tunnel->aes_ctx_peer().ready()) {
+
+        std::string key;
+        std::string iv;
+        int num;
+        uint8_t len;
+
+        msg.cipher = static_cast<uint8_t>(tunnel->cipher());
+
+        if(!tunnel->aes_ctx().snapshot(key, iv, num)) {
+            LOG(ERROR) << tunnel->ep0_ep1_string() << ": snapshot the aes context error";
+            return false;
+        }
+        _copy_field(msg.aes_key, sizeof(msg.aes_key), len, key);
+        msg.aes_key_len = len;
+        _copy_field(msg.aes_iv, sizeof(msg.aes_iv), len, iv);
+        msg.aes_iv_len = len;
+        msg.aes_num = num;
+
+        if(!tunnel->aes_ctx_peer().snapshot(key, iv, num)) {
+            LOG(ERROR) << tunnel->ep0_ep1_string() << ": snapshot the peer aes context error";
+            return false;
+        }
+        _copy_field(msg.aes_key_peer, sizeof(msg.aes_key_peer), len, key);
+        msg.aes_key_peer_len = len;
+        _copy_field(msg.aes_iv_peer, sizeof(msg.aes_iv_peer), len, iv);
+        msg.aes_iv_peer_len = len;
+        msg.aes_num_peer = num;
+
+    }
+
+    int fds[2] = {tunnel->ep0()->fileno(), tunnel->ep1()->fileno()};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+
+    struct sockaddr_un addr;
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = &addr;
+    mh.msg_namelen = _abstract_address(dest, addr);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+
+    if(sendmsg(_sender, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(msg))) {
+        return false;
+    }
+
+    return true;
+
+}
+
+std::shared_ptr<ProxySocket> ProxyHandoff::listen(const std::string &name) {
+
+    std::shared_ptr<ProxySocket> sock;
+
+    try {
+        sock = std::make_shared<ProxyUdpSocket>(AF_UNIX, 0);
+    } catch (const std::exception &ex) {
+        LOG(ERROR) << "create the handoff socket " << name << " error: " << ex.what();
+        return nullptr;
+    }
+
+    struct sockaddr_un addr;
+    socklen_t addrlen = _abstract_address(name, addr);
+    if(sock->bind(reinterpret_cast<const struct sockaddr *>(&addr), addrlen) < 0) {
+        LOG(ERROR) << "bind the handoff socket " << name << " error: " << strerror(errno);
+        return nullptr;
+    }
+    sock->host(name);
+
+    return sock;
+
+}
+
+std::shared_ptr<ProxyTunnel> ProxyHandoff::receive(const std::shared_ptr<ProxySocket> &sock,
+    ProxyServer *server) {
+
+    // park the coroutine until a message is queued, the message itself stays queued
+    std::shared_ptr<ProxyBuffer> peek = std::make_shared<ProxyBuffer>(1);
+    std::shared_ptr<ProxySocket> s = sock;
+    if(s->recvfrom(peek, MSG_PEEK, NULL, NULL) < 0) {
+        LOG(ERROR) << "wait on the handoff socket error: " << strerror(errno);
+        return nullptr;
+    }
+
+    ProxyHandoffMessage msg;
+    int fds[2] = {-1, -1};
+    char control[CMSG_SPACE(sizeof(fds))];
+
+    struct iovec iov;
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(sock->fileno(), &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if(n < 0) {
+        if(errno != EAGAIN) {
+            LOG(ERROR) << "receive from the handoff socket error: " << strerror(errno);
+        }
+        return nullptr;
+    }
+
+    for(struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+            cm->cmsg_len == CMSG_LEN(sizeof(fds))) {
+            memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+        }
+    }
+
+    if(n != static_cast<ssize_t>(sizeof(msg)) || msg.version != ProxyHandoff::VERSION ||
+        fds[0] < 0 || fds[1] < 0 || (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        LOG(ERROR) << "receive a malformed handoff message";
+        for(int fd : fds) {
+            if(fd >= 0) {
+                ::close(fd);
+            }
+        }
+        return nullptr;
+    }
+
+    msg.ep0_host[sizeof(msg.ep0_host) - 1] = '\0';
+    msg.ep1_host[sizeof(msg.ep1_host) - 1] = '\0';
+
+    std::shared_ptr<ProxySocket> ep0;
+    std::shared_ptr<ProxySocket> ep1;
+    try {
+        ep0.reset(ProxyTcpSocket::adopt(fds[0], msg.ep0_host, msg.ep0_port),
+            std::default_delete<ProxySocket>(), ProxySlabAllocator<ProxySocket>());
+        fds[0] = -1;
+        ep1.reset(ProxyTcpSocket::adopt(fds[1], msg.ep1_host, msg.ep1_port),
+            std::default_delete<ProxySocket>(), ProxySlabAllocator<ProxySocket>());
+        fds[1] = -1;
+    } catch (const std::exception &ex) {
+        LOG(ERROR) << "adopt the handoff descriptors error: " << ex.what();
+        for(int fd : fds) {
+            if(fd >= 0) {
+                ::close(fd);
+            }
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<ProxyTunnel> tunnel = std::allocate_shared<ProxyTunnel>(
+        ProxySlabAllocator<ProxyTunnel>(), std::move(ep0), std::move(ep1), server,
+        static_cast<ProxyStmState>(msg.state));
+
+    if(!msg.aes_key_len) {
+        return tunnel;
+    }
+
+    using proxy::crypto::ProxyCryptoAesContextType;
+    using proxy::crypto::ProxyCryptoCipher;
+    using proxy::crypto::ProxyCryptoCipherSuite;
+
+    ProxyCryptoCipherSuite suite;
+    if(!ProxyCryptoCipher::from_id(msg.cipher, suite)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": unknown handoff cipher "
+            << static_cast<int>(msg.cipher);
+        tunnel->close();
+        return nullptr;
+    }
+    tunnel->cipher(suite);
+
+    if(!tunnel->aes_ctx().restore(ProxyCryptoAesContextType::AES_CONTEXT_ENCRYPT_TYPE, suite,
+        std::string(msg.aes_key, msg.aes_key_len), std::string(msg.aes_iv, msg.aes_iv_len),
+        msg.aes_num) ||
+        !tunnel->aes_ctx_peer().restore(ProxyCryptoAesContextType::AES_CONTEXT_DECRYPT_TYPE,
+        suite, std::string(msg.aes_key_peer, msg.aes_key_peer_len),
+        std::string(msg.aes_iv_peer, msg.aes_iv_peer_len), msg.aes_num_peer)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": restore the handoff aes contexts error";
+        tunnel->close();
+        return nullptr;
+    }
+
+    return tunnel;
+
+}
+
+}
+}
@@ -0,0 +1,74 @@
+#ifndef PROXY_CORE_HANDOFF_H_H_H
+#define PROXY_CORE_HANDOFF_H_H_H
+
+#include <memory>
+#include <string>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "openssl/evp.h"
+
+#include "core/socket.h"
+
+namespace proxy {
+namespace core {
+
+class ProxyServer;
+class ProxyTunnel;
+
+/*
+ * the established tunnel passed between the workers of the same master, the two
+ * descriptors travel along as SCM_RIGHTS
+ */
+class ProxyHandoffMessage {
+
+public:
+    uint32_t version;
+    int32_t state;
+
+    char ep0_host[INET_ADDRSTRLEN];
+    uint16_t ep0_port;
+    char ep1_host[INET_ADDRSTRLEN];
+    uint16_t ep1_port;
+
+    // the suite of both contexts
+    uint8_t cipher;
+
+    uint8_t aes_key_len;
+    uint8_t aes_iv_len;
+    int32_t aes_num;
+    char aes_key[EVP_MAX_KEY_LENGTH];
+    char aes_iv[EVP_MAX_IV_LENGTH];
+
+    uint8_t aes_key_peer_len;
+    uint8_t aes_iv_peer_len;
+    int32_t aes_num_peer;
+    char aes_key_peer[EVP_MAX_KEY_LENGTH];
+    char aes_iv_peer[EVP_MAX_IV_LENGTH];
+
+};
+
+class ProxyHandoff {
+
+public:
+    static std::string relay_address(pid_t, size_t);
+
+    // non-blocking, the errno is EAGAIN when the queue of the receiver is full
+    static bool send(const std::shared_ptr<ProxyTunnel> &, const std::string &);
+    static std::shared_ptr<ProxySocket> listen(const std::string &);
+    static std::shared_ptr<ProxyTunnel> receive(const std::shared_ptr<ProxySocket> &,
+        ProxyServer *);
+
+    static const uint32_t VERSION;
+
+private:
+    static int _sender;
+
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,244 @@
+#include <exception>
+#include <stdexcept>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "core/idle.h"
+#include "core/stm.h"
+#include "core/tunnel.h"
+#include "glog/logging.h"
+
+namespace proxy {
+namespace core {
+
+const int ProxyIdlePoller::EPOLL_BATCH = 256;
+
+ProxyIdlePoller::ProxyIdlePoller() : _epfd(-1), _stopfd(-1), _wakeups(0) {
+
+    if((_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        throw std::runtime_error(std::string("create the idle epoll error: ") + strerror(errno));
+    }
+
+    if((_stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        int err = errno;
+        ::close(_epfd);
+        throw std::runtime_error(std::string("create the idle stop event error: ")
+            + strerror(err));
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = _stopfd;
+    if(epoll_ctl(_epfd, EPOLL_CTL_ADD, _stopfd, &ev) < 0) {
+        int err = errno;
+        ::close(_stopfd);
+        ::close(_epfd);
+        throw std::runtime_error(std::string("watch the idle stop event error: ")
+            + strerror(err));
+    }
+
+    // the signals are handled by the main thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    try {
+        _thread = std::thread(&ProxyIdlePoller::_run, this);
+    } catch (const std::exception &ex) {
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        ::close(_stopfd);
+        ::close(_epfd);
+        throw std::runtime_error(std::string("start the idle thread error: ") + ex.what());
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+}
+
+ProxyIdlePoller::~ProxyIdlePoller() {
+
+    uint64_t one = 1;
+    if(::write(_stopfd, &one, sizeof(one)) == sizeof(one)) {
+        _thread.join();
+    } else {
+        _thread.detach();
+    }
+
+    ::close(_stopfd);
+    ::close(_epfd);
+
+}
+
+void ProxyIdlePoller::_run() {
+
+    std::vector<struct epoll_event> events(ProxyIdlePoller::EPOLL_BATCH);
+
+    while(1) {
+
+        int n = epoll_wait(_epfd, events.data(), ProxyIdlePoller::EPOLL_BATCH, -1);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            LOG(ERROR) << "wait on the idle epoll error: " << strerror(errno);
+            return;
+        }
+
+        bool stop = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for(int i = 0; i < n; ++i) {
+                if(events[i].data.fd == _stopfd) {
+                    stop = true;
+                } else {
+                    _ready.push_back(events[i].data.fd);
+                }
+            }
+        }
+
+        if(stop) {
+            return;
+        }
+
+        _event.notify();
+
+    }
+
+}
+
+bool ProxyIdlePoller::park(const std::shared_ptr<ProxyTunnel> &tunnel, bool flag) {
+
+    int fd = flag ? tunnel->ep0()->fileno() : tunnel->ep1()->fileno();
+    if(fd < 0 || _parked.count(fd)) {
+        return false;
+    }
+
+    // one shot, the dispatcher removes the descriptor before the relay goes on with it
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if(epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG(WARNING) << tunnel->ep0_ep1_string() << ": park the idle direction error: "
+            << strerror(errno);
+        return false;
+    }
+
+    _parked[fd] = ProxyIdleDirection{tunnel, flag};
+
+    // the rebalancer only moves a tunnel whose other direction is parked here
+    tunnel->parked(flag, true);
+
+    return true;
+
+}
+
+bool ProxyIdlePoller::_drop(int fd, ProxyTunnel *tunnel) {
+
+    auto it = _parked.find(fd);
+    if(it == _parked.end() || (tunnel && it->second.tunnel.get() != tunnel)) {
+        return false;
+    }
+
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
+    it->second.tunnel->parked(it->second.flag, false);
+    _parked.erase(it);
+
+    return true;
+
+}
+
+bool ProxyIdlePoller::release(const std::shared_ptr<ProxyTunnel> &tunnel, bool flag) {
+
+    const std::shared_ptr<ProxySocket> &ep = flag ? tunnel->ep0() : tunnel->ep1();
+    if(!ep || ep->fileno() < 0) {
+        return false;
+    }
+
+    return _drop(ep->fileno(), tunnel.get());
+
+}
+
+void ProxyIdlePoller::unpark(ProxyTunnel *tunnel) {
+
+    for(bool flag : {true, false}) {
+
+        const std::shared_ptr<ProxySocket> &ep = flag ? tunnel->ep0() : tunnel->ep1();
+        if(!ep || ep->fileno() < 0) {
+            continue;
+        }
+
+        auto it = _parked.find(ep->fileno());
+        if(it == _parked.end() || it->second.tunnel.get() != tunnel) {
+            continue;
+        }
+
+        // the tunnel may be closed by itself, so the last reference goes away later in
+        // the dispatcher
+        std::shared_ptr<ProxyTunnel> t = it->second.tunnel;
+        _drop(ep->fileno(), tunnel);
+        ProxyStm::relay_end(t);
+        _released.push_back(std::move(t));
+
+    }
+
+    if(!_released.empty()) {
+        _event.notify();
+    }
+
+}
+
+void *ProxyIdlePoller::dispatch(void *args) {
+
+    ProxyIdlePoller *poller = reinterpret_cast<ProxyIdlePoller *>(args);
+    std::vector<int> ready;
+
+    while(1) {
+
+        if(!poller->_event.wait()) {
+            LOG(ERROR) << "wait on the idle event error: " << strerror(errno);
+            co_usleep(1000);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(poller->_mutex);
+            ready.swap(poller->_ready);
+        }
+
+        poller->_released.clear();
+
+        for(int fd : ready) {
+
+            auto it = poller->_parked.find(fd);
+            if(it == poller->_parked.end()) {
+                continue;
+            }
+
+            std::shared_ptr<ProxyTunnel> tunnel = it->second.tunnel;
+            bool flag = it->second.flag;
+            poller->_drop(fd, nullptr);
+            ++poller->_wakeups;
+
+            if(!ProxyStm::relay(tunnel, flag)) {
+                ProxyStm::relay_end(tunnel);
+            }
+
+        }
+
+        ready.clear();
+
+    }
+
+    return nullptr;
+
+}
+
+}
+}
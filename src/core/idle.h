@@ -0,0 +1,88 @@
+#ifndef PROXY_CORE_IDLE_H_H_H
+#define PROXY_CORE_IDLE_H_H_H
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+
+#include "core/event.h"
+
+namespace proxy {
+namespace core {
+
+class ProxyTunnel;
+
+// a direction of the tunnel which waits for its socket, flag as the relay coroutines
+class ProxyIdleDirection {
+
+public:
+    std::shared_ptr<ProxyTunnel> tunnel;
+    bool flag;
+
+};
+
+/*
+ * the idle directions of the tunnels own neither a coroutine nor a buffer: the socket
+ * waits in an epoll of a plain thread, which wakes up the dispatcher coroutine through
+ * the ProxyEvent, and the dispatcher starts a new relay coroutine for every ready one
+ *
+ *   relay coroutine --park--> epoll (thread) --ready--> dispatcher --ProxyStm::relay-->
+ */
+class ProxyIdlePoller {
+
+public:
+    ProxyIdlePoller();
+    ProxyIdlePoller(const ProxyIdlePoller &) = delete;
+    ~ProxyIdlePoller();
+
+    // called by the relay coroutine which found its socket drained, false when the
+    // direction must keep its coroutine
+    bool park(const std::shared_ptr<ProxyTunnel> &, bool);
+
+    // the socket of the parked direction leaves the epoll, and the direction is neither
+    // resumed nor ended by the poller, false when it is not parked
+    bool release(const std::shared_ptr<ProxyTunnel> &, bool);
+
+    // the tunnel is closing, its parked directions end here
+    void unpark(ProxyTunnel *);
+
+    size_t parked() const {
+        return _parked.size();
+    }
+
+    int64_t wakeups() const {
+        return _wakeups;
+    }
+
+    // the dispatcher coroutine, args is the poller
+    static void *dispatch(void *);
+
+private:
+    void _run();
+    bool _drop(int, ProxyTunnel *);
+
+    int _epfd;
+    int _stopfd;
+    ProxyEvent _event;
+    std::thread _thread;
+
+    std::mutex _mutex;
+    std::vector<int> _ready;
+
+    // the parked directions by the descriptor, only touched by the scheduler thread
+    std::unordered_map<int, ProxyIdleDirection> _parked;
+    std::vector<std::shared_ptr<ProxyTunnel>> _released;
+    int64_t _wakeups;
+
+    static const int EPOLL_BATCH;
+
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,45 @@
+#include "core/buffer.h"
+#include "core/memory.h"
+#include "core/slab.h"
+
+namespace proxy {
+namespace core {
+
+const long long ProxyMemoryBudget::READ_PAUSE = 1000;
+const long long ProxyMemoryBudget::ACCEPT_PAUSE = 10000;
+
+size_t ProxyMemoryBudget::_soft = 0;
+size_t ProxyMemoryBudget::_hard = 0;
+std::atomic<int64_t> ProxyMemoryBudget::_read_throttles(0);
+std::atomic<int64_t> ProxyMemoryBudget::_accept_throttles(0);
+
+void ProxyMemoryBudget::setup(size_t soft, size_t hard) {
+    _soft = soft;
+    _hard = hard;
+}
+
+size_t ProxyMemoryBudget::usage() {
+    return static_cast<size_t>(ProxyBufferPool::in_use() + ProxyBufferPool::resident()) +
+        static_cast<size_t>(ProxySlab::bytes());
+}
+
+ProxyMemoryPressure ProxyMemoryBudget::pressure() {
+
+    if(!enabled()) {
+        return ProxyMemoryPressure::Normal;
+    }
+
+    size_t n = usage();
+    if(_hard && n >= _hard) {
+        return ProxyMemoryPressure::Hard;
+    }
+    if(_soft && n >= _soft) {
+        return ProxyMemoryPressure::Soft;
+    }
+
+    return ProxyMemoryPressure::Normal;
+
+}
+
+}
+}
@@ -0,0 +1,78 @@
+#ifndef PROXY_CORE_MEMORY_H_H_H
+#define PROXY_CORE_MEMORY_H_H_H
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace proxy {
+namespace core {
+
+enum class ProxyMemoryPressure {
+    Normal,
+    Soft,
+    Hard
+};
+
+/*
+ * the memory budget of the worker, counted over the buffers (held and cached) and the
+ * slabs of the tunnel objects:
+ *
+ *   soft: the relays attach the smallest buffers and pause before every read
+ *   hard: the worker stops accepting until the usage drops below the limit
+ */
+class ProxyMemoryBudget {
+
+public:
+    // in bytes, 0 disables the limit
+    static void setup(size_t, size_t);
+
+    static bool enabled() {
+        return _soft || _hard;
+    }
+
+    static size_t usage();
+    static ProxyMemoryPressure pressure();
+
+    static size_t soft_limit() {
+        return _soft;
+    }
+
+    static size_t hard_limit() {
+        return _hard;
+    }
+
+    static void add_read_throttle() {
+        _read_throttles.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void add_accept_throttle() {
+        _accept_throttles.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static int64_t read_throttles() {
+        return _read_throttles.load(std::memory_order_relaxed);
+    }
+
+    static int64_t accept_throttles() {
+        return _accept_throttles.load(std::memory_order_relaxed);
+    }
+
+    // the pause of a read near the soft limit and of the accepts at the hard limit, in
+    // microseconds
+    static const long long READ_PAUSE;
+    static const long long ACCEPT_PAUSE;
+
+private:
+    static size_t _soft;
+    static size_t _hard;
+    static std::atomic<int64_t> _read_throttles;
+    static std::atomic<int64_t> _accept_throttles;
+
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,47 @@
+#include "core/ring.h"
+
+namespace proxy {
+namespace core {
+
+ProxyRelayRing::ProxyRelayRing(size_t slots) : _slots(slots ? slots : 1), _head(0), _tail(0),
+    _finished(false), _aborted(false), _space_waiting(false), _data_waiting(false) {}
+
+void ProxyRelayRing::push() {
+    ++_tail;
+    _wake(_data, _data_waiting);
+}
+
+void ProxyRelayRing::pop() {
+    ++_head;
+    _wake(_space, _space_waiting);
+}
+
+void ProxyRelayRing::finish() {
+    _finished = true;
+    _wake(_data, _data_waiting);
+}
+
+void ProxyRelayRing::abort() {
+    _aborted = true;
+    _wake(_space, _space_waiting);
+}
+
+bool ProxyRelayRing::_wait(ProxyEvent &event, bool &waiting) {
+    waiting = true;
+    if(!event.wait()) {
+        waiting = false;
+        return false;
+    }
+    return true;
+}
+
+void ProxyRelayRing::_wake(ProxyEvent &event, bool &waiting) {
+    // only one notification per wait, or the next wait returns at once
+    if(waiting) {
+        waiting = false;
+        event.notify();
+    }
+}
+
+}
+}
@@ -0,0 +1,95 @@
+#ifndef PROXY_CORE_RING_H_H_H
+#define PROXY_CORE_RING_H_H_H
+
+#include <memory>
+#include <vector>
+
+#include "core/buffer.h"
+#include "core/event.h"
+
+namespace proxy {
+namespace core {
+
+/*
+ * the chunks of a relay direction between its reader and its writer coroutine, the
+ * reader fills and ciphers the slot at the tail while the writer drains the one at the
+ * head, and a full ring stops the reader
+ *
+ *   source --read--> [tail] ... [head] --write--> destination
+ */
+class ProxyRelayRing {
+
+public:
+    explicit ProxyRelayRing(size_t);
+    ProxyRelayRing(const ProxyRelayRing &) = delete;
+
+    bool empty() const {
+        return _head == _tail;
+    }
+
+    bool full() const {
+        return _tail - _head == _slots.size();
+    }
+
+    size_t slots() const {
+        return _slots.size();
+    }
+
+    // the slot filled by the reader, valid while the ring is not full
+    std::shared_ptr<ProxyBuffer> &back() {
+        return _slots[_tail % _slots.size()];
+    }
+
+    // the slot drained by the writer, valid while the ring is not empty
+    std::shared_ptr<ProxyBuffer> &front() {
+        return _slots[_head % _slots.size()];
+    }
+
+    void push();
+    void pop();
+
+    // the reader met the end of the source, the writer exits once the ring is drained
+    void finish();
+
+    bool finished() const {
+        return _finished;
+    }
+
+    // the writer failed, the reader exits before its next read
+    void abort();
+
+    bool aborted() const {
+        return _aborted;
+    }
+
+    // the reader waits for a free slot and the writer for a filled one, false when the
+    // event is broken
+    bool wait_space() {
+        return _wait(_space, _space_waiting);
+    }
+
+    bool wait_data() {
+        return _wait(_data, _data_waiting);
+    }
+
+private:
+    static bool _wait(ProxyEvent &, bool &);
+    static void _wake(ProxyEvent &, bool &);
+
+    std::vector<std::shared_ptr<ProxyBuffer>> _slots;
+    size_t _head;
+    size_t _tail;
+    bool _finished;
+    bool _aborted;
+
+    ProxyEvent _space;
+    bool _space_waiting;
+    ProxyEvent _data;
+    bool _data_waiting;
+
+};
+
+}
+}
+
+#endif
@@ -10,17 +10,29 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <functional>
+#include <sstream>
 #include <vector>
 #include <string>
 
 #include "boost/filesystem.hpp"
 #include "boost/filesystem/fstream.hpp"
+#include "openssl/rand.h"
 
+#include "core/affinity.h"
+#include "core/arena.h"
+#include "core/handoff.h"
+#include "core/memory.h"
 #include "core/server.h"
 #include "core/stm.h"
 #include "core/tunnel.h"
+#include "core/uring.h"
 
 #include "glog/logging.h"
 
@@ -29,6 +41,13 @@ namespace core {
 
 ProxyServer *ProxyServerSignalHandler::server = nullptr;
 
+const size_t ProxyServer::HANDOFF_MAX_RETRY = 1000;
+const long long ProxyServer::HANDOFF_RETRY_INTERVAL = 1000;
+const size_t ProxyServer::CRYPTO_POOL_QUEUE_SIZE = 1024;
+const size_t ProxyServer::RSA_POOL_QUEUE_SIZE = 256;
+const int64_t ProxyServer::REBALANCE_MIN_CPU = 500;
+const int64_t ProxyServer::REBALANCE_RATIO = 150;
+
 bool ProxyServer::setup() {
 
     if(!_daemonize()) {
@@ -43,25 +62,19 @@ bool ProxyServer::setup() {
         return false;
     }
 
-    if(!_setup_coroutine_framework()) {
-        return false;
-    }
-
-    if(!_setup_tunnel_gc_loop()) {
-        return false;
-    }
-
-    if(!_setup_statistic_loop()) {
-        return false;
-    }
-
     return true;
 
 }
 
 bool ProxyServer::teardown() {
 
-    if(!_teardown_coroutine_framework()) {
+    // join the crypto threads before the sockets of the framework go away
+    _crypto_pool.reset();
+    _rsa_pool.reset();
+    _idle_poller.reset();
+    ProxyUring::destroy();
+
+    if(_framework_ready && !_teardown_coroutine_framework()) {
         return false;
     }
 
@@ -71,12 +84,183 @@ bool ProxyServer::teardown() {
 
 void ProxyServer::run() {
 
+    // the rsa key pair is generated before forking, so all the workers share the same
+    // (read-only) key pair
     if(_config.mode() == ProxyServerType::Decryption) {
         _rsa_keypair = proxy::crypto::ProxyCryptoRsa::generate_key_pair();
         if(!_rsa_keypair) {
             LOG(ERROR) << "generate the rsa key pair error";
             return;
         }
+        // and so are the ticket keys, a ticket opens in any worker
+        if(_config.crypto_ticket_lifetime()) {
+            _ticket_keys = proxy::crypto::ProxyCryptoTicketKeys::generate(
+                static_cast<time_t>(_config.crypto_ticket_lifetime()));
+            if(!_ticket_keys) {
+                LOG(ERROR) << "generate the ticket keys error";
+                return;
+            }
+        }
+    }
+
+    if(_config.workers() > 1 || _config.handshake_workers()) {
+        _run_master();
+    } else {
+        _run_worker();
+    }
+
+}
+
+bool ProxyServer::_spawn_worker(size_t id) {
+
+    pid_t pid;
+    if((pid = fork()) < 0) {
+        LOG(ERROR) << "fork the worker " << id << " error: " << strerror(errno);
+        return false;
+    } else if(pid > 0) {
+        _worker_pids[id] = pid;
+        return true;
+    }
+
+    _master = false;
+    _worker_id = id;
+    _worker_pids.clear();
+
+    // with dedicated handshake workers, the first `workers` workers are the relay ones
+    if(_config.handshake_workers()) {
+        _role = (id < _config.workers()) ? ProxyWorkerRole::Relay : ProxyWorkerRole::Handshake;
+    }
+
+    // the worker should not outlive the master
+    if(prctl(PR_SET_PDEATHSIG, SIGTERM) < 0) {
+        LOG(WARNING) << "[WORKER " << id << "]set the parent death signal error: "
+            << strerror(errno);
+    }
+
+    // the worker must not share the random state of the master: openssl reseeds its own
+    // generator here, and the libc one is seeded by the pid
+    srandom(static_cast<unsigned int>(getpid()) ^ static_cast<unsigned int>(time(NULL)));
+    if(RAND_poll() != 1) {
+        LOG(WARNING) << "[WORKER " << id << "]reseed the random generator error";
+    }
+
+    _run_worker();
+    _exit(0);
+
+}
+
+void ProxyServer::_run_master() {
+
+    _master = true;
+    _master_pid = getpid();
+    _worker_pids.assign(_config.workers() + _config.handshake_workers(), 0);
+
+    // SIGCHLD is ignored by default, which makes the workers unwaitable
+    struct sigaction chld_action;
+    memset(&chld_action, 0, sizeof(chld_action));
+    chld_action.sa_handler = SIG_DFL;
+    if(sigaction(SIGCHLD, &chld_action, NULL) < 0) {
+        LOG(ERROR) << "restore the default handler of SIGCHLD error: " << strerror(errno);
+        return;
+    }
+
+    if(_config.rebalance() && _config.workers() > 1) {
+        try {
+            _load_board = std::make_shared<ProxyLoadBoard>(_config.workers());
+        } catch (const std::exception &ex) {
+            LOG(ERROR) << "create the load board error: " << ex.what();
+            return;
+        }
+    }
+
+    for(size_t i = 0; i < _worker_pids.size(); ++i) {
+        if(!_spawn_worker(i)) {
+            return;
+        }
+    }
+
+    LOG(INFO) << "the master " << getpid() << " spawned " << _worker_pids.size() << " workers";
+
+    while(true) {
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if(pid < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            LOG(ERROR) << "wait the workers error: " << strerror(errno);
+            return;
+        }
+
+        for(size_t i = 0; i < _worker_pids.size(); ++i) {
+            if(_worker_pids[i] != pid) {
+                continue;
+            }
+            LOG(ERROR) << "[WORKER " << i << "]the worker " << pid << " exits with status "
+                << status << ", respawning";
+            _worker_pids[i] = 0;
+            // avoid a busy fork loop when the worker fails at startup
+            sleep(1);
+            if(!_spawn_worker(i)) {
+                return;
+            }
+            break;
+        }
+
+    }
+
+}
+
+void ProxyServer::_run_worker() {
+
+    if(!_setup_affinity()) {
+        return;
+    }
+
+    if(!_setup_huge_pages()) {
+        return;
+    }
+
+    ProxyMemoryBudget::setup(_config.memory_soft_limit() * 1024 * 1024,
+        _config.memory_hard_limit() * 1024 * 1024);
+
+    if(!_setup_io_backend()) {
+        return;
+    }
+
+    if(!_setup_coroutine_framework()) {
+        return;
+    }
+    _framework_ready = true;
+
+    if(!_setup_tunnel_gc_loop()) {
+        return;
+    }
+
+    if(!_setup_statistic_loop()) {
+        return;
+    }
+
+    if(!_setup_crypto_pool()) {
+        return;
+    }
+
+    if(!_setup_idle_poller()) {
+        return;
+    }
+
+    if(!_setup_handoff_socket()) {
+        return;
+    }
+
+    if(!_setup_rebalance_loop()) {
+        return;
+    }
+
+    if(_role == ProxyWorkerRole::Relay) {
+        _handoff_loop(this);
+        return;
     }
 
     if(!_setup_listen_socket()) {
@@ -233,6 +417,14 @@ bool ProxyServer::_setup_listen_socket() {
         return false;
     }
 
+    // every worker binds its own listen socket and the kernel shards the connections
+    int reuse = 1;
+    if(_master_pid && _listen_socket->setsockopt(SOL_SOCKET, SO_REUSEPORT,
+        &reuse, sizeof(reuse)) < 0) {
+        LOG(ERROR) << "enable SO_REUSEPORT of the listen socket error: " << strerror(errno);
+        return false;
+    }
+
     struct sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_port = htons(_config.local_port());
@@ -262,8 +454,8 @@ bool ProxyServer::_setup_listen_socket() {
 void *ProxyServer::_tunnel_gc_loop(void *args) {
 
     ProxyServer *server = reinterpret_cast<ProxyServer *>(args);
-    std::list<std::weak_ptr<ProxyTunnel>>::iterator p;
-    std::list<std::weak_ptr<ProxyTunnel>>::iterator q;
+    decltype(server->_tunnels)::iterator p;
+    decltype(server->_tunnels)::iterator q;
     bool del;
     while(1) {
         p = server->_tunnels.begin();
@@ -291,6 +483,8 @@ void *ProxyServer::_tunnel_gc_loop(void *args) {
                 server->_tunnels.erase(q);
             }
         }
+        // the buffers idle since the last round go back to the arena
+        ProxyBufferPool::trim();
         co_usleep(static_cast<long long>(server->_config.statistic_interval()) * 1000000LL);
     }
 
@@ -336,9 +530,14 @@ void *ProxyServer::_statistic_loop(void *args) {
                 LOG(ERROR) << "[STATS]update the server timestamp error";
             } else {
 
-                ep0_ep1_speed = static_cast<long double>(server->_ep0_ep1_bytes) /
+                // the per thread counters are summed without any lock, and only the
+                // difference to the last total is used
+                ProxyTrafficTotal total = ProxyTraffic::total();
+                ProxyTrafficTotal delta = total - server->_traffic;
+
+                ep0_ep1_speed = static_cast<long double>(delta.bytes[0]) /
                     (static_cast<long double>(now - server->_ts) / 1.0e6);
-                ep1_ep0_speed = static_cast<long double>(server->_ep1_ep0_bytes) /
+                ep1_ep0_speed = static_cast<long double>(delta.bytes[1]) /
                     (static_cast<long double>(now - server->_ts) / 1.0e6);
                 ep0_ep1_speed_unit = 0;
                 ep1_ep0_speed_unit = 0;
@@ -359,13 +558,138 @@ void *ProxyServer::_statistic_loop(void *args) {
                     ep1_ep0_speed = ep1_ep0_speed / 1024.0;
                 }
 
-                LOG(INFO) << "[STATS]current speed [up:"
+                LOG(INFO) << "[STATS]" << server->_worker_tag() << "current speed [up:"
                     << ep0_ep1_speed << UNITS[ep0_ep1_speed_unit] << "][down:"
                     << ep1_ep0_speed << UNITS[ep1_ep0_speed_unit] << "]";
 
+                LOG(INFO) << "[STATS]" << server->_worker_tag() << "relay [up reads:"
+                    << delta.reads[0] << "][up writes:" << delta.writes[0] << "][up crypto:"
+                    << delta.crypto_ns[0] / 1000000 << "ms][down reads:" << delta.reads[1]
+                    << "][down writes:" << delta.writes[1] << "][down crypto:"
+                    << delta.crypto_ns[1] / 1000000 << "ms]";
+
+                LOG(INFO) << "[STATS]" << server->_worker_tag() << "fairness [budget hits:"
+                    << server->_budget_hits << "]";
+
+                if(server->_handshakes) {
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "handshake [handshakes:"
+                        << server->_handshakes << "][messages per handshake:"
+                        << static_cast<double>(server->_handshake_messages) /
+                        server->_handshakes << "][writes per handshake:"
+                        << static_cast<double>(server->_handshake_writes) /
+                        server->_handshakes << "][x25519:" << server->_handshake_x25519 << "]";
+
+                    std::ostringstream oss;
+                    for(const auto &kv : server->_handshake_ciphers) {
+                        oss << "[" << proxy::crypto::ProxyCryptoCipher::name(kv.first) << ":"
+                            << kv.second << "]";
+                    }
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "ciphers " << oss.str();
+                }
+
+                if(server->_rsa_key_hits || server->_rsa_key_stale) {
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "rsa key cache [hits:"
+                        << server->_rsa_key_hits << "][stale:" << server->_rsa_key_stale << "]";
+                }
+
+                if(server->_resumptions || server->_tickets_issued) {
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "resumption [attempts:"
+                        << server->_resumptions << "][hits:" << server->_resumption_hits
+                        << "][hit rate:" << (server->_resumptions ? 100.0 *
+                        server->_resumption_hits / server->_resumptions : 0.0)
+                        << "%][tickets issued:" << server->_tickets_issued << "]";
+                }
+
+                if(server->_crypto_pool) {
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "crypto offload [chunks:"
+                        << server->_crypto_offloaded << "][pending:"
+                        << server->_crypto_pool->pending() << "]";
+                }
+
+                if(server->_rsa_pool) {
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "rsa offload [ops:"
+                        << server->_rsa_offloaded << "][queue depth:"
+                        << server->_rsa_pool->pending() << "]";
+                }
+
+                if(!server->_relay_buffers.empty()) {
+                    std::ostringstream oss;
+                    for(const auto &kv : server->_relay_buffers) {
+                        oss << "[" << kv.first / 1024 << "K:" << kv.second << "]";
+                    }
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "relay buffers "
+                        << oss.str();
+                }
+
+                {
+                    size_t alive = 0;
+                    size_t bytes = 0;
+                    for(auto &p : server->_tunnels) {
+                        std::shared_ptr<ProxyTunnel> tunnel = p.lock();
+                        if(tunnel) {
+                            ++alive;
+                            bytes += tunnel->footprint();
+                        }
+                    }
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "tunnels [alive:"
+                        << alive << "][bytes per tunnel:" << (alive ? bytes / alive : 0)
+                        << "B]";
+                }
+
+                LOG(INFO) << "[STATS]" << server->_worker_tag() << "slab [objects:"
+                    << ProxySlab::allocations() << "][slabs:" << ProxySlab::refills()
+                    << "][objects per connection:" << (server->_accepted ?
+                    ProxySlab::allocations() / server->_accepted : 0) << "]";
+
+                if(ProxyMemoryBudget::enabled()) {
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "memory [usage:"
+                        << ProxyMemoryBudget::usage() << "B][soft:"
+                        << ProxyMemoryBudget::soft_limit() << "B][hard:"
+                        << ProxyMemoryBudget::hard_limit() << "B][read throttles:"
+                        << ProxyMemoryBudget::read_throttles() << "][accept throttles:"
+                        << ProxyMemoryBudget::accept_throttles() << "]";
+                }
+
+                LOG(INFO) << "[STATS]" << server->_worker_tag() << "buffer pool [hits:"
+                    << ProxyBufferPool::hits() << "][misses:" << ProxyBufferPool::misses()
+                    << "][resident:" << ProxyBufferPool::resident() << "B]";
+
+                if(ProxyArena::enabled()) {
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "arena [node:"
+                        << ProxyArena::node() << "][mapped:" << ProxyArena::mapped() << "B][huge:"
+                        << ProxyArena::huge_mapped() << "B][thp:" << ProxyArena::thp_mapped()
+                        << "B]";
+                }
+
+                if(server->_idle_poller) {
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "idle relay [parked:"
+                        << server->_idle_poller->parked() << "][wakeups:"
+                        << server->_idle_poller->wakeups() << "]";
+                }
+
+                if(ProxyUring::instance()) {
+                    ProxyUring *uring = ProxyUring::instance();
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "io_uring [ops:"
+                        << uring->ops() << "][enters:" << uring->enters() << "][fixed files:"
+                        << uring->fixed_file_ops() << "][fixed buffers:"
+                        << uring->fixed_buffer_ops() << "/" << uring->fixed_buffers() << "]";
+                }
+
+                if(server->_load_board && server->_role != ProxyWorkerRole::Handshake) {
+                    const ProxyWorkerLoad &load = server->_load_board->at(server->_worker_id);
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "rebalance [cpu:"
+                        << load.cpu.load() / 10 << "%][rate:" << load.bytes_rate.load()
+                        << "B/s][migrated:" << server->_migrations << "]";
+                }
+
+                if(server->_role != ProxyWorkerRole::Standalone) {
+                    LOG(INFO) << "[STATS]" << server->_worker_tag() << "handoff [sent:"
+                        << server->_handoff_sent << "][received:"
+                        << server->_handoff_received << "]";
+                }
+
                 server->_ts = now;
-                server->_ep0_ep1_bytes = 0;
-                server->_ep1_ep0_bytes = 0;
+                server->_traffic = total;
             }
         }
         co_usleep(static_cast<long long>(server->_config.statistic_interval()) * 1000000LL);
@@ -387,12 +711,336 @@ bool ProxyServer::_setup_statistic_loop() {
 
 }
 
+bool ProxyServer::_setup_affinity() {
+
+    std::vector<int> cpus;
+
+    // following the rx queues keeps the packets and their relay on the same cache
+    if(!_config.irq_affinity().empty() &&
+        !ProxyAffinity::irq_cpus(_config.irq_affinity(), cpus)) {
+        LOG(WARNING) << "[AFFINITY]" << _worker_tag() << "no rx queue interrupt of "
+            << _config.irq_affinity() << " is found, fall back to proxy.cpu_affinity";
+    }
+    if(cpus.empty()) {
+        cpus = _config.cpu_affinity();
+    }
+
+    if(cpus.empty()) {
+        if(_config.numa_arena()) {
+            LOG(WARNING) << "[AFFINITY]" << _worker_tag()
+                << "the numa arena is disabled since the worker is not pinned";
+        }
+        return true;
+    }
+
+    int cpu = cpus[_worker_id % cpus.size()];
+    if(!ProxyAffinity::pin(pthread_self(), std::vector<int>{cpu})) {
+        LOG(ERROR) << "[AFFINITY]" << _worker_tag() << "pin the scheduler to the cpu " << cpu
+            << " error: " << strerror(errno);
+        return false;
+    }
+
+    // the pool threads share the node of the scheduler but not its cpu if possible
+    int node = ProxyAffinity::node_of_cpu(cpu);
+    _pool_cpus.clear();
+    for(int c : cpus) {
+        if(c != cpu && ProxyAffinity::node_of_cpu(c) == node) {
+            _pool_cpus.push_back(c);
+        }
+    }
+    if(_pool_cpus.empty()) {
+        _pool_cpus.push_back(cpu);
+    }
+
+    if(_config.numa_arena() && !ProxyArena::setup(node)) {
+        LOG(WARNING) << "[AFFINITY]" << _worker_tag() << "unsupported numa node " << node
+            << ", the numa arena is disabled";
+    }
+
+    LOG(INFO) << "[AFFINITY]" << _worker_tag() << "pin the scheduler to the cpu " << cpu
+        << " of the numa node " << node << (ProxyArena::enabled() ? " with" : " without")
+        << " the numa arena";
+
+    return true;
+
+}
+
+bool ProxyServer::_setup_huge_pages() {
+
+    if(!_config.huge_pages()) {
+        return true;
+    }
+
+    // before the first buffer, so every chunk of the arena is a huge mapping
+    ProxyArena::huge_pages(true);
+    if(!ProxyArena::enabled()) {
+        ProxyArena::setup(-1);
+    }
+
+    LOG(INFO) << "[ARENA]" << _worker_tag() << "carve the buffers from the huge pages";
+
+    return true;
+
+}
+
+bool ProxyServer::_setup_io_backend() {
+
+    if(!_config.io_uring()) {
+        return true;
+    }
+
+    // the ring is created before the first buffer, so all the mappings of the arena are
+    // registered as the fixed buffers
+    if(!ProxyUring::setup(_config.io_uring_entries(), _config.io_uring_sqpoll())) {
+        LOG(WARNING) << "[IO]" << _worker_tag() << "fall back to the epoll backend";
+        return true;
+    }
+
+    if(!ProxyArena::enabled()) {
+        ProxyArena::setup(-1);
+    }
+
+    LOG(INFO) << "[IO]" << _worker_tag() << "use the io_uring backend [entries:"
+        << _config.io_uring_entries() << "][sqpoll:" << _config.io_uring_sqpoll() << "]";
+
+    return true;
+
+}
+
+bool ProxyServer::_setup_idle_poller() {
+
+    // the handshake workers pass the tunnels on before relaying anything
+    if(!_config.idle_relay() || _role == ProxyWorkerRole::Handshake) {
+        return true;
+    }
+
+    try {
+        _idle_poller = std::make_shared<ProxyIdlePoller>();
+    } catch (const std::exception &ex) {
+        LOG(ERROR) << "[IDLE]" << _worker_tag() << "create the idle poller error: " << ex.what();
+        return false;
+    }
+
+    co_thread_t *c = nullptr;
+    if(!(c = coroutine_create(ProxyIdlePoller::dispatch,
+        reinterpret_cast<void *>(_idle_poller.get())))) {
+        LOG(ERROR) << "create the idle dispatcher coroutine error: " << strerror(errno);
+        _idle_poller.reset();
+        return false;
+    }
+    coroutine_setdetachstate(c, COROUTINE_FLAG_NONJOINABLE);
+
+    return true;
+
+}
+
+bool ProxyServer::_setup_crypto_pool() {
+
+    // the threads can not survive the fork, so every worker owns its pools, the handshake
+    // workers never relay and the relay workers never run the handshakes
+    if(_config.crypto_offload_threads() && _role != ProxyWorkerRole::Handshake) {
+        try {
+            _crypto_pool = std::make_shared<ProxyThreadPool>("crypto",
+                _config.crypto_offload_threads(), ProxyServer::CRYPTO_POOL_QUEUE_SIZE,
+                _pool_cpus);
+        } catch (const std::exception &ex) {
+            LOG(ERROR) << "create the crypto thread pool error: " << ex.what();
+            return false;
+        }
+    }
+
+    if(_config.crypto_rsa_threads() && _role != ProxyWorkerRole::Relay) {
+        try {
+            _rsa_pool = std::make_shared<ProxyThreadPool>("rsa",
+                _config.crypto_rsa_threads(), ProxyServer::RSA_POOL_QUEUE_SIZE, _pool_cpus);
+        } catch (const std::exception &ex) {
+            LOG(ERROR) << "create the rsa thread pool error: " << ex.what();
+            return false;
+        }
+    }
+
+    return true;
+
+}
+
+bool ProxyServer::_setup_handoff_socket() {
+
+    // the relay workers receive the tunnels of the handshake workers, and every relaying
+    // worker receives the migrated tunnels when rebalancing
+    if(_role != ProxyWorkerRole::Relay &&
+        !(_load_board && _role == ProxyWorkerRole::Standalone)) {
+        return true;
+    }
+
+    _handoff_socket = ProxyHandoff::listen(ProxyHandoff::relay_address(_master_pid,
+        _worker_id));
+    if(!_handoff_socket) {
+        return false;
+    }
+
+    // the relay worker runs the handoff loop instead of the accept loop
+    if(_role == ProxyWorkerRole::Relay) {
+        return true;
+    }
+
+    co_thread_t *c = nullptr;
+    if(!(c = coroutine_create(ProxyServer::_handoff_loop, reinterpret_cast<void *>(this)))) {
+        LOG(ERROR) << "create the handoff coroutine error: " << strerror(errno);
+        return false;
+    }
+    coroutine_setdetachstate(c, COROUTINE_FLAG_NONJOINABLE);
+    return true;
+
+}
+
+bool ProxyServer::_setup_rebalance_loop() {
+
+    if(!_load_board || _role == ProxyWorkerRole::Handshake) {
+        return true;
+    }
+
+    co_thread_t *c = nullptr;
+    if(!(c = coroutine_create(ProxyServer::_rebalance_loop, reinterpret_cast<void *>(this)))) {
+        LOG(ERROR) << "create the rebalance coroutine error: " << strerror(errno);
+        return false;
+    }
+    coroutine_setdetachstate(c, COROUTINE_FLAG_NONJOINABLE);
+    return true;
+
+}
+
+void *ProxyServer::_rebalance_loop(void *args) {
+
+    ProxyServer *server = reinterpret_cast<ProxyServer *>(args);
+
+    while(1) {
+        server->_rebalance();
+        co_usleep(static_cast<long long>(server->_config.statistic_interval()) * 1000000LL);
+    }
+
+    return nullptr;
+
+}
+
+void ProxyServer::_rebalance() {
+
+    co_time_t now = co_get_current_time();
+    struct rusage ru;
+    if(now < 0 || getrusage(RUSAGE_SELF, &ru) < 0) {
+        LOG(ERROR) << "[REBALANCE]" << _worker_tag() << "sample the load error";
+        return;
+    }
+
+    int64_t cpu = static_cast<int64_t>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL +
+        ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    int64_t elapsed = now - _rebalance_ts;
+    bool first = !_rebalance_ts;
+
+    ProxyTrafficTotal total = ProxyTraffic::total();
+    int64_t bytes = static_cast<int64_t>(total.bytes[0] + total.bytes[1]);
+    int64_t rate = first ? 0 : (bytes - _rebalance_bytes) * 1000000LL / elapsed;
+    int64_t load = first ? 0 : (cpu - _rebalance_cpu) * 1000LL / elapsed;
+    _rebalance_ts = now;
+    _rebalance_bytes = bytes;
+    _rebalance_cpu = cpu;
+
+    ProxyWorkerLoad &self = _load_board->at(_worker_id);
+    self.bytes_rate.store(rate);
+    self.cpu.store(load);
+    self.tunnels.store(static_cast<int64_t>(_tunnels.size()));
+    self.updated.store(now);
+
+    // the idlest of the live workers, the stale slots belong to the dead or the respawning
+    int target = -1;
+    int64_t target_cpu = 0;
+    int64_t target_rate = 0;
+    int64_t total_rate = 0;
+    int64_t alive = 0;
+    co_time_t stale = 3LL * static_cast<long long>(_config.statistic_interval()) * 1000000LL;
+
+    for(size_t i = 0; i < _load_board->size(); ++i) {
+        const ProxyWorkerLoad &w = _load_board->at(i);
+        co_time_t updated = w.updated.load();
+        if(!updated || now - updated > stale) {
+            continue;
+        }
+        ++alive;
+        total_rate += w.bytes_rate.load();
+        if(i != _worker_id && (target < 0 || w.cpu.load() < target_cpu)) {
+            target = static_cast<int>(i);
+            target_cpu = w.cpu.load();
+            target_rate = w.bytes_rate.load();
+        }
+    }
+
+    // only a busy worker well above the average gives away, and only to a worker which
+    // is at most half as busy, so the tunnels never bounce back and forth
+    bool busy = !first && target >= 0 && load >= ProxyServer::REBALANCE_MIN_CPU &&
+        rate * alive * 100 >= total_rate * ProxyServer::REBALANCE_RATIO &&
+        target_cpu * 2 <= load && rate > target_rate;
+
+    std::shared_ptr<ProxyTunnel> heaviest;
+    int64_t heaviest_rate = 0;
+
+    for(auto &p : _tunnels) {
+        std::shared_ptr<ProxyTunnel> tunnel = p.lock();
+        if(!tunnel) {
+            continue;
+        }
+        // the migration which did not reach a read boundary in time is dropped
+        tunnel->migrate_to(-1);
+        int64_t r = first ? 0 : tunnel->take_bytes_delta() * 1000000LL / elapsed;
+        // moving a tunnel heavier than the gap only swaps the roles of the two workers
+        if(busy && r > heaviest_rate && r < rate - target_rate) {
+            heaviest = tunnel;
+            heaviest_rate = r;
+        }
+    }
+
+    if(heaviest) {
+        LOG(INFO) << "[REBALANCE]" << _worker_tag() << "move " << heaviest->ep0_ep1_string()
+            << " (" << heaviest_rate << "B/s) to the worker " << target << " [cpu:"
+            << load / 10 << "%/" << target_cpu / 10 << "%]";
+        heaviest->migrate_to(target);
+    }
+
+}
+
+std::string ProxyServer::_worker_tag() const {
+
+    switch(_role) {
+        case ProxyWorkerRole::Handshake:
+            return "[HANDSHAKE " + std::to_string(_worker_id) + "]";
+        case ProxyWorkerRole::Relay:
+            return "[RELAY " + std::to_string(_worker_id) + "]";
+        default:
+            break;
+    }
+    if(!_master_pid) {
+        return "";
+    }
+    return "[WORKER " + std::to_string(_worker_id) + "]";
+
+}
+
 void ProxyServer::_run_loop() {
 
     while(true) {
 
         ProxySocket *fd;
 
+        // the new connections wait in the backlog until the memory comes back
+        if(ProxyMemoryBudget::pressure() == ProxyMemoryPressure::Hard) {
+            LOG(WARNING) << "[MEMORY]" << _worker_tag() << "stop accepting at the hard limit, "
+                << ProxyMemoryBudget::usage() << "B in use";
+            do {
+                ProxyMemoryBudget::add_accept_throttle();
+                co_usleep(ProxyMemoryBudget::ACCEPT_PAUSE);
+            } while(ProxyMemoryBudget::pressure() == ProxyMemoryPressure::Hard);
+            LOG(INFO) << "[MEMORY]" << _worker_tag() << "resume accepting, "
+                << ProxyMemoryBudget::usage() << "B in use";
+        }
+
         try {
             fd = _listen_socket->accept();  
         } catch (const std::exception &ex) {
@@ -401,6 +1049,7 @@ void ProxyServer::_run_loop() {
         }
 
         LOG(INFO) << "receive a connection from " << fd->to_string();
+        ++_accepted;
 
         ProxyStmFlowArgs *args = new ProxyStmFlowArgs{fd, this};
 
@@ -408,6 +1057,66 @@ void ProxyServer::_run_loop() {
         if(!(c = coroutine_create(ProxyStm::startup, reinterpret_cast<void *>(args)))) {
             LOG(ERROR) << "create a new coroutine for " << args->fd->to_string() << " error: "
                 << strerror(errno);
+            delete args->fd;
+            delete args;
+            continue;
+        }
+
+        coroutine_setdetachstate(c, COROUTINE_FLAG_NONJOINABLE);
+
+    }
+
+}
+
+bool ProxyServer::handoff(const std::shared_ptr<ProxyTunnel> &tunnel) {
+
+    // spread the tunnels over the relay workers, and wait a little when all of their
+    // queues are full or they are being respawned
+    for(size_t retry = 0; retry < ProxyServer::HANDOFF_MAX_RETRY; ++retry) {
+        for(size_t i = 0; i < _config.workers(); ++i) {
+            size_t id = (_handoff_next++) % _config.workers();
+            if(ProxyHandoff::send(tunnel, ProxyHandoff::relay_address(_master_pid, id))) {
+                ++_handoff_sent;
+                return true;
+            }
+            if(errno != EAGAIN && errno != ECONNREFUSED) {
+                LOG(ERROR) << tunnel->ep0_ep1_string() << ": hand off to the relay worker "
+                    << id << " error: " << strerror(errno);
+                return false;
+            }
+        }
+        co_usleep(ProxyServer::HANDOFF_RETRY_INTERVAL);
+    }
+
+    LOG(ERROR) << tunnel->ep0_ep1_string() << ": all of the relay workers are busy";
+    return false;
+
+}
+
+void *ProxyServer::_handoff_loop(void *args) {
+
+    ProxyServer *server = reinterpret_cast<ProxyServer *>(args);
+
+    while(true) {
+
+        std::shared_ptr<ProxyTunnel> tunnel = ProxyHandoff::receive(server->_handoff_socket,
+            server);
+        if(!tunnel) {
+            co_usleep(ProxyServer::HANDOFF_RETRY_INTERVAL);
+            continue;
+        }
+
+        ++server->_handoff_received;
+        server->add_tunnel(tunnel);
+
+        ProxyStmResumeArgs *args = new ProxyStmResumeArgs{tunnel};
+
+        co_thread_t *c = nullptr;
+        if(!(c = coroutine_create(ProxyStm::resume, reinterpret_cast<void *>(args)))) {
+            LOG(ERROR) << "create a new coroutine for the handed off "
+                << tunnel->ep0_ep1_string() << " error: " << strerror(errno);
+            tunnel->close();
+            delete args;
             continue;
         }
 
@@ -415,10 +1124,62 @@ void ProxyServer::_run_loop() {
 
     }
 
+    return nullptr;
+
+}
+
+bool ProxyServer::migrate(const std::shared_ptr<ProxyTunnel> &tunnel, bool flag) {
+
+    // a direction blocked in its read can neither leave the epoll of the coroutines nor be
+    // woken up, so the other direction must be parked in the idle poller, otherwise try
+    // again at the next read boundary
+    int id = tunnel->migrate_to();
+    if(id < 0 || !_idle_poller || !tunnel->parked(!flag)) {
+        return false;
+    }
+    tunnel->migrate_to(-1);
+
+    // the socket leaves the idle epoll before the other worker owns it, so no relay of this
+    // worker reads it again
+    if(!_idle_poller->release(tunnel, !flag)) {
+        return false;
+    }
+
+    if(!ProxyHandoff::send(tunnel, ProxyHandoff::relay_address(_master_pid,
+        static_cast<size_t>(id)))) {
+        LOG(WARNING) << "[REBALANCE]" << _worker_tag() << "move " << tunnel->ep0_ep1_string()
+            << " to the worker " << id << " error: " << strerror(errno);
+        // the released direction goes on with a new coroutine, which parks it again
+        std::shared_ptr<ProxyTunnel> t = tunnel;
+        if(!ProxyStm::relay(t, !flag)) {
+            ProxyStm::relay_end(t);
+        }
+        return false;
+    }
+
+    ++_migrations;
+
+    // neither direction waits on the descriptors any more, the released one ends here and
+    // the calling one returns
+    std::shared_ptr<ProxyTunnel> t = tunnel;
+    ProxyStm::relay_end(t);
+    tunnel->close();
+
+    return true;
+
 }
 
 void ProxyServerSignalHandler::server_signal_handler(int signum) {
 
+    // the master passes the signals through to the workers
+    if(ProxyServerSignalHandler::server->is_master()) {
+        for(pid_t pid : ProxyServerSignalHandler::server->worker_pids()) {
+            if(pid > 0) {
+                kill(pid, signum);
+            }
+        }
+    }
+
     switch(signum) {
         case SIGHUP:
             ProxyServerSignalHandler::server->config().reload();
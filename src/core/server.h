@@ -4,10 +4,20 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <map>
+#include <string>
 
+#include <sys/types.h>
+
+#include "core/balance.h"
 #include "core/config.h"
+#include "core/counter.h"
+#include "core/idle.h"
+#include "core/slab.h"
 #include "core/socket.h"
+#include "core/thread_pool.h"
 #include "crypto/rsa.h"
+#include "crypto/ticket.h"
 
 extern "C" {
 #include "coroutine/coroutine.h"
@@ -18,12 +28,25 @@ namespace core {
 
 class ProxyTunnel;
 
+enum class ProxyWorkerRole {
+    Standalone,
+    Handshake,
+    Relay
+};
+
 class ProxyServer {
 
 public:
 
     ProxyServer(const ProxyConfig &config) : _config(config),
-        _ts(co_get_current_time()), _ep0_ep1_bytes(0), _ep1_ep0_bytes(0) {}
+        _ts(co_get_current_time()), _accepted(0),
+        _master(false), _master_pid(0), _worker_id(0), _role(ProxyWorkerRole::Standalone),
+        _framework_ready(false), _handoff_next(0), _handoff_sent(0), _handoff_received(0),
+        _crypto_offloaded(0), _rsa_offloaded(0), _rebalance_ts(0),
+        _rebalance_bytes(0), _rebalance_cpu(0), _migrations(0), _budget_hits(0),
+        _handshakes(0), _handshake_messages(0), _handshake_writes(0), _handshake_x25519(0),
+        _rsa_key_hits(0), _rsa_key_stale(0), _resumptions(0), _resumption_hits(0),
+        _tickets_issued(0) {}
 
     bool setup();
     bool teardown();
@@ -45,16 +68,115 @@ public:
         return _rsa_keypair;
     }
 
-    void add_tunnel(const std::shared_ptr<ProxyTunnel> &u) {
-        _tunnels.push_back(u);
+    // the public keys of the decryption servers by host:port, nullptr for an unknown one
+    std::shared_ptr<proxy::crypto::ProxyCryptoRsaPublicKey> rsa_key_cache(
+        const std::string &remote) const {
+        auto it = _rsa_key_cache.find(remote);
+        return it == _rsa_key_cache.end() ? nullptr : it->second;
+    }
+
+    void rsa_key_cache(const std::string &remote,
+        const std::shared_ptr<proxy::crypto::ProxyCryptoRsaPublicKey> &key) {
+        _rsa_key_cache[remote] = key;
+    }
+
+    // the keys which seal the tickets of the decryption server, nullptr without tickets
+    const std::shared_ptr<proxy::crypto::ProxyCryptoTicketKeys> &ticket_keys() const {
+        return _ticket_keys;
+    }
+
+    // the resumption tickets of the encryption server by host:port
+    const proxy::crypto::ProxyCryptoTicket *ticket(const std::string &remote) const {
+        auto it = _tickets.find(remote);
+        return it == _tickets.end() ? nullptr : &it->second;
+    }
+
+    void ticket(const std::string &remote, const proxy::crypto::ProxyCryptoTicket &t) {
+        _tickets.erase(remote);
+        _tickets.emplace(remote, t);
+    }
+
+    void drop_ticket(const std::string &remote) {
+        _tickets.erase(remote);
     }
 
-    void add_ep0_ep1_data_amount(int64_t amount) {
-        _ep0_ep1_bytes += amount;
+    // a ticket presented or received, and whether it resumed the session
+    void add_resumption(bool hit) {
+        ++_resumptions;
+        _resumption_hits += hit ? 1 : 0;
     }
 
-    void add_ep1_ep0_data_amount(int64_t amount) {
-        _ep1_ep0_bytes += amount;
+    void add_ticket_issued() {
+        ++_tickets_issued;
+    }
+
+    // a cached key accepted by the peer, or replaced because the peer has a new one
+    void add_rsa_key_cache(bool hit) {
+        ++(hit ? _rsa_key_hits : _rsa_key_stale);
+    }
+
+    bool is_master() const {
+        return _master;
+    }
+
+    size_t worker_id() const {
+        return _worker_id;
+    }
+
+    const std::vector<pid_t> &worker_pids() const {
+        return _worker_pids;
+    }
+
+    ProxyWorkerRole role() const {
+        return _role;
+    }
+
+    bool handoff(const std::shared_ptr<ProxyTunnel> &);
+    bool migrate(const std::shared_ptr<ProxyTunnel> &, bool);
+
+    const std::shared_ptr<ProxyThreadPool> &crypto_pool() const {
+        return _crypto_pool;
+    }
+
+    void add_crypto_offloaded() {
+        ++_crypto_offloaded;
+    }
+
+    const std::shared_ptr<ProxyThreadPool> &rsa_pool() const {
+        return _rsa_pool;
+    }
+
+    void add_rsa_offloaded() {
+        ++_rsa_offloaded;
+    }
+
+    const std::shared_ptr<ProxyIdlePoller> &idle_poller() const {
+        return _idle_poller;
+    }
+
+    void add_budget_hit() {
+        ++_budget_hits;
+    }
+
+    // the messages of a finished handshake, the writes which carried them and its cipher
+    void add_handshake(uint32_t messages, uint32_t writes,
+        proxy::crypto::ProxyCryptoCipherSuite cipher) {
+        ++_handshakes;
+        _handshake_messages += messages;
+        _handshake_writes += writes;
+        ++_handshake_ciphers[cipher];
+    }
+
+    void add_x25519() {
+        ++_handshake_x25519;
+    }
+
+    void add_relay_buffer(size_t size) {
+        ++_relay_buffers[size];
+    }
+
+    void add_tunnel(const std::shared_ptr<ProxyTunnel> &u) {
+        _tunnels.push_back(u);
     }
 
 
@@ -66,20 +188,105 @@ private:
     bool _setup_listen_socket();
     bool _setup_tunnel_gc_loop();
     bool _setup_statistic_loop();
+    bool _setup_affinity();
+    bool _setup_huge_pages();
+    bool _setup_io_backend();
+    bool _setup_crypto_pool();
+    bool _setup_idle_poller();
+    bool _setup_handoff_socket();
+    bool _setup_rebalance_loop();
+    void _rebalance();
     bool _init_signals();
     bool _create_pid_file();
+    bool _spawn_worker(size_t);
+    void _run_master();
+    void _run_worker();
     void _run_loop();
+    std::string _worker_tag() const;
 
     ProxyConfig _config;
     co_time_t _ts;
-    int64_t _ep0_ep1_bytes;
-    int64_t _ep1_ep0_bytes;
+    ProxyTrafficTotal _traffic;
     std::shared_ptr<ProxySocket> _listen_socket;
-    std::list<std::weak_ptr<ProxyTunnel>> _tunnels;
+    // the list nodes come from the slab like the tunnels themselves
+    std::list<std::weak_ptr<ProxyTunnel>, ProxySlabAllocator<std::weak_ptr<ProxyTunnel>>> _tunnels;
+    int64_t _accepted;
     std::shared_ptr<proxy::crypto::ProxyCryptoRsaKeypair> _rsa_keypair;
 
+    // the master only forks and supervises the workers when workers > 1,
+    // every worker owns its coroutine framework, listen socket and tunnels
+    bool _master;
+    pid_t _master_pid;
+    size_t _worker_id;
+    ProxyWorkerRole _role;
+    bool _framework_ready;
+    std::vector<pid_t> _worker_pids;
+
+    // the decryption handshake workers pass the established tunnels to the relay workers
+    std::shared_ptr<ProxySocket> _handoff_socket;
+    size_t _handoff_next;
+    int64_t _handoff_sent;
+    int64_t _handoff_received;
+
+    // the configured cpus on the numa node of the scheduler, for the pool threads
+    std::vector<int> _pool_cpus;
+
+    // the bulk aes work of the large chunks runs outside of the scheduler thread
+    std::shared_ptr<ProxyThreadPool> _crypto_pool;
+    int64_t _crypto_offloaded;
+
+    // the rsa private key operations of the handshakes
+    std::shared_ptr<ProxyThreadPool> _rsa_pool;
+    int64_t _rsa_offloaded;
+
+    // the relay workers publish their load on the shared board, and the busy ones move
+    // their heaviest tunnel to the idlest one
+    std::shared_ptr<ProxyLoadBoard> _load_board;
+    co_time_t _rebalance_ts;
+    int64_t _rebalance_bytes;
+    int64_t _rebalance_cpu;
+    int64_t _migrations;
+
+    // the drained relay directions wait here without a coroutine or a buffer
+    std::shared_ptr<ProxyIdlePoller> _idle_poller;
+
+    // the times a relay coroutine used up its budget and yielded
+    int64_t _budget_hits;
+
+    // the handshake flights, staged and sent by one write each
+    int64_t _handshakes;
+    int64_t _handshake_messages;
+    int64_t _handshake_writes;
+    std::map<proxy::crypto::ProxyCryptoCipherSuite, int64_t> _handshake_ciphers;
+    int64_t _handshake_x25519;
+
+    // the encryption server sends the aes material with the cached key of the peer
+    std::map<std::string, std::shared_ptr<proxy::crypto::ProxyCryptoRsaPublicKey>>
+        _rsa_key_cache;
+    int64_t _rsa_key_hits;
+    int64_t _rsa_key_stale;
+
+    // the stateless resumption, the tickets are kept by the encryption server only
+    std::shared_ptr<proxy::crypto::ProxyCryptoTicketKeys> _ticket_keys;
+    std::map<std::string, proxy::crypto::ProxyCryptoTicket> _tickets;
+    int64_t _resumptions;
+    int64_t _resumption_hits;
+    int64_t _tickets_issued;
+
+    // the relay buffers attached by their size
+    std::map<size_t, int64_t> _relay_buffers;
+
+    static const size_t HANDOFF_MAX_RETRY;
+    static const long long HANDOFF_RETRY_INTERVAL;
+    static const size_t CRYPTO_POOL_QUEUE_SIZE;
+    static const size_t RSA_POOL_QUEUE_SIZE;
+    static const int64_t REBALANCE_MIN_CPU;
+    static const int64_t REBALANCE_RATIO;
+
     static void *_tunnel_gc_loop(void *);
     static void *_statistic_loop(void *);
+    static void *_handoff_loop(void *);
+    static void *_rebalance_loop(void *);
     static void _server_signal_handler(int);
 
 };
@@ -0,0 +1,13 @@
+#include "core/slab.h"
+
+namespace proxy {
+namespace core {
+
+const size_t ProxySlab::SLAB_OBJECTS = 64;
+
+std::atomic<int64_t> ProxySlab::_allocations(0);
+std::atomic<int64_t> ProxySlab::_refills(0);
+std::atomic<int64_t> ProxySlab::_bytes(0);
+
+}
+}
@@ -0,0 +1,180 @@
+#ifndef PROXY_CORE_SLAB_H_H_H
+#define PROXY_CORE_SLAB_H_H_H
+
+#include <atomic>
+#include <new>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/arena.h"
+
+namespace proxy {
+namespace core {
+
+// a free object, linked through its own memory
+class ProxySlabFree {
+
+public:
+    ProxySlabFree *next;
+
+};
+
+class ProxySlab {
+
+public:
+    // the objects handed out by all the pools, and the slabs carved for them
+    static void add_allocation() {
+        _allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void add_refill(size_t bytes) {
+        _refills.fetch_add(1, std::memory_order_relaxed);
+        _bytes.fetch_add(static_cast<int64_t>(bytes), std::memory_order_relaxed);
+    }
+
+    static int64_t allocations() {
+        return _allocations.load(std::memory_order_relaxed);
+    }
+
+    static int64_t refills() {
+        return _refills.load(std::memory_order_relaxed);
+    }
+
+    // the bytes of all the slabs, which are kept for reuse
+    static int64_t bytes() {
+        return _bytes.load(std::memory_order_relaxed);
+    }
+
+    static const size_t SLAB_OBJECTS;
+
+private:
+    static std::atomic<int64_t> _allocations;
+    static std::atomic<int64_t> _refills;
+    static std::atomic<int64_t> _bytes;
+
+};
+
+/*
+ * the objects of a type come from the free list of the thread, and an empty list is
+ * refilled with a slab of SLAB_OBJECTS objects carved from one block of the arena, the
+ * slabs are never given back
+ *
+ *   head -> [free] -> [free] -> ... -> nullptr
+ */
+template<typename T>
+class ProxySlabPool {
+
+public:
+    static void *allocate() {
+
+        ProxySlabFree *&head = _head();
+        if(!head) {
+            _refill(head);
+        }
+
+        ProxySlabFree *p = head;
+        head = p->next;
+        ProxySlab::add_allocation();
+
+        return p;
+
+    }
+
+    static void deallocate(void *p) {
+        if(!p) {
+            return;
+        }
+        ProxySlabFree *&head = _head();
+        ProxySlabFree *f = static_cast<ProxySlabFree *>(p);
+        f->next = head;
+        head = f;
+    }
+
+    static const size_t OBJECT_SIZE = ((sizeof(T) > sizeof(ProxySlabFree) ? sizeof(T) :
+        sizeof(ProxySlabFree)) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+private:
+    static ProxySlabFree *&_head() {
+        static thread_local ProxySlabFree *head = nullptr;
+        return head;
+    }
+
+    static void _refill(ProxySlabFree *&head) {
+
+        char *slab = static_cast<char *>(ProxyArena::allocate(OBJECT_SIZE *
+            ProxySlab::SLAB_OBJECTS));
+        ProxySlab::add_refill(OBJECT_SIZE * ProxySlab::SLAB_OBJECTS);
+
+        for(size_t i = ProxySlab::SLAB_OBJECTS; i > 0; --i) {
+            ProxySlabFree *f = reinterpret_cast<ProxySlabFree *>(slab + (i - 1) * OBJECT_SIZE);
+            f->next = head;
+            head = f;
+        }
+
+    }
+
+};
+
+// the base of the classes created with new, the derived classes larger than T use the heap
+template<typename T>
+class ProxySlabObject {
+
+public:
+    static void *operator new(size_t size) {
+        return size == sizeof(T) ? ProxySlabPool<T>::allocate() : ::operator new(size);
+    }
+
+    static void operator delete(void *p, size_t size) {
+        if(size == sizeof(T)) {
+            ProxySlabPool<T>::deallocate(p);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+};
+
+// for std::allocate_shared and the containers, a single object comes from the slab
+template<typename T>
+class ProxySlabAllocator {
+
+public:
+    typedef T value_type;
+
+    ProxySlabAllocator() =default;
+
+    template<typename U>
+    ProxySlabAllocator(const ProxySlabAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        if(n == 1) {
+            return static_cast<T *>(ProxySlabPool<T>::allocate());
+        }
+        return static_cast<T *>(ProxyArena::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if(n == 1) {
+            ProxySlabPool<T>::deallocate(p);
+        } else {
+            ProxyArena::deallocate(p, n * sizeof(T));
+        }
+    }
+
+    template<typename U>
+    bool operator==(const ProxySlabAllocator<U> &) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const ProxySlabAllocator<U> &) const {
+        return false;
+    }
+
+};
+
+}
+}
+
+#endif
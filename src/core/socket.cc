@@ -1,24 +1,27 @@
 #include <exception>
 #include <stdexcept>
 
+#include <errno.h>
+#include <unistd.h>
+
 #include "core/socket.h"
+#include "core/uring.h"
 
 namespace proxy {
 namespace core {
 
 ProxySocket::ProxySocket(int domain, int type, int protocol) :
     _fd(co_socket(domain, type, protocol)){
+    _clear_addr();
     if(!_fd) {
         throw std::runtime_error("create the non-blocking socket error");
     }
     _used = true;
 }
 
-ProxySocket::ProxySocket(ProxySocket &&ps) : _fd(ps._fd), _host(ps._host),
-    _port(ps._port), _used(true) {
+ProxySocket::ProxySocket(ProxySocket &&ps) : _fd(ps._fd), _addr(ps._addr), _used(true) {
     ps._fd = nullptr;
-    ps._host = "";
-    ps._port = 0;
+    ps._clear_addr();
     ps._used = false;
 }
 
@@ -28,6 +31,9 @@ ProxySocket::~ProxySocket() {
 
 void ProxySocket::close() {
     if(_used && _fd) {
+        if(ProxyUring::instance()) {
+            ProxyUring::instance()->forget(co_socket_get_fd(_fd));
+        }
         co_close(_fd);
         _used = false;
         _fd = nullptr;
@@ -38,14 +44,16 @@ int ProxySocket::bind(const struct sockaddr *addr, socklen_t addrlen) {
     return co_bind(_fd, addr, addrlen);
 }
 
+int ProxySocket::setsockopt(int level, int optname, const void *optval, socklen_t optlen) {
+    return ::setsockopt(co_socket_get_fd(_fd), level, optname, optval, optlen);
+}
+
 void ProxySocket::connect() {
 
-    struct sockaddr_in addr;
+    struct sockaddr_in addr = _addr;
     socklen_t addrlen = sizeof(addr);
- 
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(_port);
-    if(!inet_aton(_host.c_str(), &addr.sin_addr)) {
+
+    if(addr.sin_family != AF_INET) {
         throw std::runtime_error("convert host of " + to_string() + " to struct in_addr error");
     }
 
@@ -60,20 +68,66 @@ void ProxySocket::connect() {
             + " error: " + strerror(errno));
     }
 
-    _host = inet_ntoa(addr.sin_addr);
-    _port = ntohs(addr.sin_port);
+    _addr = addr;
     _used = true;
 
     return;
 
 }
 
+ssize_t ProxySocket::_read(void *buf, size_t n) {
+
+    ProxyUring *uring = ProxyUring::instance();
+    if(uring) {
+        ssize_t nread = uring->read(co_socket_get_fd(_fd), buf, n);
+        if(nread >= 0 || errno != EAGAIN) {
+            return nread;
+        }
+    }
+
+    return co_read(_fd, buf, n);
+
+}
+
+ssize_t ProxySocket::_write(const void *buf, size_t n) {
+
+    ProxyUring *uring = ProxyUring::instance();
+    if(uring) {
+        ssize_t nwrite = uring->write(co_socket_get_fd(_fd), buf, n);
+        if(nwrite >= 0 || errno != EAGAIN) {
+            return nwrite;
+        }
+    }
+
+    return co_write(_fd, buf, n);
+
+}
+
 ssize_t ProxySocket::read(std::shared_ptr<ProxyBuffer> &pb) {
 
     if(pb->cur == pb->size) {
         return 0;
     }
-    ssize_t nread = co_read(_fd, pb->buffer + pb->cur, pb->size - pb->cur);
+    ssize_t nread = _read( pb->buffer + pb->cur, pb->size - pb->cur);
+    if(nread > 0) {
+        pb->cur += static_cast<size_t>(nread);
+    }
+    return nread;
+
+}
+
+ssize_t ProxySocket::read_nonblock(std::shared_ptr<ProxyBuffer> &pb) {
+
+    if(pb->cur == pb->size) {
+        return 0;
+    }
+    // only what is already queued: the ring and the framework would both wait for more, and an
+    // empty socket reads as -1 with EAGAIN
+    ssize_t nread;
+    do {
+        nread = recv(co_socket_get_fd(_fd), pb->buffer + pb->cur, pb->size - pb->cur,
+            MSG_DONTWAIT);
+    } while(nread < 0 && errno == EINTR);
     if(nread > 0) {
         pb->cur += static_cast<size_t>(nread);
     }
@@ -86,7 +140,7 @@ ssize_t ProxySocket::write(std::shared_ptr<ProxyBuffer> &pb) {
     if(pb->start == pb->cur) {
         return 0;
     }
-    ssize_t nwrite = co_write(_fd, pb->buffer + pb->start, pb->cur - pb->start);
+    ssize_t nwrite = _write(pb->buffer + pb->start, pb->cur - pb->start);
     if(nwrite > 0) {
         pb->start += static_cast<size_t>(nwrite);
     }
@@ -104,6 +158,18 @@ ProxyTcpSocket *ProxyTcpSocket::accept() {
     socklen_t addrlen = sizeof(addr);
     co_socket_t *fd;
 
+    ProxyUring *uring = ProxyUring::instance();
+    if(uring) {
+        int cfd = uring->accept(co_socket_get_fd(_fd), reinterpret_cast<struct sockaddr *>(&addr),
+            &addrlen);
+        if(cfd >= 0) {
+            return ProxyTcpSocket::adopt(cfd, inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+        } else if(errno != EAGAIN) {
+            throw std::runtime_error(strerror(errno));
+        }
+        addrlen = sizeof(addr);
+    }
+
     if(!(fd = co_accept(_fd, reinterpret_cast<struct sockaddr *>(&addr), &addrlen))) {
         throw std::runtime_error(strerror(errno));
     }
@@ -112,12 +178,32 @@ ProxyTcpSocket *ProxyTcpSocket::accept() {
 
 }
 
+ProxyTcpSocket *ProxyTcpSocket::adopt(int fd, const std::string &host, uint16_t port) {
+
+    // the coroutine framework can only wrap the sockets created by itself, so create one
+    // and move the received descriptor onto its number
+    co_socket_t *cfd = co_socket(AF_INET, SOCK_STREAM, 0);
+    if(!cfd) {
+        throw std::runtime_error("create the non-blocking socket error");
+    }
+
+    if(dup2(fd, co_socket_get_fd(cfd)) < 0) {
+        int err = errno;
+        co_close(cfd);
+        throw std::runtime_error(std::string("adopt the descriptor error: ") + strerror(err));
+    }
+    ::close(fd);
+
+    return new ProxyTcpSocket(cfd, host, port);
+
+}
+
 ssize_t ProxyTcpSocket::read_eq(size_t n, std::shared_ptr<ProxyBuffer> &pb) {
 
     size_t nbytes = n;
 
     while(n) {
-        ssize_t nread = co_read(_fd, pb->buffer + pb->cur, n);
+        ssize_t nread = _read(pb->buffer + pb->cur, n);
         if(nread < 0) {
             return -1;
         } else if (nread == 0) {
@@ -136,7 +222,7 @@ ssize_t ProxyTcpSocket::write_eq(size_t n, std::shared_ptr<ProxyBuffer> &pb) {
     size_t nbytes = n;
 
     while(n) {
-        ssize_t nwrite = co_write(_fd, pb->buffer + pb->start, n);
+        ssize_t nwrite = _write(pb->buffer + pb->start, n);
         if(nwrite < 0) {
             return -1;
         }
@@ -16,6 +16,7 @@ extern "C" {
 }
 
 #include "core/buffer.h"
+#include "core/slab.h"
 
 namespace proxy {
 namespace core {
@@ -23,33 +24,54 @@ namespace core {
 class ProxySocket {
 
 public:
-    ProxySocket() : _fd(nullptr), _port(0), _used(false) {}
+    ProxySocket() : _fd(nullptr), _used(false) {
+        _clear_addr();
+    }
     ProxySocket(int, int, int);
-    ProxySocket(co_socket_t *fd, std::string host, uint16_t port) :
-        _fd(fd), _host(host), _port(port), _used(true) {}
+    ProxySocket(co_socket_t *fd, const std::string &host, uint16_t port) :
+        _fd(fd), _used(true) {
+        _clear_addr();
+        this->host(host);
+        this->port(port);
+    }
     ProxySocket(const ProxySocket &) = delete;
     ProxySocket(ProxySocket &&);
     virtual ~ProxySocket();
 
+    // the address is kept in binary, a host which is not an ipv4 address leaves it unset
     void host(const std::string &h) {
-        _host = h;
+        if(inet_aton(h.c_str(), &_addr.sin_addr)) {
+            _addr.sin_family = AF_INET;
+        } else {
+            _addr.sin_family = AF_UNSPEC;
+            _addr.sin_addr.s_addr = 0;
+        }
     }
 
     void port(uint16_t p) {
-        _port = p;
+        _addr.sin_port = htons(p);
     }
 
     std::string host() const {
-        return _host;
+        char buf[INET_ADDRSTRLEN];
+        if(_addr.sin_family != AF_INET ||
+            !inet_ntop(AF_INET, &_addr.sin_addr, buf, sizeof(buf))) {
+            return "";
+        }
+        return buf;
     }
 
     uint16_t port() const {
-        return _port;
+        return ntohs(_addr.sin_port);
+    }
+
+    const struct sockaddr_in &addr() const {
+        return _addr;
     }
 
     std::string to_string() const {
         std::ostringstream oss;
-        oss << _host << ":" << _port;
+        oss << host() << ":" << port();
         return oss.str();
     }
     
@@ -57,6 +79,10 @@ public:
         return _used;
     }
 
+    int fileno() const {
+        return _fd ? co_socket_get_fd(_fd) : -1;
+    }
+
     void set_used() {
         _used = true;
     }
@@ -67,8 +93,10 @@ public:
 
 
     int bind(const struct sockaddr *, socklen_t);
+    int setsockopt(int, int, const void *, socklen_t);
     void connect();
     ssize_t read(std::shared_ptr<ProxyBuffer> &);
+    ssize_t read_nonblock(std::shared_ptr<ProxyBuffer> &);
     ssize_t write(std::shared_ptr<ProxyBuffer> &);
     void close();
 
@@ -83,20 +111,28 @@ public:
         struct sockaddr *, socklen_t *) =0;
 
 protected:
+    // through the io_uring of the worker when there is one, otherwise the framework
+    ssize_t _read(void *, size_t);
+    ssize_t _write(const void *, size_t);
+
+    void _clear_addr() {
+        memset(&_addr, 0, sizeof(_addr));
+        _addr.sin_family = AF_UNSPEC;
+    }
+
     co_socket_t *_fd;
-    std::string _host;
-    uint16_t _port;
+    struct sockaddr_in _addr;
     bool _used;
 
 };
 
 
-class ProxyTcpSocket : public ProxySocket {
+class ProxyTcpSocket : public ProxySocket, public ProxySlabObject<ProxyTcpSocket> {
 
 public:
     ProxyTcpSocket() : ProxySocket() {}
     ProxyTcpSocket(int domain, int protocol) : ProxySocket(domain, SOCK_STREAM, protocol) {}
-    ProxyTcpSocket(co_socket_t *fd, std::string host,
+    ProxyTcpSocket(co_socket_t *fd, const std::string &host,
         uint16_t port) : ProxySocket(fd, host, port) {}
     ProxyTcpSocket(ProxyTcpSocket &&fd) : ProxySocket(std::move(fd)) {}
 
@@ -104,6 +140,9 @@ public:
         return "tcp";
     }
 
+    // take over a connected descriptor received from another process
+    static ProxyTcpSocket *adopt(int, const std::string &, uint16_t);
+
     virtual int listen(int) override;
     virtual ProxyTcpSocket *accept() override;
     virtual ssize_t read_eq(size_t, std::shared_ptr<ProxyBuffer> &) override;
@@ -121,9 +160,9 @@ class ProxyUdpSocket : public ProxySocket {
 public:
     ProxyUdpSocket() : ProxySocket() {}
     ProxyUdpSocket(int domain, int protocol) : ProxySocket(domain, SOCK_DGRAM, protocol) {}
-    ProxyUdpSocket(co_socket_t *fd, std::string host,
+    ProxyUdpSocket(co_socket_t *fd, const std::string &host,
         uint16_t port) : ProxySocket(fd, host, port) {}
-    ProxyUdpSocket(ProxyUdpSocket &&fd) : ProxyUdpSocket(std::move(fd)) {}
+    ProxyUdpSocket(ProxyUdpSocket &&fd) : ProxySocket(std::move(fd)) {}
 
     virtual std::string type() const override{
         return "udp";
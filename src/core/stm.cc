@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include "core/arena.h"
 #include "core/stm.h"
 #include "core/server.h"
 #include "core/tunnel.h"
@@ -13,6 +14,7 @@
 #include "protocol/socks5/socks5.h"
 #include "protocol/intimate/crypto.h"
 #include "protocol/intimate/auth.h"
+#include "protocol/intimate/resume.h"
 #include "protocol/intimate/trans.h"
 
 #include "glog/logging.h"
@@ -32,7 +34,8 @@ void *ProxyStm::startup(void *args) {
 
         p = reinterpret_cast<ProxyStmFlowArgs *>(args);
 
-        std::shared_ptr<ProxySocket> fd(p->fd);
+        std::shared_ptr<ProxySocket> fd(p->fd, std::default_delete<ProxySocket>(),
+            ProxySlabAllocator<ProxySocket>());
 
         switch(p->server->config().mode()) {
             case ProxyServerType::Encryption:
@@ -56,18 +59,33 @@ void *ProxyStm::startup(void *args) {
 
     }
 
-    if(!p) {
-        delete p;
+    delete p;
+
+    return nullptr;
+
+}
+
+void *ProxyStm::resume(void *args) {
+
+    ProxyStmResumeArgs *p = reinterpret_cast<ProxyStmResumeArgs *>(args);
+
+    try {
+        _transmit_common(p->tunnel);
+    } catch (const std::exception &ex) {
+        LOG(ERROR) << "unexpected exception: " << ex.what();
     }
 
+    delete p;
+
     return nullptr;
 
 }
 
 void ProxyStm::_encryption_flow_startup(std::shared_ptr<ProxySocket> fd, ProxyServer *server) {
 
-    std::shared_ptr<ProxyTunnel> tunnel = std::make_shared<ProxyTunnel>(std::move(fd),
-        std::move(nullptr), server, ProxyStmState::PROXY_STM_ENCRYPTION_READY);
+    std::shared_ptr<ProxyTunnel> tunnel = std::allocate_shared<ProxyTunnel>(
+        ProxySlabAllocator<ProxyTunnel>(), std::move(fd), std::move(nullptr), server,
+        ProxyStmState::PROXY_STM_ENCRYPTION_READY);
 
     server->add_tunnel(tunnel);
 
@@ -80,7 +98,8 @@ void ProxyStm::_encryption_flow_startup(std::shared_ptr<ProxySocket> fd, ProxySe
 void ProxyStm::_encryption_flow_rsa_negotiate(std::shared_ptr<ProxyTunnel> &tunnel) {
 
     try {
-        tunnel->ep1(std::make_shared<ProxyTcpSocket>(AF_INET, 0));
+        tunnel->ep1(std::allocate_shared<ProxyTcpSocket>(
+            ProxySlabAllocator<ProxyTcpSocket>(), AF_INET, 0));
         tunnel->ep1()->host(tunnel->server()->config().remote_host());
         tunnel->ep1()->port(tunnel->server()->config().remote_port());
     } catch(const std::exception &ex) {
@@ -95,6 +114,20 @@ void ProxyStm::_encryption_flow_rsa_negotiate(std::shared_ptr<ProxyTunnel> &tunn
         return;
     }
 
+    if(tunnel->server()->config().crypto_resumption()) {
+        if(_encryption_flow_resume(tunnel)) {
+            return;
+        }
+        if(!proxy::protocol::intimate::ProxyProtoResume::on_ticket_request(tunnel)) {
+            return;
+        }
+    }
+
+    if(tunnel->server()->config().crypto_x25519()) {
+        _encryption_flow_ecdh_negotiate(tunnel);
+        return;
+    }
+
     ProxyStmEvent ret =
         proxy::protocol::intimate::ProxyProtoCryptoNegotiate::on_rsa_pubkey_request(tunnel);
 
@@ -118,6 +151,60 @@ void ProxyStm::_encryption_flow_rsa_negotiate(std::shared_ptr<ProxyTunnel> &tunn
 
 }
 
+bool ProxyStm::_encryption_flow_resume(std::shared_ptr<ProxyTunnel> &tunnel) {
+
+    // true when the tunnel is done with the handshake, a rejected ticket goes on with the
+    // key exchange
+    ProxyStmEvent ret =
+        proxy::protocol::intimate::ProxyProtoResume::on_resume_request(tunnel);
+
+    switch(ret) {
+        case ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_REJECT:
+            return false;
+        case ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_OK:
+        case ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL:
+            ProxyStmHelper::switch_state(tunnel, ret);
+            break;
+        default:
+            LOG(ERROR) << tunnel->ep0_ep1_string()
+                << ": the resumption return unexpected "
+                << ProxyStmHelper::event2string(ret);
+            return true;
+    }
+
+    if(ret == ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_OK) {
+        _transmit_common(tunnel);
+    }
+
+    return true;
+
+}
+
+void ProxyStm::_encryption_flow_ecdh_negotiate(std::shared_ptr<ProxyTunnel> &tunnel) {
+
+    ProxyStmEvent ret =
+        proxy::protocol::intimate::ProxyProtoCryptoNegotiate::on_ecdh_request(tunnel);
+
+    switch(ret) {
+        case ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_RECEIVE:
+        case ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL:
+            ProxyStmHelper::switch_state(tunnel, ret);
+            break;
+        default:
+            LOG(ERROR) << tunnel->ep0_ep1_string()
+                << ": the x25519 key exchange return unexpected "
+                << ProxyStmHelper::event2string(ret);
+            return;
+    }
+
+    if(ret == ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_RECEIVE) {
+        _encryption_flow_authenticate(tunnel);
+    }
+
+    return;
+
+}
+
 void ProxyStm::_encryption_flow_aes_negotiate(std::shared_ptr<ProxyTunnel> &tunnel) {
 
     using proxy::protocol::intimate::ProxyProtoCryptoNegotiate;
@@ -125,11 +212,19 @@ void ProxyStm::_encryption_flow_aes_negotiate(std::shared_ptr<ProxyTunnel> &tunn
 
     std::shared_ptr<proxy::crypto::ProxyCryptoAesKeyAndIv> key_iv =
         proxy::crypto::ProxyCryptoAes::generate_key_and_iv();
+    std::shared_ptr<proxy::crypto::ProxyCryptoAesKeyAndIv> key_iv_peer =
+        proxy::crypto::ProxyCryptoAes::generate_key_and_iv();
+    if(!key_iv || !key_iv_peer) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": generate the aes key and iv error";
+        ProxyStmHelper::switch_state(tunnel, ProxyStmEvent::PROXY_STM_EVENT_AES_NEGOTIATING_FAIL);
+        return;
+    }
+
     tunnel->aes_key(key_iv->key());
     tunnel->aes_iv(key_iv->iv());
     tunnel->aes_ctx_setup(proxy::crypto::ProxyCryptoAesContextType::AES_CONTEXT_ENCRYPT_TYPE);
 
-    key_iv = proxy::crypto::ProxyCryptoAes::generate_key_and_iv();
+    key_iv = key_iv_peer;
     tunnel->aes_key_peer(key_iv->key());
     tunnel->aes_iv_peer(key_iv->iv());
     tunnel->aes_ctx_peer_setup(proxy::crypto::ProxyCryptoAesContextType::AES_CONTEXT_DECRYPT_TYPE);
@@ -188,13 +283,15 @@ void ProxyStm::_encryption_flow_authenticate(std::shared_ptr<ProxyTunnel> &tunne
 
 void ProxyStm::_transmission_flow_startup(std::shared_ptr<ProxySocket> fd, ProxyServer *server) {
 
-    std::shared_ptr<ProxyTunnel> tunnel = std::make_shared<ProxyTunnel>(std::move(fd),
-        std::move(nullptr), server, ProxyStmState::PROXY_STM_TRANSMISSION_READY);
+    std::shared_ptr<ProxyTunnel> tunnel = std::allocate_shared<ProxyTunnel>(
+        ProxySlabAllocator<ProxyTunnel>(), std::move(fd), std::move(nullptr), server,
+        ProxyStmState::PROXY_STM_TRANSMISSION_READY);
 
     server->add_tunnel(tunnel);
 
     try {
-        tunnel->ep1(std::make_shared<ProxyTcpSocket>(AF_INET, 0));
+        tunnel->ep1(std::allocate_shared<ProxyTcpSocket>(
+            ProxySlabAllocator<ProxyTcpSocket>(), AF_INET, 0));
         tunnel->ep1()->host(tunnel->server()->config().remote_host());
         tunnel->ep1()->port(tunnel->server()->config().remote_port());
     } catch(const std::exception &ex) {
@@ -217,8 +314,9 @@ void ProxyStm::_transmission_flow_startup(std::shared_ptr<ProxySocket> fd, Proxy
 
 void ProxyStm::_decryption_flow_startup(std::shared_ptr<ProxySocket> fd, ProxyServer *server) {
 
-    std::shared_ptr<ProxyTunnel> tunnel = std::make_shared<ProxyTunnel>(std::move(fd),
-        std::move(nullptr), server, ProxyStmState::PROXY_STM_DECRYPTION_READY);
+    std::shared_ptr<ProxyTunnel> tunnel = std::allocate_shared<ProxyTunnel>(
+        ProxySlabAllocator<ProxyTunnel>(), std::move(fd), std::move(nullptr), server,
+        ProxyStmState::PROXY_STM_DECRYPTION_READY);
 
     server->add_tunnel(tunnel);
 
@@ -237,6 +335,10 @@ void ProxyStm::_decryption_flow_rsa_negotiate(std::shared_ptr<ProxyTunnel> &tunn
     switch(ret) {
         case ProxyStmEvent::PROXY_STM_EVENT_RSA_PUBKEY_SEND:
         case ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL:
+        case ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_SEND:
+        case ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL:
+        case ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_OK:
+        case ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL:
             ProxyStmHelper::switch_state(tunnel, ret);
             break;
         default:
@@ -247,6 +349,10 @@ void ProxyStm::_decryption_flow_rsa_negotiate(std::shared_ptr<ProxyTunnel> &tunn
 
     if(ret == ProxyStmEvent::PROXY_STM_EVENT_RSA_PUBKEY_SEND) {
         _decryption_flow_aes_negotiate(tunnel);
+    } else if(ret == ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_SEND) {
+        _decryption_flow_authenticate(tunnel);
+    } else if(ret == ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_OK) {
+        _decryption_flow_socks5_negotiate(tunnel);
     }
 
     return;
@@ -328,87 +434,106 @@ void ProxyStm::_decryption_flow_socks5_negotiate(std::shared_ptr<ProxyTunnel> &t
 
     ProxyStmHelper::switch_state(tunnel, ProxyStmEvent::PROXY_STM_EVENT_SOCKS5_REQUEST_OK);
 
+    if(tunnel->server()->role() == ProxyWorkerRole::Handshake) {
+        _handoff(tunnel);
+        return;
+    }
+
     _transmit_common(tunnel);
 
 }
 
-void ProxyStm::_transmit_common(std::shared_ptr<ProxyTunnel> &tunnel) {
+void ProxyStm::_handoff(std::shared_ptr<ProxyTunnel> &tunnel) {
 
-    using proxy::protocol::intimate::ProxyProtoTransmitArgs;
+    // the relay worker owns the tunnel from now on, and this worker only drops its copy of
+    // the descriptors
+    if(!tunnel->flush_outbound() || !tunnel->forward_inbound() ||
+        !tunnel->server()->handoff(tunnel)) {
+        ProxyStmHelper::switch_state(tunnel, ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL);
+    }
 
-    co_thread_t *c;
-    co_thread_t *c_r;
+    tunnel->close();
 
-    ProxyProtoTransmitArgs *args = nullptr;
-    ProxyProtoTransmitArgs *args_r = nullptr;
+}
 
-    void*(*fp)(void *);
+void ProxyStm::_transmit_common(std::shared_ptr<ProxyTunnel> &tunnel) {
 
-    try {
-        args = new ProxyProtoTransmitArgs{tunnel};
-        args_r = new ProxyProtoTransmitArgs{tunnel};
-    } catch(const std::exception &ex) {
-        LOG(ERROR) << tunnel->ep0_ep1_string()
-            << ": create the coroutine args error: " << ex.what();
-        if(args) {
-            delete args;
-        }
-        if(args_r) {
-            delete args_r;
-        }
+    if(!tunnel->flush_outbound() || !tunnel->forward_inbound()) {
+        ProxyStmHelper::switch_state(tunnel, ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL);
         return;
     }
 
+    // the handshake material is not needed any more by the established tunnel
+    tunnel->compact();
+
+    // the two directions run on their own, and the last one to end finishes the tunnel,
+    // so this coroutine and its stack go away now
+    for(bool flag : {true, false}) {
+        tunnel->add_relay();
+        if(!relay(tunnel, flag)) {
+            relay_end(tunnel);
+        }
+    }
+
+    return;
+}
+
+bool ProxyStm::relay(const std::shared_ptr<ProxyTunnel> &tunnel, bool flag) {
+
+    using proxy::protocol::intimate::ProxyProtoTransmit;
+    using proxy::protocol::intimate::ProxyProtoTransmitArgs;
+
+    void*(*fp)(void *);
+
     switch(tunnel->server()->config().mode()) {
         case ProxyServerType::Encryption:
-            fp = proxy::protocol::intimate::ProxyProtoTransmit::on_enc_mode_transmit_ep0_ep1;
+            fp = flag ? ProxyProtoTransmit::on_enc_mode_transmit_ep0_ep1 :
+                ProxyProtoTransmit::on_enc_mode_transmit_ep1_ep0;
             break;
         case ProxyServerType::Transmission:
-            fp = proxy::protocol::intimate::ProxyProtoTransmit::on_trans_mode_transmit_ep0_ep1;
+            fp = flag ? ProxyProtoTransmit::on_trans_mode_transmit_ep0_ep1 :
+                ProxyProtoTransmit::on_trans_mode_transmit_ep1_ep0;
             break;
         case ProxyServerType::Decryption:
-            fp = proxy::protocol::intimate::ProxyProtoTransmit::on_dec_mode_transmit_ep0_ep1;
+            fp = flag ? ProxyProtoTransmit::on_dec_mode_transmit_ep0_ep1 :
+                ProxyProtoTransmit::on_dec_mode_transmit_ep1_ep0;
             break;
         default:
-            return;
+            return false;
     }
 
-    if(!(c = coroutine_create(fp, reinterpret_cast<void *>(args)))) {
-        LOG(ERROR) << tunnel->ep0_ep1_string()
-            << ": create the ep0-ep1 coroutine error: "
-            << strerror(errno);
-        delete args;
-        return;
+    // the ring relay ciphers by the mode on its own
+    if(tunnel->server()->config().relay_ring_slots()) {
+        fp = flag ? ProxyProtoTransmit::on_ring_transmit_ep0_ep1 :
+            ProxyProtoTransmit::on_ring_transmit_ep1_ep0;
     }
 
-    switch(tunnel->server()->config().mode()) {
-        case ProxyServerType::Encryption:
-            fp = proxy::protocol::intimate::ProxyProtoTransmit::on_enc_mode_transmit_ep1_ep0;
-            break;
-        case ProxyServerType::Transmission:
-            fp = proxy::protocol::intimate::ProxyProtoTransmit::on_trans_mode_transmit_ep1_ep0;
-            break;
-        case ProxyServerType::Decryption:
-            fp = proxy::protocol::intimate::ProxyProtoTransmit::on_dec_mode_transmit_ep1_ep0;
-            break;
-        default:
-            break;
+    ProxyProtoTransmitArgs *args = nullptr;
+    try {
+        args = new ProxyProtoTransmitArgs{tunnel};
+    } catch(const std::exception &ex) {
+        LOG(ERROR) << tunnel->ep0_ep1_string()
+            << ": create the coroutine args error: " << ex.what();
+        return false;
     }
 
-    if(!(c_r = coroutine_create(fp, reinterpret_cast<void *>(args_r)))) {
-        LOG(ERROR) << tunnel->ep1_ep0_string()
-            << ": create the ep1-ep0 coroutine error: "
-            << strerror(errno);
-        delete args_r;
-        return;
+    co_thread_t *c;
+    if(!(c = coroutine_create(fp, reinterpret_cast<void *>(args)))) {
+        LOG(ERROR) << (flag ? tunnel->ep0_ep1_string() : tunnel->ep1_ep0_string())
+            << ": create the relay coroutine error: " << strerror(errno);
+        delete args;
+        return false;
     }
+    coroutine_setdetachstate(c, COROUTINE_FLAG_NONJOINABLE);
 
-    coroutine_join(c, NULL);
-    coroutine_join(c_r, NULL);
+    return true;
 
-    ProxyStmHelper::switch_state(tunnel, ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL);
+}
 
-    return;
+void ProxyStm::relay_end(std::shared_ptr<ProxyTunnel> &tunnel) {
+    if(!tunnel->del_relay()) {
+        ProxyStmHelper::switch_state(tunnel, ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL);
+    }
 }
 
 const ProxyStmTranslation ProxyStmHelper::stm_table[] = {
@@ -425,6 +550,25 @@ const ProxyStmTranslation ProxyStmHelper::stm_table[] = {
         ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL,
         ProxyStmState::PROXY_STM_ENCRYPTION_FAIL},
 
+    // the x25519 exchange settles the keys in the first round trip, so it skips the
+    // aes negotiation
+    {ProxyStmState::PROXY_STM_ENCRYPTION_RSA_NEGOTIATING,
+        ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_RECEIVE,
+        ProxyStmState::PROXY_STM_ENCRYPTION_AUTHENTICATING},
+
+    {ProxyStmState::PROXY_STM_ENCRYPTION_RSA_NEGOTIATING,
+        ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL,
+        ProxyStmState::PROXY_STM_ENCRYPTION_FAIL},
+
+    // a resumed tunnel has the keys from the ticket and was authenticated by it
+    {ProxyStmState::PROXY_STM_ENCRYPTION_RSA_NEGOTIATING,
+        ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_OK,
+        ProxyStmState::PROXY_STM_ENCRYPTION_TRANSMITTING},
+
+    {ProxyStmState::PROXY_STM_ENCRYPTION_RSA_NEGOTIATING,
+        ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL,
+        ProxyStmState::PROXY_STM_ENCRYPTION_FAIL},
+
     {ProxyStmState::PROXY_STM_ENCRYPTION_AES_NEGOTIATING,
         ProxyStmEvent::PROXY_STM_EVENT_AES_KEY_SEND,
         ProxyStmState::PROXY_STM_ENCRYPTION_AUTHENTICATING},
@@ -461,6 +605,22 @@ const ProxyStmTranslation ProxyStmHelper::stm_table[] = {
         ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL,
         ProxyStmState::PROXY_STM_DECRYPTION_FAIL},
 
+    {ProxyStmState::PROXY_STM_DECRYPTION_RSA_NEGOTIATING,
+        ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_SEND,
+        ProxyStmState::PROXY_STM_DECRYPTION_AUTHENTICATING},
+
+    {ProxyStmState::PROXY_STM_DECRYPTION_RSA_NEGOTIATING,
+        ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL,
+        ProxyStmState::PROXY_STM_DECRYPTION_FAIL},
+
+    {ProxyStmState::PROXY_STM_DECRYPTION_RSA_NEGOTIATING,
+        ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_OK,
+        ProxyStmState::PROXY_STM_DECRYPTION_SOCKS5_HANDSHAKING},
+
+    {ProxyStmState::PROXY_STM_DECRYPTION_RSA_NEGOTIATING,
+        ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL,
+        ProxyStmState::PROXY_STM_DECRYPTION_FAIL},
+
     {ProxyStmState::PROXY_STM_DECRYPTION_AES_NEGOTIATING,
         ProxyStmEvent::PROXY_STM_EVENT_AES_KEY_RECEIVE,
         ProxyStmState::PROXY_STM_DECRYPTION_AUTHENTICATING},
@@ -548,6 +708,13 @@ const std::unordered_map<ProxyStmEvent, std::string> ProxyStmHelper::ProxyStmEve
     {ProxyStmEvent::PROXY_STM_EVENT_AES_KEY_SEND, "PROXY_STM_EVENT_AES_KEY_SEND"},
     {ProxyStmEvent::PROXY_STM_EVENT_AES_KEY_RECEIVE, "PROXY_STM_EVENT_AES_KEY_RECEIVE"},
     {ProxyStmEvent::PROXY_STM_EVENT_AES_NEGOTIATING_FAIL, "PROXY_STM_EVENT_AES_NEGOTIATING_FAIL"},
+    {ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_SEND, "PROXY_STM_EVENT_ECDH_KEY_SEND"},
+    {ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_RECEIVE, "PROXY_STM_EVENT_ECDH_KEY_RECEIVE"},
+    {ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL,
+        "PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL"},
+    {ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_OK, "PROXY_STM_EVENT_RESUMPTION_OK"},
+    {ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_REJECT, "PROXY_STM_EVENT_RESUMPTION_REJECT"},
+    {ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL, "PROXY_STM_EVENT_RESUMPTION_FAIL"},
     {ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_OK, "PROXY_STM_EVENT_AUTHENTICATING_OK"},
     {ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL, "PROXY_STM_EVENT_AUTHENTICATING_FAIL"},
     {ProxyStmEvent::PROXY_STM_EVENT_SOCKS5_HANDSHAKE_OK, "PROXY_STM_EVENT_SOCKS5_HANDSHAKE_OK"},
@@ -555,7 +722,8 @@ const std::unordered_map<ProxyStmEvent, std::string> ProxyStmHelper::ProxyStmEve
     {ProxyStmEvent::PROXY_STM_EVENT_SOCKS5_REQUEST_OK, "PROXY_STM_EVENT_SOCKS5_REQUEST_OK"},
     {ProxyStmEvent::PROXY_STM_EVENT_SOCKS5_REQUEST_FAIL, "PROXY_STM_EVENT_SOCKS5_REQUEST_FAIL"},
     {ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK, "PROXY_STM_EVENT_TRANSMISSION_OK"},
-    {ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL, "PROXY_STM_EVENT_TRANSMISSION_FAIL"}
+    {ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL, "PROXY_STM_EVENT_TRANSMISSION_FAIL"},
+    {ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_IDLE, "PROXY_STM_EVENT_TRANSMISSION_IDLE"}
 };
 
 std::string ProxyStmHelper::state2string(ProxyStmState state) {
@@ -8,6 +8,7 @@
 #include <unordered_map>
 
 #include "core/config.h"
+#include "core/slab.h"
 #include "core/socket.h"
 
 namespace proxy {
@@ -50,6 +51,12 @@ enum class ProxyStmEvent {
     PROXY_STM_EVENT_AES_KEY_SEND,
     PROXY_STM_EVENT_AES_KEY_RECEIVE,
     PROXY_STM_EVENT_AES_NEGOTIATING_FAIL,
+    PROXY_STM_EVENT_ECDH_KEY_SEND,
+    PROXY_STM_EVENT_ECDH_KEY_RECEIVE,
+    PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL,
+    PROXY_STM_EVENT_RESUMPTION_OK,
+    PROXY_STM_EVENT_RESUMPTION_REJECT,
+    PROXY_STM_EVENT_RESUMPTION_FAIL,
     PROXY_STM_EVENT_AUTHENTICATING_OK,
     PROXY_STM_EVENT_AUTHENTICATING_FAIL,
     PROXY_STM_EVENT_SOCKS5_HANDSHAKE_OK,
@@ -57,7 +64,8 @@ enum class ProxyStmEvent {
     PROXY_STM_EVENT_SOCKS5_REQUEST_OK,
     PROXY_STM_EVENT_SOCKS5_REQUEST_FAIL,
     PROXY_STM_EVENT_TRANSMISSION_OK,
-    PROXY_STM_EVENT_TRANSMISSION_FAIL
+    PROXY_STM_EVENT_TRANSMISSION_FAIL,
+    PROXY_STM_EVENT_TRANSMISSION_IDLE
 
 };
 
@@ -68,23 +76,43 @@ public:
     ProxyStmState to;
 };
 
-class ProxyStmFlowArgs {
+class ProxyStmFlowArgs : public ProxySlabObject<ProxyStmFlowArgs> {
 
 public:
+    ProxyStmFlowArgs(ProxySocket *f, ProxyServer *s) : fd(f), server(s) {}
+
     ProxySocket *fd;
     ProxyServer *server;
 
 };
 
+class ProxyStmResumeArgs : public ProxySlabObject<ProxyStmResumeArgs> {
+
+public:
+    explicit ProxyStmResumeArgs(const std::shared_ptr<ProxyTunnel> &t) : tunnel(t) {}
+
+    std::shared_ptr<ProxyTunnel> tunnel;
+
+};
+
 class ProxyStm {
 
 public:
     static void *startup(void *);
+    static void *resume(void *);
+
+    // start the relay coroutine of a direction, flag as the relay coroutines
+    static bool relay(const std::shared_ptr<ProxyTunnel> &, bool);
+
+    // a direction stopped relaying, the last one finishes the tunnel
+    static void relay_end(std::shared_ptr<ProxyTunnel> &);
     virtual ~ProxyStm() =delete;
 
 private:
     static void _encryption_flow_startup(std::shared_ptr<ProxySocket>, ProxyServer *);
     static void _encryption_flow_rsa_negotiate(std::shared_ptr<ProxyTunnel> &);
+    static bool _encryption_flow_resume(std::shared_ptr<ProxyTunnel> &);
+    static void _encryption_flow_ecdh_negotiate(std::shared_ptr<ProxyTunnel> &);
     static void _encryption_flow_aes_negotiate(std::shared_ptr<ProxyTunnel> &);
     static void _encryption_flow_authenticate(std::shared_ptr<ProxyTunnel> &);
 
@@ -97,6 +125,7 @@ private:
     static void _decryption_flow_socks5_negotiate(std::shared_ptr<ProxyTunnel> &);
 
     static void _transmit_common(std::shared_ptr<ProxyTunnel> &);
+    static void _handoff(std::shared_ptr<ProxyTunnel> &);
 
 };
 
@@ -0,0 +1,147 @@
+#include <exception>
+#include <stdexcept>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+#include "core/affinity.h"
+#include "core/thread_pool.h"
+#include "glog/logging.h"
+
+namespace proxy {
+namespace core {
+
+ProxyThreadPool::ProxyThreadPool(const std::string &name, size_t threads, size_t capacity,
+    const std::vector<int> &cpus) :
+    _name(name), _capacity(capacity), _stop(false), _pending(0) {
+
+    // the signals are handled by the main thread only
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    try {
+        for(size_t i = 0; i < threads; ++i) {
+            _threads.emplace_back(&ProxyThreadPool::_run, this);
+        }
+    } catch (const std::exception &ex) {
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cond.notify_all();
+        for(auto &t : _threads) {
+            t.join();
+        }
+        throw std::runtime_error("start the " + _name + " thread pool error: " + ex.what());
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if(cpus.empty()) {
+        return;
+    }
+    for(auto &t : _threads) {
+        if(!ProxyAffinity::pin(t.native_handle(), cpus)) {
+            LOG(WARNING) << "pin the " << _name << " thread error: " << strerror(errno);
+        }
+    }
+
+}
+
+ProxyThreadPool::~ProxyThreadPool() {
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cond.notify_all();
+
+    for(auto &t : _threads) {
+        t.join();
+    }
+
+}
+
+bool ProxyThreadPool::submit(std::function<void()> &&job) {
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_stop || _jobs.size() >= _capacity) {
+            return false;
+        }
+        _jobs.emplace_back(std::move(job));
+        _pending.fetch_add(1, std::memory_order_relaxed);
+    }
+    _cond.notify_one();
+
+    return true;
+
+}
+
+bool ProxyThreadPool::call(std::function<void()> &&job, ProxyEvent &event) {
+
+    ProxyEvent *ev = &event;
+    std::function<void()> f(std::move(job));
+
+    // nothing of the caller is touched after the notification, which is sent even when the
+    // job throws, or the caller would wait forever on its own stack
+    if(!submit([this, &f, ev]() {
+        try {
+            f();
+        } catch (const std::exception &ex) {
+            LOG(ERROR) << "unexpected exception in the " << _name << " thread pool: "
+                << ex.what();
+        } catch (...) {
+            LOG(ERROR) << "unexpected exception in the " << _name << " thread pool";
+        }
+        ev->notify();
+    })) {
+        return false;
+    }
+
+    // the job refers to the stack of the caller, so never leave before it is done
+    while(!ev->wait()) {
+        LOG(ERROR) << "wait for the job of the " << _name << " thread pool error: "
+            << strerror(errno);
+        co_usleep(1000);
+    }
+
+    return true;
+
+}
+
+void ProxyThreadPool::_run() {
+
+    while(1) {
+
+        std::function<void()> job;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return _stop || !_jobs.empty(); });
+            if(_jobs.empty()) {
+                return;
+            }
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+
+        try {
+            job();
+        } catch (const std::exception &ex) {
+            LOG(ERROR) << "unexpected exception in the " << _name << " thread pool: "
+                << ex.what();
+        }
+
+        _pending.fetch_sub(1, std::memory_order_relaxed);
+
+    }
+
+}
+
+}
+}
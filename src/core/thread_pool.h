@@ -0,0 +1,71 @@
+#ifndef PROXY_CORE_THREAD_POOL_H_H_H
+#define PROXY_CORE_THREAD_POOL_H_H_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/event.h"
+
+namespace proxy {
+namespace core {
+
+/*
+ * the plain threads for the cpu bound jobs, the coroutine scheduler stays on the main
+ * thread and waits for the results through the ProxyEvent
+ */
+class ProxyThreadPool {
+
+public:
+    // the threads are pinned to the cpus when given
+    ProxyThreadPool(const std::string &, size_t, size_t,
+        const std::vector<int> &cpus = std::vector<int>());
+    ProxyThreadPool(const ProxyThreadPool &) = delete;
+    ~ProxyThreadPool();
+
+    // false when the queue is full, the caller runs the job by itself then
+    bool submit(std::function<void()> &&);
+
+    // submit and park the calling coroutine on the event until the job has finished
+    bool call(std::function<void()> &&, ProxyEvent &);
+
+    const std::string &name() const {
+        return _name;
+    }
+
+    size_t size() const {
+        return _threads.size();
+    }
+
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    // the jobs which are queued or running
+    size_t pending() const {
+        return _pending.load(std::memory_order_relaxed);
+    }
+
+private:
+    void _run();
+
+    std::string _name;
+    size_t _capacity;
+    bool _stop;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<std::function<void()>> _jobs;
+    std::vector<std::thread> _threads;
+    std::atomic<size_t> _pending;
+
+};
+
+}
+}
+
+#endif
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <exception>
 
 #include <arpa/inet.h>
@@ -6,13 +7,74 @@
 
 #include "core/tunnel.h"
 #include "core/server.h"
+#include "core/idle.h"
 
 #include "glog/logging.h"
 
 namespace proxy {
 namespace core {
 
+const std::string ProxyTunnel::_NONE;
+const size_t ProxyTunnel::_INBOUND_SIZE = 512;
+const size_t ProxyTunnel::_OUTBOUND_SIZE = 512;
+
+static size_t _string_footprint(const std::string &s) {
+    // the short strings live in the object itself
+    return sizeof(s) + (s.capacity() > 15 ? s.capacity() + 1 : 0);
+}
+
+size_t ProxyTunnel::footprint() const {
+
+    // the control block of allocate_shared holds the two counters
+    size_t n = sizeof(ProxyTunnel) + 2 * sizeof(long);
+
+    for(const std::shared_ptr<ProxySocket> &ep : {_ep0, _ep1}) {
+        if(ep) {
+            n += sizeof(ProxyTcpSocket) + 2 * sizeof(long);
+        }
+    }
+
+    if(_handshake) {
+        n += _string_footprint(_handshake->rsa_key) + _string_footprint(_handshake->aes_iv) +
+            _string_footprint(_handshake->aes_key) +
+            _string_footprint(_handshake->aes_iv_peer) +
+            _string_footprint(_handshake->aes_key_peer);
+        for(const std::shared_ptr<ProxyBuffer> &in : _handshake->inbound) {
+            if(in) {
+                n += sizeof(ProxyBuffer) + in->size;
+            }
+        }
+        for(const std::shared_ptr<ProxyBuffer> &out : _handshake->outbound) {
+            if(out) {
+                n += sizeof(ProxyBuffer) + out->size;
+            }
+        }
+    }
+
+    return n;
+
+}
+
+void ProxyTunnel::close() {
+
+    // a parked direction has no coroutine to wake up, so the poller drops it
+    if(_server && _server->idle_poller()) {
+        _server->idle_poller()->unpark(this);
+    }
+
+    if(_ep0 && _ep0->is_used()) {
+        _ep0->close();
+    }
+    if(_ep1 && _ep1->is_used()) {
+        _ep1->close();
+    }
+
+}
+
 ssize_t ProxyTunnel::read_ep0_eq(size_t n, std::shared_ptr<ProxyBuffer> &buffer) {
+    if(!_flush(true)) {
+        return -1;
+    }
     _update_ktime();
     return _ep0->read_eq(n, buffer);
 }
@@ -23,6 +85,9 @@ ssize_t ProxyTunnel::write_ep0_eq(size_t n, std::shared_ptr<ProxyBuffer> &buffer
 }
 
 ssize_t ProxyTunnel::read_ep1_eq(size_t n, std::shared_ptr<ProxyBuffer> &buffer) {
+    if(!_flush(false)) {
+        return -1;
+    }
     _update_ktime();
     return _ep1->read_eq(n, buffer);
 }
@@ -32,90 +97,170 @@ ssize_t ProxyTunnel::write_ep1_eq(size_t n, std::shared_ptr<ProxyBuffer> &buffer
     return _ep1->write_eq(n, buffer);
 }
 
-bool ProxyTunnel::_read_decrypted_byte(unsigned char &data, bool flag) {
-    
-    // flag:
-    //     if true, read the ep0 (endpoint0)
-    //     else, read the ep1 (endpoint1)
-    
-    std::shared_ptr<ProxyBuffer> buf0;
-    std::shared_ptr<ProxyBuffer> buf1;
-
-    try {
-        buf0 = std::make_shared<ProxyBuffer>(1);
-        buf1 = std::make_shared<ProxyBuffer>(1);
-    } catch(const std::exception &ex) {
-        LOG(ERROR) << "create the buffer to read decrypted byte error";
-        return false;
-    }
+bool ProxyTunnel::_stage(std::shared_ptr<ProxyBuffer> &buf, bool flag) {
 
-    if(flag) {
-        if(1 != read_ep0_eq(1, buf0)) {
-            LOG(ERROR) << "read 1 byte from the ep0 error: " << strerror(errno);
+    std::shared_ptr<ProxyBuffer> &out = _handshake_material().outbound[flag ? 0 : 1];
+    size_t n = buf->cur - buf->start;
+
+    if(!out || out->size - out->cur < n) {
+        std::shared_ptr<ProxyBuffer> grown;
+        size_t staged = out ? out->cur - out->start : 0;
+        try {
+            grown = std::make_shared<ProxyBuffer>(std::max(ProxyTunnel::_OUTBOUND_SIZE,
+                staged + n));
+        } catch(const std::exception &ex) {
+            LOG(ERROR) << "create the buffer to stage the handshake error";
             return false;
         }
-    } else {
-        if(1 != read_ep1_eq(1, buf0)) {
-            LOG(ERROR) << "read 1 byte from the ep1 error: " << strerror(errno);
-            return false;
+        if(staged) {
+            memcpy(grown->buffer, out->buffer + out->start, staged);
+            grown->cur = staged;
         }
+        out = std::move(grown);
+    }
+
+    memcpy(out->buffer + out->cur, buf->buffer + buf->start, n);
+    out->cur += n;
+    buf->start = buf->cur;
+    ++_handshake->messages;
+
+    return true;
+
+}
+
+bool ProxyTunnel::stage_ep0(std::shared_ptr<ProxyBuffer> &buf) {
+    return _stage(buf, true);
+}
+
+bool ProxyTunnel::stage_ep1(std::shared_ptr<ProxyBuffer> &buf) {
+    return _stage(buf, false);
+}
+
+bool ProxyTunnel::_flush(bool flag) {
+
+    if(!_handshake) {
+        return true;
+    }
+
+    std::shared_ptr<ProxyBuffer> &out = _handshake->outbound[flag ? 0 : 1];
+    if(!out || out->empty()) {
+        return true;
     }
 
-    if(!proxy::crypto::ProxyCryptoAes::aes_cfb_decrypt(_aes_ctx_peer, buf0, buf1)) {
-        LOG(ERROR) << "decrypt the received 1 byte error";
+    size_t towrite = out->cur - out->start;
+    ssize_t nwrite = flag ? write_ep0_eq(towrite, out) : write_ep1_eq(towrite, out);
+    if(nwrite < 0 || static_cast<size_t>(nwrite) != towrite) {
+        LOG(ERROR) << "write the staged handshake to the " << (flag ? "ep0" : "ep1")
+            << " error: " << strerror(errno);
         return false;
     }
 
-    data = static_cast<unsigned char>(buf1->buffer[0]);
+    out->clear();
+    ++_handshake->writes;
 
     return true;
 
 }
 
-bool ProxyTunnel::read_decrypted_byte_from_ep0(unsigned char &data) {
-    return _read_decrypted_byte(data, true);
-}
+bool ProxyTunnel::flush_outbound() {
+
+    if(!_handshake) {
+        return true;
+    }
+
+    if(!(_flush(true) && _flush(false))) {
+        return false;
+    }
+
+    if(_server && _handshake->messages) {
+        _server->add_handshake(_handshake->messages, _handshake->writes, _cipher);
+    }
+
+    return true;
 
-bool ProxyTunnel::read_decrypted_byte_from_ep1(unsigned char &data) {
-    return _read_decrypted_byte(data, false);
 }
 
-bool ProxyTunnel::_read_decrypted_4bytes(uint32_t &data, bool flag) {
+bool ProxyTunnel::_read_decrypted(char *data, size_t n, bool flag) {
 
     // flag:
     //     if true, read the ep0 (endpoint0)
     //     else, read the ep1 (endpoint1)
-    
-    std::shared_ptr<ProxyBuffer> buf0;
-    std::shared_ptr<ProxyBuffer> buf1;
-
-    try {
-        buf0 = std::make_shared<ProxyBuffer>(4);
-        buf1 = std::make_shared<ProxyBuffer>(4);
-    } catch(const std::exception &ex) {
-        LOG(ERROR) << "create the buffer to read decrypted 4bytes error";
+    //
+    // one read takes whatever the peer has sent and deciphers it at once, and the following
+    // reads of the handshake are served from the buffer
+
+    if(!_flush(flag)) {
         return false;
     }
 
-    if(flag) {
-        if(4 != read_ep0_eq(4, buf0)) {
-            LOG(ERROR) << "read 4 bytes from the ep0 error: " << strerror(errno);
+    std::shared_ptr<ProxyBuffer> &in = _handshake_material().inbound[flag ? 0 : 1];
+
+    if(!in) {
+        try {
+            in = std::make_shared<ProxyBuffer>(ProxyTunnel::_INBOUND_SIZE);
+        } catch(const std::exception &ex) {
+            LOG(ERROR) << "create the buffer to read decrypted data error";
             return false;
         }
-    } else {
-        if(4 != read_ep1_eq(4, buf0)) {
-            LOG(ERROR) << "read 4 bytes from the ep1 error: " << strerror(errno);
-            return false;
+    }
+
+    while(n) {
+
+        if(in->empty()) {
+
+            in->clear();
+
+            _update_ktime();
+            ssize_t nread = flag ? _ep0->read(in) : _ep1->read(in);
+            if(nread < 0) {
+                LOG(ERROR) << "read from the " << (flag ? "ep0" : "ep1") << " error: "
+                    << strerror(errno);
+                return false;
+            } else if(nread == 0) {
+                LOG(ERROR) << "the " << (flag ? "ep0" : "ep1") << " is closed in the middle of "
+                    << "the handshake";
+                return false;
+            }
+
+            if(!proxy::crypto::ProxyCryptoAes::decrypt(_aes_ctx_peer, in)) {
+                LOG(ERROR) << "decrypt the received data error";
+                return false;
+            }
+
         }
+
+        size_t m = std::min(n, in->cur - in->start);
+        memcpy(data, in->buffer + in->start, m);
+        in->start += m;
+        data += m;
+        n -= m;
+
     }
 
-    if(!proxy::crypto::ProxyCryptoAes::aes_cfb_decrypt(_aes_ctx_peer, buf0, buf1)) {
-        LOG(ERROR) << "decrypt the received 4 bytes error";
+    return true;
+
+}
+
+bool ProxyTunnel::_read_decrypted_byte(unsigned char &data, bool flag) {
+    return _read_decrypted(reinterpret_cast<char *>(&data), 1, flag);
+}
+
+bool ProxyTunnel::read_decrypted_byte_from_ep0(unsigned char &data) {
+    return _read_decrypted_byte(data, true);
+}
+
+bool ProxyTunnel::read_decrypted_byte_from_ep1(unsigned char &data) {
+    return _read_decrypted_byte(data, false);
+}
+
+bool ProxyTunnel::_read_decrypted_4bytes(uint32_t &data, bool flag) {
+
+    uint32_t n;
+    if(!_read_decrypted(reinterpret_cast<char *>(&n), 4, flag)) {
         return false;
     }
 
-    uint32_t *p = reinterpret_cast<uint32_t *>(buf1->get_charp_at(0));
-    data = ntohl(*p);
+    data = ntohl(n);
 
     return true;
 
@@ -131,45 +276,14 @@ bool ProxyTunnel::read_decrypted_4bytes_from_ep1(uint32_t &data) {
 
 bool ProxyTunnel::_read_decrypted_string(size_t toread, std::string &data, bool flag) {
 
-    // flag:
-    //     if true, read the ep0 (endpoint0)
-    //     else, read the ep1 (endpoint1)
-    
-    std::shared_ptr<ProxyBuffer> buf0;
-    std::shared_ptr<ProxyBuffer> buf1;
-
-    try {
-        buf0 = std::make_shared<ProxyBuffer>(toread);
-        buf1 = std::make_shared<ProxyBuffer>(toread);
-    } catch(const std::exception &ex) {
-        LOG(ERROR) << "create the buffer to read decrypted string error";
+    data.resize(toread);
+    if(toread && !_read_decrypted(&data[0], toread, flag)) {
+        data.clear();
         return false;
     }
 
-    ssize_t nread;
-    if(flag) {
-        nread = read_ep0_eq(toread, buf0);
-    } else {
-        nread = read_ep1_eq(toread, buf0);
-    }
-
-    if(nread < 0 || static_cast<size_t>(nread) != toread) {
-        if(flag) {
-            LOG(ERROR) << "read the string from the ep0 error: " << strerror(errno);
-        } else {
-            LOG(ERROR) << "read the string from the ep1 error: " << strerror(errno);
-        }
-        return false;
-    }
-
-    if(!proxy::crypto::ProxyCryptoAes::aes_cfb_decrypt(_aes_ctx_peer, buf0, buf1)) {
-        LOG(ERROR) << "decrypt the received string error";
-        return false;
-    }
-
-    data = std::string(buf1->buffer, buf1->cur);
-
     return true;
+
 }
 
 bool ProxyTunnel::read_decrypted_string_from_ep0(size_t n, std::string &data) {
@@ -180,5 +294,36 @@ bool ProxyTunnel::read_decrypted_string_from_ep1(size_t n, std::string &data) {
     return _read_decrypted_string(n, data, false);
 }
 
+bool ProxyTunnel::forward_inbound() {
+
+    if(!_handshake) {
+        return true;
+    }
+
+    for(bool flag : {true, false}) {
+
+        std::shared_ptr<ProxyBuffer> &in = _handshake->inbound[flag ? 0 : 1];
+        if(!in || in->empty()) {
+            continue;
+        }
+
+        // the ep0 bytes are already deciphered for the ep1, and the other way around
+        size_t towrite = in->cur - in->start;
+        ssize_t nwrite = flag ? write_ep1_eq(towrite, in) : write_ep0_eq(towrite, in);
+        if(nwrite < 0 || static_cast<size_t>(nwrite) != towrite) {
+            LOG(ERROR) << (flag ? ep0_ep1_string() : ep1_ep0_string())
+                << ": forward the bytes read ahead of the handshake error: " << strerror(errno);
+            return false;
+        }
+
+        add_bytes(static_cast<int64_t>(towrite));
+        in.reset();
+
+    }
+
+    return true;
+
+}
+
 }
 }
@@ -12,30 +12,69 @@
 #include <sys/types.h>
 
 #include "core/buffer.h"
+#include "core/slab.h"
 #include "core/socket.h"
 #include "core/stm.h"
 #include "crypto/aes.h"
+#include "crypto/rsa.h"
 
 namespace proxy {
 namespace core {
 
 class ProxyServer;
 
+// the keys exchanged by the handshake, which the relay does not need
+class ProxyTunnelHandshake : public ProxySlabObject<ProxyTunnelHandshake> {
+
+public:
+    std::string rsa_key;
+    std::string aes_iv;
+    std::string aes_key;
+    std::string aes_iv_peer;
+    std::string aes_key_peer;
+
+    ProxyTunnelHandshake() : rsa_cached(false), ticket(false), messages(0), writes(0) {}
+
+    // the parsed public key of the peer, which came from the cache when rsa_cached
+    std::shared_ptr<proxy::crypto::ProxyCryptoRsaPublicKey> rsa_pubkey;
+    bool rsa_cached;
+
+    // the peer asked for a resumption ticket
+    bool ticket;
+
+    // the decrypted bytes read ahead from ep0 and ep1, between start and cur
+    std::shared_ptr<ProxyBuffer> inbound[2];
+
+    // the messages to ep0 and ep1 which are sent together at the end of the flight
+    std::shared_ptr<ProxyBuffer> outbound[2];
+    uint32_t messages;
+    uint32_t writes;
+
+};
 
 class ProxyTunnel {
 
 public:
 
     ProxyTunnel(ProxySocket *ep0, ProxySocket *ep1, ProxyServer *server, ProxyStmState state) :
-        _ep0(ep0), _ep1(ep1), _server(server), _state(state), _ktime(time(NULL)) {}
+        _ep0(ep0), _ep1(ep1), _server(server), _state(state),
+        _cipher(proxy::crypto::ProxyCryptoCipherSuite::AES_128_CFB), _ktime(time(NULL)),
+        _bytes(0), _bytes_mark(0), _parked{false, false}, _migrate_to(-1), _relays(0),
+        _relay_size{0, 0}, _small_reads{0, 0} {}
 
     ProxyTunnel(const std::shared_ptr<ProxySocket> &ep0, const std::shared_ptr<ProxySocket> &ep1,
         ProxyServer *server, ProxyStmState state): _ep0(ep0), _ep1(ep1), _server(server),
-        _state(state), _ktime(time(NULL)) {}
+        _state(state), _cipher(proxy::crypto::ProxyCryptoCipherSuite::AES_128_CFB),
+        _ktime(time(NULL)),
+        _bytes(0), _bytes_mark(0), _parked{false, false}, _migrate_to(-1), _relays(0),
+        _relay_size{0, 0}, _small_reads{0, 0} {}
             
     ProxyTunnel(std::shared_ptr<ProxySocket> &&ep0, std::shared_ptr<ProxySocket> &&ep1,
         ProxyServer *server, ProxyStmState state) : _ep0(std::move(ep0)), _ep1(std::move(ep1)),
-        _server(server), _state(state), _ktime(time(NULL)) {}
+        _server(server), _state(state),
+        _cipher(proxy::crypto::ProxyCryptoCipherSuite::AES_128_CFB), _ktime(time(NULL)),
+        _bytes(0), _bytes_mark(0), _parked{false, false}, _migrate_to(-1), _relays(0),
+        _relay_size{0, 0}, _small_reads{0, 0} {}
 
     virtual ~ProxyTunnel() =default;
 
@@ -85,67 +124,105 @@ public:
         return _server;
     }
 
+    // the handshake material, released by compact() once the tunnel relays
     const std::string &rsa_key() const {
-        return _rsa_key;
+        return _handshake ? _handshake->rsa_key : ProxyTunnel::_NONE;
     }
 
     void rsa_key(const std::string &key) {
-        _rsa_key = key;
+        _handshake_material().rsa_key = key;
     }
 
     void rsa_key(std::string &&key) {
-        _rsa_key = std::move(key);
+        _handshake_material().rsa_key = std::move(key);
+    }
+
+    std::shared_ptr<proxy::crypto::ProxyCryptoRsaPublicKey> rsa_pubkey() const {
+        return _handshake ? _handshake->rsa_pubkey : nullptr;
+    }
+
+    void rsa_pubkey(const std::shared_ptr<proxy::crypto::ProxyCryptoRsaPublicKey> &key,
+        bool cached) {
+        _handshake_material().rsa_pubkey = key;
+        _handshake->rsa_cached = cached;
+    }
+
+    bool rsa_cached() const {
+        return _handshake && _handshake->rsa_cached;
     }
 
+    bool ticket_wanted() const {
+        return _handshake && _handshake->ticket;
+    }
+
+    void ticket_wanted(bool t) {
+        _handshake_material().ticket = t;
+    }
 
     const std::string &aes_iv() const {
-        return _aes_iv;
+        return _handshake ? _handshake->aes_iv : ProxyTunnel::_NONE;
     }
 
     void aes_iv(const std::string &iv) {
-        _aes_iv = iv;
+        _handshake_material().aes_iv = iv;
     }
 
     void aes_iv(std::string &&iv) {
-        _aes_iv = std::move(iv);
+        _handshake_material().aes_iv = std::move(iv);
     }
 
     const std::string &aes_key() const {
-        return _aes_key;
+        return _handshake ? _handshake->aes_key : ProxyTunnel::_NONE;
     }
 
     void aes_key(const std::string &key) {
-        _aes_key = key;
+        _handshake_material().aes_key = key;
     }
 
     void aes_key(std::string &&key) {
-        _aes_key = std::move(key);
+        _handshake_material().aes_key = std::move(key);
     }
 
     const std::string &aes_iv_peer() const {
-        return _aes_iv_peer;
+        return _handshake ? _handshake->aes_iv_peer : ProxyTunnel::_NONE;
     }
 
     void aes_iv_peer(const std::string &iv) {
-        _aes_iv_peer = iv;
+        _handshake_material().aes_iv_peer = iv;
     }
 
     void aes_iv_peer(std::string &&iv) {
-        _aes_iv_peer = std::move(iv);
+        _handshake_material().aes_iv_peer = std::move(iv);
     }
 
     const std::string &aes_key_peer() const {
-        return _aes_key_peer;
+        return _handshake ? _handshake->aes_key_peer : ProxyTunnel::_NONE;
     }
 
     void aes_key_peer(const std::string &key) {
-        _aes_key_peer = key;
+        _handshake_material().aes_key_peer = key;
     }
 
     void aes_key_peer(std::string &&key) {
-        _aes_key_peer = std::move(key);
+        _handshake_material().aes_key_peer = std::move(key);
+    }
+
+    // the contexts keep their own key, so the strings above are not needed to relay
+    void compact() {
+        _handshake.reset();
     }
 
+    // the staged messages are written before the relay starts, and the flights of the
+    // handshake are reported to the server
+    bool flush_outbound();
+
+    // the bytes read ahead of the handshake belong to the relay, so they are written to the
+    // other endpoint before the relay starts
+    bool forward_inbound();
+
+    // the bytes held by the tunnel and its endpoints
+    size_t footprint() const;
+
     std::string ep0_ep1_string() const {
         if(!_ep1) {
             return _ep0->to_string();
@@ -160,46 +237,108 @@ public:
         return _ep1->to_string() + "->" + _ep0->to_string();
     }
 
+    // the negotiated stream cipher of both directions, aes-128-cfb with the old peers
+    proxy::crypto::ProxyCryptoCipherSuite cipher() const {
+        return _cipher;
+    }
+
+    void cipher(proxy::crypto::ProxyCryptoCipherSuite suite) {
+        _cipher = suite;
+    }
+
     bool aes_ctx_setup(proxy::crypto::ProxyCryptoAesContextType ty) {
-        _aes_ctx = std::make_shared<proxy::crypto::ProxyCryptoAesContext>();
-        return _aes_ctx->setup(ty, _aes_key, _aes_iv);
+        return _aes_ctx.setup(ty, _cipher, aes_key(), aes_iv());
     }
 
-    std::shared_ptr<proxy::crypto::ProxyCryptoAesContext> &aes_ctx() {
+    proxy::crypto::ProxyCryptoAesContext &aes_ctx() {
         return _aes_ctx;
     }
 
-    const std::shared_ptr<proxy::crypto::ProxyCryptoAesContext> &aes_ctx() const {
+    const proxy::crypto::ProxyCryptoAesContext &aes_ctx() const {
         return _aes_ctx;
     }
 
     bool aes_ctx_peer_setup(proxy::crypto::ProxyCryptoAesContextType ty) {
-        _aes_ctx_peer = std::make_shared<proxy::crypto::ProxyCryptoAesContext>();
-        return _aes_ctx_peer->setup(ty, _aes_key_peer, _aes_iv_peer);
+        return _aes_ctx_peer.setup(ty, _cipher, aes_key_peer(), aes_iv_peer());
     }
 
-    std::shared_ptr<proxy::crypto::ProxyCryptoAesContext> &aes_ctx_peer() {
+    proxy::crypto::ProxyCryptoAesContext &aes_ctx_peer() {
         return _aes_ctx_peer;
     }
 
-    const std::shared_ptr<proxy::crypto::ProxyCryptoAesContext> &aes_ctx_peer() const {
+    const proxy::crypto::ProxyCryptoAesContext &aes_ctx_peer() const {
         return _aes_ctx_peer;
     }
 
-    void close() {
-        if(_ep0 && _ep0->is_used()) {
-            _ep0->close();
-        }
-        if(_ep1 && _ep1->is_used()) {
-            _ep1->close();
-        }
+    int64_t bytes() const {
+        return _bytes;
+    }
+
+    void add_bytes(int64_t n) {
+        _bytes += n;
+    }
+
+    // the bytes since the last call, used by the rebalancer
+    int64_t take_bytes_delta() {
+        int64_t d = _bytes - _bytes_mark;
+        _bytes_mark = _bytes;
+        return d;
+    }
+
+    // the direction waits in the idle poller and owns no coroutine,
+    // flag: true for the ep0-ep1 direction, false for the ep1-ep0 direction
+    bool parked(bool flag) const {
+        return _parked[flag ? 0 : 1];
+    }
+
+    void parked(bool flag, bool p) {
+        _parked[flag ? 0 : 1] = p;
+    }
+
+    // the relay worker which the tunnel moves to at the next read boundary, -1 for none
+    int migrate_to() const {
+        return _migrate_to;
+    }
+
+    void migrate_to(int id) {
+        _migrate_to = id;
+    }
+
+    // the relay directions which are running or parked
+    void add_relay() {
+        ++_relays;
+    }
+
+    int del_relay() {
+        return --_relays;
     }
 
+    // the relay buffer size of the direction, 0 before the first chunk
+    size_t relay_size(bool flag) const {
+        return _relay_size[flag ? 0 : 1];
+    }
+
+    void relay_size(bool flag, size_t n) {
+        _relay_size[flag ? 0 : 1] = n;
+    }
+
+    // the reads in a row which used a small part of the relay buffer
+    uint32_t &small_reads(bool flag) {
+        return _small_reads[flag ? 0 : 1];
+    }
+
+    void close();
+
     ssize_t read_ep0_eq(size_t, std::shared_ptr<ProxyBuffer> &);
     ssize_t write_ep0_eq(size_t, std::shared_ptr<ProxyBuffer> &);
     ssize_t read_ep1_eq(size_t, std::shared_ptr<ProxyBuffer> &);
     ssize_t write_ep1_eq(size_t, std::shared_ptr<ProxyBuffer> &);
 
+    // the handshake messages wait until the tunnel reads from the same endpoint, so a flight
+    // goes out in one write
+    bool stage_ep0(std::shared_ptr<ProxyBuffer> &);
+    bool stage_ep1(std::shared_ptr<ProxyBuffer> &);
+
     bool read_decrypted_byte_from_ep0(unsigned char &);
     bool read_decrypted_byte_from_ep1(unsigned char &);
     bool read_decrypted_4bytes_from_ep0(uint32_t &);
@@ -213,18 +352,24 @@ protected:
     std::shared_ptr<ProxySocket> _ep1;
     ProxyServer *_server;
     ProxyStmState _state;
+    proxy::crypto::ProxyCryptoCipherSuite _cipher;
     time_t _ktime;
 
-    std::string _rsa_key;
-
-    std::string _aes_iv;
-    std::string _aes_key;
-    std::shared_ptr<proxy::crypto::ProxyCryptoAesContext> _aes_ctx;
-
-    std::string _aes_iv_peer;
-    std::string _aes_key_peer;
-    std::shared_ptr<proxy::crypto::ProxyCryptoAesContext> _aes_ctx_peer;
-
+    std::unique_ptr<ProxyTunnelHandshake> _handshake;
+    proxy::crypto::ProxyCryptoAesContext _aes_ctx;
+    proxy::crypto::ProxyCryptoAesContext _aes_ctx_peer;
+
+    int64_t _bytes;
+    int64_t _bytes_mark;
+    bool _parked[2];
+    int _migrate_to;
+    int _relays;
+    size_t _relay_size[2];
+    uint32_t _small_reads[2];
+
+    bool _stage(std::shared_ptr<ProxyBuffer> &, bool);
+    bool _flush(bool);
+    bool _read_decrypted(char *, size_t, bool);
     bool _read_decrypted_byte(unsigned char &, bool);
     bool _read_decrypted_4bytes(uint32_t &, bool);
     bool _read_decrypted_string(size_t, std::string &, bool);
@@ -233,6 +378,17 @@ protected:
         _ktime = time(NULL);
     }
 
+    ProxyTunnelHandshake &_handshake_material() {
+        if(!_handshake) {
+            _handshake.reset(new ProxyTunnelHandshake());
+        }
+        return *_handshake;
+    }
+
+    static const std::string _NONE;
+    static const size_t _INBOUND_SIZE;
+    static const size_t _OUTBOUND_SIZE;
+
 
 };
 
@@ -0,0 +1,566 @@
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "core/arena.h"
+#include "core/uring.h"
+#include "glog/logging.h"
+
+namespace proxy {
+namespace core {
+
+const size_t ProxyUring::FIXED_FILES_MAX = 65536;
+const size_t ProxyUring::FIXED_BUFFERS_MAX = 256;
+const uint32_t ProxyUring::SQPOLL_IDLE = 1000;
+
+ProxyUring *ProxyUring::_instance = nullptr;
+
+static int _io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int _io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr));
+}
+
+bool ProxyUring::setup(size_t entries, bool sqpoll) {
+
+    if(_instance) {
+        return true;
+    }
+
+    try {
+        _instance = new ProxyUring(entries, sqpoll);
+    } catch (const std::exception &ex) {
+        LOG(ERROR) << "create the io_uring error: " << ex.what();
+        return false;
+    }
+
+    // the buffers are carved from the arena, so its mappings are the fixed buffers
+    ProxyArena::map_hook(&ProxyUring::_on_map);
+
+    return true;
+
+}
+
+void ProxyUring::destroy() {
+    ProxyArena::map_hook(nullptr);
+    delete _instance;
+    _instance = nullptr;
+}
+
+ProxyUring::ProxyUring(size_t entries, bool sqpoll) : _ring(-1), _sqpoll(sqpoll),
+    _skip_cqe(false), _sq_ptr(MAP_FAILED), _sq_size(0), _cq_ptr(MAP_FAILED), _cq_size(0),
+    _sqes(static_cast<struct io_uring_sqe *>(MAP_FAILED)), _sqes_size(0),
+    _sq_local_tail(0), _buffers_registered(0), _buffers_enabled(false),
+    _ops(0), _enters(0), _fixed_file_ops(0), _fixed_buffer_ops(0) {
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    // every request posts one cqe, and one more for the eventfd when it can not be skipped
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = static_cast<unsigned>(entries * 2);
+    if(sqpoll) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = ProxyUring::SQPOLL_IDLE;
+    }
+
+    if((_ring = _io_uring_setup(static_cast<unsigned>(entries), &p)) < 0) {
+        throw std::runtime_error(std::string("io_uring_setup error: ") + strerror(errno));
+    }
+
+    if(!(p.features & IORING_FEAT_NODROP)) {
+        ::close(_ring);
+        throw std::runtime_error("the kernel may drop the completions, which is unsupported");
+    }
+    _skip_cqe = (p.features & IORING_FEAT_CQE_SKIP) ? true : false;
+
+    _sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+    }
+
+    _sq_ptr = mmap(NULL, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        _ring, IORING_OFF_SQ_RING);
+    if(_sq_ptr == MAP_FAILED) {
+        int err = errno;
+        ::close(_ring);
+        throw std::runtime_error(std::string("map the submission ring error: ") + strerror(err));
+    }
+
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_ptr = _sq_ptr;
+    } else {
+        _cq_ptr = mmap(NULL, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            _ring, IORING_OFF_CQ_RING);
+        if(_cq_ptr == MAP_FAILED) {
+            int err = errno;
+            munmap(_sq_ptr, _sq_size);
+            ::close(_ring);
+            throw std::runtime_error(std::string("map the completion ring error: ")
+                + strerror(err));
+        }
+    }
+
+    _sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    _sqes = static_cast<struct io_uring_sqe *>(mmap(NULL, _sqes_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring, IORING_OFF_SQES));
+    if(_sqes == MAP_FAILED) {
+        int err = errno;
+        if(_cq_ptr != _sq_ptr) {
+            munmap(_cq_ptr, _cq_size);
+        }
+        munmap(_sq_ptr, _sq_size);
+        ::close(_ring);
+        throw std::runtime_error(std::string("map the submission entries error: ")
+            + strerror(err));
+    }
+
+    char *sq = static_cast<char *>(_sq_ptr);
+    _sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    _sq_flags = reinterpret_cast<unsigned *>(sq + p.sq_off.flags);
+    _sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    _sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    _sq_entries = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_entries);
+    _sq_local_tail = *_sq_tail;
+
+    char *cq = static_cast<char *>(_cq_ptr);
+    _cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    _cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    _cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    // the sparse tables, the slots are filled when the descriptors and the buffers show up
+    struct rlimit rl;
+    size_t nfiles = ProxyUring::FIXED_FILES_MAX;
+    if(!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur != RLIM_INFINITY) {
+        nfiles = std::min(nfiles, static_cast<size_t>(rl.rlim_cur));
+    }
+
+    struct io_uring_rsrc_register rr;
+    memset(&rr, 0, sizeof(rr));
+    rr.nr = static_cast<uint32_t>(nfiles);
+    rr.flags = IORING_RSRC_REGISTER_SPARSE;
+    if(_io_uring_register(_ring, IORING_REGISTER_FILES2, &rr, sizeof(rr)) < 0) {
+        LOG(WARNING) << "register the fixed files of the io_uring error: " << strerror(errno);
+    } else {
+        _files.resize(nfiles, false);
+    }
+
+    memset(&rr, 0, sizeof(rr));
+    rr.nr = static_cast<uint32_t>(ProxyUring::FIXED_BUFFERS_MAX);
+    rr.flags = IORING_RSRC_REGISTER_SPARSE;
+    if(_io_uring_register(_ring, IORING_REGISTER_BUFFERS2, &rr, sizeof(rr)) < 0) {
+        LOG(WARNING) << "register the fixed buffers of the io_uring error: " << strerror(errno);
+    } else {
+        _buffers_enabled = true;
+    }
+
+}
+
+ProxyUring::~ProxyUring() {
+
+    for(auto &w : _waiters) {
+        co_close(w->sock);
+    }
+
+    munmap(_sqes, _sqes_size);
+    if(_cq_ptr != _sq_ptr) {
+        munmap(_cq_ptr, _cq_size);
+    }
+    munmap(_sq_ptr, _sq_size);
+    ::close(_ring);
+
+}
+
+void ProxyUring::_on_map(void *p, size_t size) {
+
+    ProxyUring *uring = _instance;
+    if(!uring || !uring->_buffers_enabled) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(uring->_buffers_mutex);
+
+    if(uring->_buffers_registered >= ProxyUring::FIXED_BUFFERS_MAX) {
+        return;
+    }
+
+    struct iovec iov;
+    iov.iov_base = p;
+    iov.iov_len = size;
+
+    struct io_uring_rsrc_update2 up;
+    memset(&up, 0, sizeof(up));
+    up.offset = static_cast<uint32_t>(uring->_buffers_registered);
+    up.data = reinterpret_cast<uint64_t>(&iov);
+    up.nr = 1;
+
+    // e.g. over RLIMIT_MEMLOCK, the new regions are served by the plain requests then
+    if(_io_uring_register(uring->_ring, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up)) < 1) {
+        LOG(WARNING) << "register the fixed buffer of the io_uring error: " << strerror(errno);
+        uring->_buffers_enabled = false;
+        return;
+    }
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(p);
+    uring->_buffers[start] = std::make_pair(start + size,
+        static_cast<int>(uring->_buffers_registered));
+    ++uring->_buffers_registered;
+
+}
+
+size_t ProxyUring::fixed_buffers() const {
+    std::lock_guard<std::mutex> lock(_buffers_mutex);
+    return _buffers_registered;
+}
+
+int ProxyUring::_fixed_buffer(const void *buf, size_t len) {
+
+    std::lock_guard<std::mutex> lock(_buffers_mutex);
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(buf);
+    auto it = _buffers.upper_bound(start);
+    if(it == _buffers.begin()) {
+        return -1;
+    }
+    --it;
+
+    if(start + len > it->second.first) {
+        return -1;
+    }
+
+    return it->second.second;
+
+}
+
+bool ProxyUring::_fixed_file(int fd) {
+
+    if(fd < 0 || static_cast<size_t>(fd) >= _files.size()) {
+        return false;
+    }
+
+    if(_files[fd]) {
+        return true;
+    }
+
+    struct io_uring_files_update up;
+    memset(&up, 0, sizeof(up));
+    up.offset = static_cast<uint32_t>(fd);
+    up.fds = reinterpret_cast<uint64_t>(&fd);
+    if(_io_uring_register(_ring, IORING_REGISTER_FILES_UPDATE, &up, 1) < 1) {
+        return false;
+    }
+
+    _files[fd] = true;
+
+    return true;
+
+}
+
+ProxyUringWaiter *ProxyUring::_acquire() {
+
+    if(!_idle.empty()) {
+        ProxyUringWaiter *w = _idle.back();
+        _idle.pop_back();
+        return w;
+    }
+
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(efd < 0) {
+        return nullptr;
+    }
+
+    // the coroutine framework can only park on the sockets created by itself
+    co_socket_t *sock = co_socket(AF_UNIX, SOCK_DGRAM, 0);
+    if(!sock) {
+        ::close(efd);
+        return nullptr;
+    }
+
+    if(dup2(efd, co_socket_get_fd(sock)) < 0) {
+        ::close(efd);
+        co_close(sock);
+        return nullptr;
+    }
+    ::close(efd);
+
+    std::unique_ptr<ProxyUringWaiter> w(new ProxyUringWaiter());
+    w->sock = sock;
+    w->fd = -1;
+    w->res = 0;
+    w->done = false;
+    w->one = 1;
+    _waiters.push_back(std::move(w));
+
+    return _waiters.back().get();
+
+}
+
+void ProxyUring::_release(ProxyUringWaiter *w) {
+
+    auto it = _inflight.find(w->fd);
+    if(it != _inflight.end()) {
+        std::vector<ProxyUringWaiter *> &ws = it->second;
+        ws.erase(std::remove(ws.begin(), ws.end(), w), ws.end());
+        if(ws.empty()) {
+            _inflight.erase(it);
+        }
+    }
+
+    w->fd = -1;
+    _idle.push_back(w);
+
+}
+
+struct io_uring_sqe *ProxyUring::_get_sqe() {
+
+    unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    if(_sq_local_tail - head >= _sq_entries) {
+        return nullptr;
+    }
+
+    unsigned idx = _sq_local_tail & _sq_mask;
+    struct io_uring_sqe *sqe = &_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    _sq_array[idx] = idx;
+    ++_sq_local_tail;
+
+    return sqe;
+
+}
+
+void ProxyUring::_flush() {
+    __atomic_store_n(_sq_tail, _sq_local_tail, __ATOMIC_RELEASE);
+}
+
+int ProxyUring::_enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    ++_enters;
+    return static_cast<int>(syscall(__NR_io_uring_enter, _ring, to_submit, min_complete,
+        flags, NULL, 0));
+}
+
+void ProxyUring::_submit() {
+
+    if(_sqpoll) {
+        if(__atomic_load_n(_sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) {
+            _enter(0, 0, IORING_ENTER_SQ_WAKEUP);
+        }
+        return;
+    }
+
+    unsigned pending = _sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    if(pending) {
+        _enter(pending, 0, 0);
+    }
+
+}
+
+void ProxyUring::_reap() {
+
+    // the overflowed completions are flushed into the ring by entering the kernel
+    if(__atomic_load_n(_sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+        _enter(0, 0, IORING_ENTER_GETEVENTS);
+    }
+
+    unsigned head = *_cq_head;
+    unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+
+    for(; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &_cqes[head & _cq_mask];
+        ProxyUringWaiter *w = reinterpret_cast<ProxyUringWaiter *>(cqe->user_data);
+        if(w) {
+            w->res = cqe->res;
+            w->done = true;
+        }
+    }
+
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+
+}
+
+ssize_t ProxyUring::_perform(struct io_uring_sqe &op, int fd, const void *buf, size_t len) {
+
+    // the request and its wakeup go into the ring together
+    if(_sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) + 2 > _sq_entries) {
+        _submit();
+        if(_sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) + 2 > _sq_entries) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    ProxyUringWaiter *w = _acquire();
+    if(!w) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if(_fixed_file(fd)) {
+        op.flags |= IOSQE_FIXED_FILE;
+        ++_fixed_file_ops;
+    }
+
+    if(buf) {
+        int idx = _fixed_buffer(buf, len);
+        if(idx >= 0) {
+            op.opcode = (op.opcode == IORING_OP_READ) ? IORING_OP_READ_FIXED :
+                IORING_OP_WRITE_FIXED;
+            op.buf_index = static_cast<uint16_t>(idx);
+            ++_fixed_buffer_ops;
+        }
+    }
+
+    w->fd = fd;
+    w->res = 0;
+    w->done = false;
+    _inflight[fd].push_back(w);
+
+    struct io_uring_sqe *sqe = _get_sqe();
+    *sqe = op;
+    sqe->fd = fd;
+    sqe->flags |= IOSQE_IO_HARDLINK;
+    sqe->user_data = reinterpret_cast<uint64_t>(w);
+
+    sqe = _get_sqe();
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = co_socket_get_fd(w->sock);
+    sqe->addr = reinterpret_cast<uint64_t>(&w->one);
+    sqe->len = sizeof(w->one);
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->flags = _skip_cqe ? IOSQE_CQE_SKIP_SUCCESS : 0;
+    sqe->user_data = 0;
+
+    _flush();
+    ++_ops;
+
+    // let the other runnable coroutines queue their requests, then submit them at once
+    if(!_sqpoll) {
+        co_usleep(0);
+    }
+    _submit();
+
+    uint64_t count;
+    while(!w->done) {
+        if(co_read(w->sock, &count, sizeof(count)) < 0 && errno != EAGAIN && errno != EINTR) {
+            // the eventfd is broken, wait in the kernel rather than spin
+            _enter(0, 1, IORING_ENTER_GETEVENTS);
+        }
+        _reap();
+    }
+
+    int32_t res = w->res;
+    _release(w);
+
+    if(res < 0) {
+        errno = -res;
+        return -1;
+    }
+
+    return res;
+
+}
+
+ssize_t ProxyUring::read(int fd, void *buf, size_t len) {
+
+    struct io_uring_sqe op;
+    memset(&op, 0, sizeof(op));
+    op.opcode = IORING_OP_READ;
+    op.addr = reinterpret_cast<uint64_t>(buf);
+    op.len = static_cast<uint32_t>(std::min(len, static_cast<size_t>(UINT32_MAX)));
+
+    return _perform(op, fd, buf, op.len);
+
+}
+
+ssize_t ProxyUring::write(int fd, const void *buf, size_t len) {
+
+    struct io_uring_sqe op;
+    memset(&op, 0, sizeof(op));
+    op.opcode = IORING_OP_WRITE;
+    op.addr = reinterpret_cast<uint64_t>(buf);
+    op.len = static_cast<uint32_t>(std::min(len, static_cast<size_t>(UINT32_MAX)));
+
+    return _perform(op, fd, buf, op.len);
+
+}
+
+int ProxyUring::accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+
+    struct io_uring_sqe op;
+    memset(&op, 0, sizeof(op));
+    op.opcode = IORING_OP_ACCEPT;
+    op.addr = reinterpret_cast<uint64_t>(addr);
+    op.addr2 = reinterpret_cast<uint64_t>(addrlen);
+    op.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+
+    return static_cast<int>(_perform(op, fd, nullptr, 0));
+
+}
+
+void ProxyUring::forget(int fd) {
+
+    if(fd < 0) {
+        return;
+    }
+
+    auto it = _inflight.find(fd);
+    if(it != _inflight.end()) {
+
+        std::vector<ProxyUringWaiter *> ws = it->second;
+        for(ProxyUringWaiter *w : ws) {
+            struct io_uring_sqe *sqe = _get_sqe();
+            if(!sqe) {
+                break;
+            }
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = reinterpret_cast<uint64_t>(w);
+            sqe->user_data = 0;
+        }
+        _flush();
+
+        // the cancellations of the polled requests complete inline, the others wake up
+        // through their linked eventfd writes later
+        if(_sqpoll) {
+            _submit();
+        } else {
+            _enter(_sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE), 0,
+                IORING_ENTER_GETEVENTS);
+        }
+        _reap();
+
+        // like co_close, the parked coroutines return with the error
+        uint64_t one = 1;
+        for(ProxyUringWaiter *w : ws) {
+            if(w->done && ::write(co_socket_get_fd(w->sock), &one, sizeof(one)) < 0) {
+                LOG(WARNING) << "wake up the io_uring waiter error: " << strerror(errno);
+            }
+        }
+
+    }
+
+    if(static_cast<size_t>(fd) < _files.size() && _files[fd]) {
+        int none = -1;
+        struct io_uring_files_update up;
+        memset(&up, 0, sizeof(up));
+        up.offset = static_cast<uint32_t>(fd);
+        up.fds = reinterpret_cast<uint64_t>(&none);
+        _io_uring_register(_ring, IORING_REGISTER_FILES_UPDATE, &up, 1);
+        _files[fd] = false;
+    }
+
+}
+
+}
+}
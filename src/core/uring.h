@@ -0,0 +1,154 @@
+#ifndef PROXY_CORE_URING_H_H_H
+#define PROXY_CORE_URING_H_H_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+extern "C" {
+#include "coroutine/coroutine.h"
+}
+
+namespace proxy {
+namespace core {
+
+/*
+ * a request in flight: the coroutine parks on the eventfd, which is written by the
+ * request linked after the io, so the wakeup comes through the coroutine framework
+ *
+ *   +-----------------------+  hardlink  +----------------------------+
+ *   | read/write/accept(fd) | ---------> | write(eventfd, 1) no cqe   |
+ *   +-----------------------+            +----------------------------+
+ */
+class ProxyUringWaiter {
+
+public:
+    co_socket_t *sock;
+    int fd;
+    int32_t res;
+    bool done;
+    uint64_t one;
+
+};
+
+/*
+ * the io_uring of the worker, only used by the coroutines of the main thread
+ */
+class ProxyUring {
+
+public:
+    ProxyUring(const ProxyUring &) = delete;
+    ~ProxyUring();
+
+    static bool setup(size_t, bool);
+    static void destroy();
+
+    static ProxyUring *instance() {
+        return _instance;
+    }
+
+    // the same as the co_* functions: -1 with the errno on error, and EAGAIN means the
+    // request can not be served by the ring, the caller falls back to the framework
+    ssize_t read(int, void *, size_t);
+    ssize_t write(int, const void *, size_t);
+    int accept(int, struct sockaddr *, socklen_t *);
+
+    // must be called before the descriptor is closed: the requests in flight are
+    // cancelled and the fixed file is released
+    void forget(int);
+
+    uint64_t ops() const {
+        return _ops;
+    }
+
+    uint64_t enters() const {
+        return _enters;
+    }
+
+    uint64_t fixed_file_ops() const {
+        return _fixed_file_ops;
+    }
+
+    uint64_t fixed_buffer_ops() const {
+        return _fixed_buffer_ops;
+    }
+
+    size_t fixed_buffers() const;
+
+    static const size_t FIXED_FILES_MAX;
+    static const size_t FIXED_BUFFERS_MAX;
+    static const uint32_t SQPOLL_IDLE;
+
+private:
+    ProxyUring(size_t, bool);
+
+    ssize_t _perform(struct io_uring_sqe &, int, const void *, size_t);
+    struct io_uring_sqe *_get_sqe();
+    void _flush();
+    int _enter(unsigned, unsigned, unsigned);
+    void _submit();
+    void _reap();
+    bool _fixed_file(int);
+    int _fixed_buffer(const void *, size_t);
+    ProxyUringWaiter *_acquire();
+    void _release(ProxyUringWaiter *);
+
+    static void _on_map(void *, size_t);
+
+    int _ring;
+    bool _sqpoll;
+    bool _skip_cqe;
+
+    void *_sq_ptr;
+    size_t _sq_size;
+    void *_cq_ptr;
+    size_t _cq_size;
+    struct io_uring_sqe *_sqes;
+    size_t _sqes_size;
+
+    unsigned *_sq_head;
+    unsigned *_sq_tail;
+    unsigned *_sq_flags;
+    unsigned *_sq_array;
+    unsigned _sq_mask;
+    unsigned _sq_entries;
+    unsigned _sq_local_tail;
+
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned _cq_mask;
+    struct io_uring_cqe *_cqes;
+
+    // indexed by the descriptor
+    std::vector<bool> _files;
+
+    // the start address of the registered region -> (end, index)
+    mutable std::mutex _buffers_mutex;
+    std::map<uintptr_t, std::pair<uintptr_t, int>> _buffers;
+    size_t _buffers_registered;
+    bool _buffers_enabled;
+
+    std::vector<std::unique_ptr<ProxyUringWaiter>> _waiters;
+    std::vector<ProxyUringWaiter *> _idle;
+    std::unordered_map<int, std::vector<ProxyUringWaiter *>> _inflight;
+
+    uint64_t _ops;
+    uint64_t _enters;
+    uint64_t _fixed_file_ops;
+    uint64_t _fixed_buffer_ops;
+
+    static ProxyUring *_instance;
+
+};
+
+}
+}
+
+#endif
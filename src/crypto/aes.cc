@@ -1,7 +1,10 @@
 #include "crypto/aes.h"
 
+#include "string.h"
 #include "time.h"
 
+#include "openssl/rand.h"
+
 #include "glog/logging.h"
 
 using proxy::core::ProxyBuffer;
@@ -11,56 +14,238 @@ namespace crypto {
 
 const size_t ProxyCryptoAes::AES_KEY_SIZE = 32;
 const size_t ProxyCryptoAes::AES_IV_SIZE = 16;
+const size_t ProxyCryptoAes::BENCHMARK_SMALL = 16384;
+const size_t ProxyCryptoAes::BENCHMARK_LARGE = 131072;
+const long long ProxyCryptoAes::BENCHMARK_TIME = 20000;
+
+static long long _now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// MB/s of encrypting the block in place over and over, 0 on error
+static double _throughput(ProxyCryptoAesContext &ctx, std::vector<unsigned char> &data,
+    size_t size) {
+
+    long long begin = _now_us();
+    long long elapsed = 0;
+    size_t bytes = 0;
+
+    do {
+        int n;
+        if(!EVP_EncryptUpdate(ctx.get(), data.data(), &n, data.data(), static_cast<int>(size))) {
+            return 0;
+        }
+        bytes += size;
+        elapsed = _now_us() - begin;
+    } while(elapsed < ProxyCryptoAes::BENCHMARK_TIME);
+
+    return static_cast<double>(bytes) / static_cast<double>(elapsed);
+
+}
 
 std::shared_ptr<ProxyCryptoAesKeyAndIv> ProxyCryptoAes::generate_key_and_iv() {
 
-    std::string key;
-    std::string iv;
+    // the counter suites repeat the whole keystream with a repeated key and iv, so both come
+    // from the csprng of openssl, which every forked worker reseeds on its own
+    std::string key(ProxyCryptoAes::AES_KEY_SIZE, '\0');
+    std::string iv(ProxyCryptoAes::AES_IV_SIZE, '\0');
 
-    for(size_t i = 0; i < ProxyCryptoAes::AES_KEY_SIZE; ++i) {
-        key.push_back(static_cast<char>(random() % 26 + 'a'));
+    if(RAND_bytes(reinterpret_cast<unsigned char *>(&key[0]), static_cast<int>(key.size())) != 1 ||
+        RAND_bytes(reinterpret_cast<unsigned char *>(&iv[0]), static_cast<int>(iv.size())) != 1) {
+        LOG(ERROR) << "generate the aes key and iv error";
+        return nullptr;
     }
 
-    for(size_t i = 0; i < ProxyCryptoAes::AES_IV_SIZE; ++i) {
-        iv.push_back(static_cast<char>(random() % 26 + 'a'));
+    return std::make_shared<ProxyCryptoAesKeyAndIv>(std::move(key), std::move(iv));
+
+}
+
+std::vector<ProxyCryptoCipherSpeed> ProxyCryptoAes::benchmark() {
+
+    std::vector<ProxyCryptoCipherSpeed> speeds;
+    std::vector<unsigned char> data(ProxyCryptoAes::BENCHMARK_LARGE, 0x5a);
+
+    std::shared_ptr<ProxyCryptoAesKeyAndIv> key_iv = generate_key_and_iv();
+    if(!key_iv) {
+        return speeds;
     }
 
-    return std::make_shared<ProxyCryptoAesKeyAndIv>(std::move(key), std::move(iv));
+    for(uint8_t id = 0; ; ++id) {
+
+        ProxyCryptoCipherSuite suite;
+        if(!ProxyCryptoCipher::from_id(id, suite)) {
+            break;
+        }
+
+        ProxyCryptoAesContext ctx;
+        if(!ctx.setup(ProxyCryptoAesContextType::AES_CONTEXT_ENCRYPT_TYPE, suite,
+            key_iv->key(), key_iv->iv())) {
+            return std::vector<ProxyCryptoCipherSpeed>();
+        }
+
+        double small = _throughput(ctx, data, ProxyCryptoAes::BENCHMARK_SMALL);
+        double large = _throughput(ctx, data, ProxyCryptoAes::BENCHMARK_LARGE);
+        if(small <= 0 || large <= 0) {
+            return std::vector<ProxyCryptoCipherSpeed>();
+        }
+
+        speeds.emplace_back(suite, small, large);
+
+    }
+
+    return speeds;
 
 }
 
-bool ProxyCryptoAesContext::setup(ProxyCryptoAesContextType ty,
+bool ProxyCryptoAesContext::setup(ProxyCryptoAesContextType ty, ProxyCryptoCipherSuite suite,
     const std::string &key, const std::string &iv) {
 
     _type = ty;
+    _suite = suite;
+    _offset = 0;
+
+    // the suite only takes the first bytes of the key, which are all the handoff needs
+    size_t key_size = ProxyCryptoCipher::key_size(suite);
+    if(key.size() < key_size || key_size > sizeof(_key) || iv.size() < sizeof(_iv)) {
+        LOG(ERROR) << "the key or the iv is too short for " << ProxyCryptoCipher::name(suite);
+        return false;
+    }
+    memcpy(_key, key.data(), key_size);
+    memcpy(_iv, iv.data(), sizeof(_iv));
 
+    if(_ctx) {
+        EVP_CIPHER_CTX_free(_ctx);
+    }
     _ctx = EVP_CIPHER_CTX_new();
     if(!_ctx) {
         LOG(ERROR) << "create a encrypt cipher context error";
         return false;
     }
 
-    if(ty == ProxyCryptoAesContextType::AES_CONTEXT_ENCRYPT_TYPE) {
-        if(!EVP_EncryptInit_ex(_ctx, EVP_aes_128_cfb(), NULL,
-            reinterpret_cast<const unsigned char *>(key.c_str()),
-            reinterpret_cast<const unsigned char *>(iv.c_str()))) {
-            LOG(ERROR) << "setup the encrypt cipher context with aes-128-cfb error";
+    if(!EVP_CipherInit_ex(_ctx, ProxyCryptoCipher::evp(suite), NULL,
+        reinterpret_cast<const unsigned char *>(key.c_str()),
+        reinterpret_cast<const unsigned char *>(iv.c_str()),
+        ty == ProxyCryptoAesContextType::AES_CONTEXT_ENCRYPT_TYPE ? 1 : 0)) {
+        LOG(ERROR) << "setup the " << (ty == ProxyCryptoAesContextType::AES_CONTEXT_ENCRYPT_TYPE ?
+            "encrypt" : "decrypt") << " cipher context with " << ProxyCryptoCipher::name(suite)
+            << " error";
+        EVP_CIPHER_CTX_free(_ctx);
+        _ctx = nullptr;
+        return false;
+    }
+
+    return true;
+
+}
+
+bool ProxyCryptoAesContext::snapshot(std::string &key, std::string &iv, int &num) const {
+
+    if(!_ctx) {
+        return false;
+    }
+
+    key.assign(reinterpret_cast<const char *>(_key), ProxyCryptoCipher::key_size(_suite));
+
+    size_t block = ProxyCryptoCipher::counter_block(_suite);
+    if(block) {
+
+        // the counter of the block under way, and the bytes already taken from it
+        unsigned char buf[sizeof(_iv)];
+        memcpy(buf, _iv, sizeof(buf));
+        uint64_t steps = _offset / block;
+
+        if(_suite == ProxyCryptoCipherSuite::CHACHA20) {
+            // a 32 bits little endian block counter ahead of the nonce, and openssl carries
+            // its wrap into the next word, so the two are added as one 64 bits counter
+            uint64_t counter = 0;
+            for(size_t i = 0; i < 8; ++i) {
+                counter |= static_cast<uint64_t>(buf[i]) << (8 * i);
+            }
+            counter += steps;
+            for(size_t i = 0; i < 8; ++i) {
+                buf[i] = static_cast<unsigned char>(counter >> (8 * i));
+            }
+        } else {
+            // the whole block is a big endian counter
+            for(size_t i = sizeof(buf); i > 0 && steps; --i) {
+                uint64_t sum = static_cast<uint64_t>(buf[i - 1]) + (steps & 0xff);
+                buf[i - 1] = static_cast<unsigned char>(sum);
+                steps = (steps >> 8) + (sum >> 8);
+            }
+        }
+
+        iv.assign(reinterpret_cast<const char *>(buf), sizeof(buf));
+        num = static_cast<int>(_offset % block);
+
+        return true;
+
+    }
+
+    unsigned char buf[EVP_MAX_IV_LENGTH];
+    size_t len = static_cast<size_t>(EVP_CIPHER_CTX_iv_length(_ctx));
+    if(len > sizeof(buf)) {
+        return false;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if(!EVP_CIPHER_CTX_get_updated_iv(_ctx, buf, len)) {
+        LOG(ERROR) << "get the running iv of the aes-128-cfb context error";
+        return false;
+    }
+#else
+    memcpy(buf, EVP_CIPHER_CTX_iv(_ctx), len);
+#endif
+
+    iv.assign(reinterpret_cast<const char *>(buf), len);
+    num = EVP_CIPHER_CTX_num(_ctx);
+
+    return true;
+
+}
+
+bool ProxyCryptoAesContext::restore(ProxyCryptoAesContextType ty, ProxyCryptoCipherSuite suite,
+    const std::string &key, const std::string &iv, int num) {
+
+    if(!setup(ty, suite, key, iv)) {
+        return false;
+    }
+
+    size_t block = ProxyCryptoCipher::counter_block(suite);
+    if(block) {
+
+        // run the counter over the bytes of the block which the other process used
+        if(num < 0 || static_cast<size_t>(num) >= block) {
+            LOG(ERROR) << "restore the offset of the " << ProxyCryptoCipher::name(suite)
+                << " context error: " << num;
             return false;
         }
-    } else {
-        if(!EVP_DecryptInit_ex(_ctx, EVP_aes_128_cfb(), NULL,
-            reinterpret_cast<const unsigned char *>(key.c_str()),
-            reinterpret_cast<const unsigned char *>(iv.c_str()))) {
-            LOG(ERROR) << "setup the decrypt cipher context with aes-128-cfb error";
+
+        unsigned char in[64] = {0};
+        unsigned char out[64];
+        int n;
+        if(num && !EVP_CipherUpdate(_ctx, out, &n, in, num)) {
+            LOG(ERROR) << "restore the offset of the " << ProxyCryptoCipher::name(suite)
+                << " context error";
             return false;
         }
+        _offset = static_cast<uint64_t>(num);
+
+        return true;
+
+    }
+
+    if(!EVP_CIPHER_CTX_set_num(_ctx, num)) {
+        LOG(ERROR) << "restore the offset of the aes-128-cfb context error";
+        return false;
     }
 
     return true;
 
 }
 
-bool ProxyCryptoAes::aes_cfb_encrypt(std::shared_ptr<ProxyCryptoAesContext> &ctx,
+bool ProxyCryptoAes::encrypt(ProxyCryptoAesContext &ctx,
     std::shared_ptr<ProxyBuffer> &from, std::shared_ptr<ProxyBuffer> &to) {
 
     if((from->cur - from->start) > (to->size - to->cur)) {
@@ -69,25 +254,26 @@ bool ProxyCryptoAes::aes_cfb_encrypt(std::shared_ptr<ProxyCryptoAesContext> &ctx
     }
 
     int encrypt_size;
-    if(!EVP_EncryptUpdate(ctx->get(), reinterpret_cast<unsigned char *>(to->buffer + to->cur),
+    if(!EVP_EncryptUpdate(ctx.get(), reinterpret_cast<unsigned char *>(to->buffer + to->cur),
         &encrypt_size, reinterpret_cast<const unsigned char *>(from->buffer + from->start),
         static_cast<int>(from->cur - from->start))) {
-        LOG(ERROR) << "aes-128-cfb encrypts error";
+        LOG(ERROR) << ProxyCryptoCipher::name(ctx._suite) << " encrypts error";
         return false;
     }
 
     if(static_cast<size_t>(encrypt_size) != from->cur - from->start) {
-        LOG(ERROR) << "aes-128-cfb encrypts data size error";
+        LOG(ERROR) << ProxyCryptoCipher::name(ctx._suite) << " encrypts data size error";
         return false;
     }
 
     to->cur += static_cast<size_t>(encrypt_size);
+    ctx._offset += static_cast<uint64_t>(encrypt_size);
 
     return true;
 
 }
 
-bool ProxyCryptoAes::aes_cfb_decrypt(std::shared_ptr<ProxyCryptoAesContext> &ctx,
+bool ProxyCryptoAes::decrypt(ProxyCryptoAesContext &ctx,
     std::shared_ptr<ProxyBuffer> &from, std::shared_ptr<ProxyBuffer> &to) {
 
     if((from->cur - from->start) > (to->size - to->cur)) {
@@ -96,19 +282,62 @@ bool ProxyCryptoAes::aes_cfb_decrypt(std::shared_ptr<ProxyCryptoAesContext> &ctx
     }
 
     int decrypt_size;
-    if(!EVP_DecryptUpdate(ctx->get(), reinterpret_cast<unsigned char *>(to->buffer + to->cur),
+    if(!EVP_DecryptUpdate(ctx.get(), reinterpret_cast<unsigned char *>(to->buffer + to->cur),
         &decrypt_size, reinterpret_cast<const unsigned char *>(from->buffer + from->start),
         static_cast<int>(from->cur - from->start))) {
-        LOG(ERROR) << "aes-128-cfb decrypts error";
+        LOG(ERROR) << ProxyCryptoCipher::name(ctx._suite) << " decrypts error";
         return false;
     }
 
     if(static_cast<size_t>(decrypt_size) != from->cur - from->start) {
-        LOG(ERROR) << "aes-128-cfb decrypts data size error";
+        LOG(ERROR) << ProxyCryptoCipher::name(ctx._suite) << " decrypts data size error";
         return false;
     }
 
     to->cur += static_cast<size_t>(decrypt_size);
+    ctx._offset += static_cast<uint64_t>(decrypt_size);
+
+    return true;
+
+}
+
+bool ProxyCryptoAes::encrypt(ProxyCryptoAesContext &ctx, std::shared_ptr<ProxyBuffer> &buf) {
+
+    unsigned char *data = reinterpret_cast<unsigned char *>(buf->buffer + buf->start);
+    int encrypt_size;
+    if(!EVP_EncryptUpdate(ctx.get(), data, &encrypt_size, data,
+        static_cast<int>(buf->cur - buf->start))) {
+        LOG(ERROR) << ProxyCryptoCipher::name(ctx._suite) << " encrypts in place error";
+        return false;
+    }
+
+    if(static_cast<size_t>(encrypt_size) != buf->cur - buf->start) {
+        LOG(ERROR) << ProxyCryptoCipher::name(ctx._suite) << " encrypts in place data size error";
+        return false;
+    }
+
+    ctx._offset += static_cast<uint64_t>(encrypt_size);
+
+    return true;
+
+}
+
+bool ProxyCryptoAes::decrypt(ProxyCryptoAesContext &ctx, std::shared_ptr<ProxyBuffer> &buf) {
+
+    unsigned char *data = reinterpret_cast<unsigned char *>(buf->buffer + buf->start);
+    int decrypt_size;
+    if(!EVP_DecryptUpdate(ctx.get(), data, &decrypt_size, data,
+        static_cast<int>(buf->cur - buf->start))) {
+        LOG(ERROR) << ProxyCryptoCipher::name(ctx._suite) << " decrypts in place error";
+        return false;
+    }
+
+    if(static_cast<size_t>(decrypt_size) != buf->cur - buf->start) {
+        LOG(ERROR) << ProxyCryptoCipher::name(ctx._suite) << " decrypts in place data size error";
+        return false;
+    }
+
+    ctx._offset += static_cast<uint64_t>(decrypt_size);
 
     return true;
 
@@ -4,10 +4,12 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "openssl/evp.h"
 
 #include "core/buffer.h"
+#include "crypto/cipher.h"
 
 namespace proxy {
 namespace crypto {
@@ -40,41 +42,95 @@ enum class ProxyCryptoAesContextType {
     AES_CONTEXT_DECRYPT_TYPE
 };
 
+// held by value in the tunnel, so it is neither copied nor moved, the suite is any of the
+// negotiated stream ciphers despite the name
 class ProxyCryptoAesContext {
 
 public:
-    ProxyCryptoAesContext() : _ctx(nullptr) {}
+    ProxyCryptoAesContext() : _ctx(nullptr), _suite(ProxyCryptoCipherSuite::AES_128_CFB),
+        _offset(0) {}
+    ProxyCryptoAesContext(const ProxyCryptoAesContext &) = delete;
+    ProxyCryptoAesContext &operator=(const ProxyCryptoAesContext &) = delete;
     ~ProxyCryptoAesContext() {
         if(_ctx) {
             EVP_CIPHER_CTX_free(_ctx);          
         }
     }
-    bool setup(ProxyCryptoAesContextType, const std::string &, const std::string &);
+    bool setup(ProxyCryptoAesContextType, ProxyCryptoCipherSuite, const std::string &,
+        const std::string &);
+    // the key and the running state, which is enough to continue the stream in another
+    // process: the feedback register and its offset for cfb, the counter block of the
+    // current position and the bytes used of it for the counter suites
+    bool snapshot(std::string &, std::string &, int &) const;
+    bool restore(ProxyCryptoAesContextType, ProxyCryptoCipherSuite, const std::string &,
+        const std::string &, int);
     EVP_CIPHER_CTX *get() const {
         return _ctx;
     }
 
+    bool ready() const {
+        return _ctx != nullptr;
+    }
+
+    ProxyCryptoCipherSuite suite() const {
+        return _suite;
+    }
+
 private:
+    friend class ProxyCryptoAes;
+
     EVP_CIPHER_CTX *_ctx;
     ProxyCryptoAesContextType _type;
+    ProxyCryptoCipherSuite _suite;
+    unsigned char _key[32];
+    // the counter suites restart from the iv of the setup and the bytes since then
+    unsigned char _iv[16];
+    uint64_t _offset;
 
 };
 
 
+// the encryption throughput of a suite on this host in MB/s
+class ProxyCryptoCipherSpeed {
+
+public:
+    ProxyCryptoCipherSpeed(ProxyCryptoCipherSuite s, double sm, double lg) : suite(s),
+        small(sm), large(lg) {}
+
+    ProxyCryptoCipherSuite suite;
+    double small;
+    double large;
+
+};
+
 class ProxyCryptoAes {
 
 public:
 
     static std::shared_ptr<ProxyCryptoAesKeyAndIv> generate_key_and_iv();
 
-    static bool aes_cfb_encrypt(std::shared_ptr<ProxyCryptoAesContext> &,
+    static bool encrypt(ProxyCryptoAesContext &,
         std::shared_ptr<proxy::core::ProxyBuffer> &, std::shared_ptr<proxy::core::ProxyBuffer> &);
 
-    static bool aes_cfb_decrypt(std::shared_ptr<ProxyCryptoAesContext> &,
+    static bool decrypt(ProxyCryptoAesContext &,
         std::shared_ptr<proxy::core::ProxyBuffer> &, std::shared_ptr<proxy::core::ProxyBuffer> &);
 
+    // transform the data between start and cur in place, the stream ciphers keep the length
+    static bool encrypt(ProxyCryptoAesContext &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &);
+
+    static bool decrypt(ProxyCryptoAesContext &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &);
+
+    // every suite encrypts the blocks of BENCHMARK_SMALL and BENCHMARK_LARGE bytes for
+    // BENCHMARK_TIME microseconds each, an empty result when a context fails
+    static std::vector<ProxyCryptoCipherSpeed> benchmark();
+
     static const size_t AES_KEY_SIZE;
     static const size_t AES_IV_SIZE;
+    static const size_t BENCHMARK_SMALL;
+    static const size_t BENCHMARK_LARGE;
+    static const long long BENCHMARK_TIME;
 
 };
 
@@ -0,0 +1,150 @@
+#include "crypto/cipher.h"
+
+#include <sstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace proxy {
+namespace crypto {
+
+const char *ProxyCryptoCipher::name(ProxyCryptoCipherSuite suite) {
+    switch(suite) {
+        case ProxyCryptoCipherSuite::AES_128_CFB:
+            return "aes-128-cfb";
+        case ProxyCryptoCipherSuite::AES_128_CTR:
+            return "aes-128-ctr";
+        case ProxyCryptoCipherSuite::AES_256_CTR:
+            return "aes-256-ctr";
+        case ProxyCryptoCipherSuite::CHACHA20:
+            return "chacha20";
+    }
+    return "unknown";
+}
+
+bool ProxyCryptoCipher::from_name(const std::string &s, ProxyCryptoCipherSuite &suite) {
+    for(uint8_t id = 0; from_id(id, suite); ++id) {
+        if(s == name(suite)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ProxyCryptoCipher::from_id(uint8_t id, ProxyCryptoCipherSuite &suite) {
+    if(id > static_cast<uint8_t>(ProxyCryptoCipherSuite::CHACHA20)) {
+        return false;
+    }
+    suite = static_cast<ProxyCryptoCipherSuite>(id);
+    return true;
+}
+
+bool ProxyCryptoCipher::parse_list(const std::string &s,
+    std::vector<ProxyCryptoCipherSuite> &suites) {
+
+    suites.clear();
+
+    std::istringstream iss(s);
+    std::string item;
+    while(std::getline(iss, item, ',')) {
+        size_t b = item.find_first_not_of(" \t");
+        size_t e = item.find_last_not_of(" \t");
+        if(b == std::string::npos) {
+            continue;
+        }
+        ProxyCryptoCipherSuite suite;
+        if(!from_name(item.substr(b, e - b + 1), suite)) {
+            return false;
+        }
+        bool dup = false;
+        for(ProxyCryptoCipherSuite c : suites) {
+            dup = dup || c == suite;
+        }
+        if(!dup) {
+            suites.push_back(suite);
+        }
+    }
+
+    return !suites.empty();
+
+}
+
+std::string ProxyCryptoCipher::list_string(const std::vector<ProxyCryptoCipherSuite> &suites) {
+    std::string s;
+    for(ProxyCryptoCipherSuite suite : suites) {
+        if(!s.empty()) {
+            s += ",";
+        }
+        s += name(suite);
+    }
+    return s;
+}
+
+const EVP_CIPHER *ProxyCryptoCipher::evp(ProxyCryptoCipherSuite suite) {
+    switch(suite) {
+        case ProxyCryptoCipherSuite::AES_128_CFB:
+            return EVP_aes_128_cfb();
+        case ProxyCryptoCipherSuite::AES_128_CTR:
+            return EVP_aes_128_ctr();
+        case ProxyCryptoCipherSuite::AES_256_CTR:
+            return EVP_aes_256_ctr();
+        case ProxyCryptoCipherSuite::CHACHA20:
+            return EVP_chacha20();
+    }
+    return nullptr;
+}
+
+size_t ProxyCryptoCipher::key_size(ProxyCryptoCipherSuite suite) {
+    switch(suite) {
+        case ProxyCryptoCipherSuite::AES_128_CFB:
+        case ProxyCryptoCipherSuite::AES_128_CTR:
+            return 16;
+        case ProxyCryptoCipherSuite::AES_256_CTR:
+        case ProxyCryptoCipherSuite::CHACHA20:
+            return 32;
+    }
+    return 0;
+}
+
+size_t ProxyCryptoCipher::counter_block(ProxyCryptoCipherSuite suite) {
+    switch(suite) {
+        case ProxyCryptoCipherSuite::AES_128_CFB:
+            return 0;
+        case ProxyCryptoCipherSuite::AES_128_CTR:
+        case ProxyCryptoCipherSuite::AES_256_CTR:
+            return 16;
+        case ProxyCryptoCipherSuite::CHACHA20:
+            return 64;
+    }
+    return 0;
+}
+
+bool ProxyCryptoCipher::hardware_aes() {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ecx & bit_AES) != 0;
+#elif defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+    return false;
+#endif
+}
+
+std::vector<ProxyCryptoCipherSuite> ProxyCryptoCipher::defaults() {
+    if(hardware_aes()) {
+        return {ProxyCryptoCipherSuite::AES_128_CTR, ProxyCryptoCipherSuite::AES_256_CTR,
+            ProxyCryptoCipherSuite::CHACHA20, ProxyCryptoCipherSuite::AES_128_CFB};
+    }
+    return {ProxyCryptoCipherSuite::CHACHA20, ProxyCryptoCipherSuite::AES_128_CTR,
+        ProxyCryptoCipherSuite::AES_256_CTR, ProxyCryptoCipherSuite::AES_128_CFB};
+}
+
+}
+}
@@ -0,0 +1,55 @@
+#ifndef PROXY_CRYPTO_CIPHER_H_H_H
+#define PROXY_CRYPTO_CIPHER_H_H_H
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "openssl/evp.h"
+
+namespace proxy {
+namespace crypto {
+
+// the ids are sent in the negotiation, so they never change
+enum class ProxyCryptoCipherSuite : uint8_t {
+    AES_128_CFB = 0x00,
+    AES_128_CTR = 0x01,
+    AES_256_CTR = 0x02,
+    CHACHA20 = 0x03
+};
+
+/*
+ * the stream ciphers of the relay, all of them keep the length of the data and run in
+ * place, the peers which know nothing of the negotiation talk aes-128-cfb
+ */
+class ProxyCryptoCipher {
+
+public:
+    static const char *name(ProxyCryptoCipherSuite);
+    static bool from_name(const std::string &, ProxyCryptoCipherSuite &);
+    static bool from_id(uint8_t, ProxyCryptoCipherSuite &);
+
+    // a comma separated list of the names, in the order of preference
+    static bool parse_list(const std::string &, std::vector<ProxyCryptoCipherSuite> &);
+    static std::string list_string(const std::vector<ProxyCryptoCipherSuite> &);
+
+    static const EVP_CIPHER *evp(ProxyCryptoCipherSuite);
+    static size_t key_size(ProxyCryptoCipherSuite);
+
+    // the bytes of keystream per counter step, 0 for the feedback mode
+    static size_t counter_block(ProxyCryptoCipherSuite);
+
+    // the cpu has the aes instructions
+    static bool hardware_aes();
+
+    // aes-ctr first with the aes instructions and chacha20 first without them
+    static std::vector<ProxyCryptoCipherSuite> defaults();
+
+};
+
+}
+}
+
+#endif
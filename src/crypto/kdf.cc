@@ -0,0 +1,46 @@
+#include "crypto/kdf.h"
+
+#include <memory>
+
+#include "openssl/evp.h"
+#include "openssl/kdf.h"
+
+#include "glog/logging.h"
+
+namespace proxy {
+namespace crypto {
+
+bool ProxyCryptoKdf::hkdf(const std::string &secret, const std::string &salt,
+    const std::string &info, size_t len, std::string &out) {
+
+    std::shared_ptr<EVP_PKEY_CTX> ctx(EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL),
+        [](EVP_PKEY_CTX *c){EVP_PKEY_CTX_free(c);});
+    if(!ctx || EVP_PKEY_derive_init(ctx.get()) <= 0 ||
+        EVP_PKEY_CTX_set_hkdf_md(ctx.get(), EVP_sha256()) <= 0 ||
+        EVP_PKEY_CTX_set1_hkdf_salt(ctx.get(),
+            reinterpret_cast<const unsigned char *>(salt.data()),
+            static_cast<int>(salt.size())) <= 0 ||
+        EVP_PKEY_CTX_set1_hkdf_key(ctx.get(),
+            reinterpret_cast<const unsigned char *>(secret.data()),
+            static_cast<int>(secret.size())) <= 0 ||
+        EVP_PKEY_CTX_add1_hkdf_info(ctx.get(),
+            reinterpret_cast<const unsigned char *>(info.data()),
+            static_cast<int>(info.size())) <= 0) {
+        LOG(ERROR) << "create the hkdf context error";
+        return false;
+    }
+
+    out.assign(len, '\0');
+    size_t outlen = len;
+    if(EVP_PKEY_derive(ctx.get(), reinterpret_cast<unsigned char *>(&out[0]), &outlen) <= 0 ||
+        outlen != len) {
+        LOG(ERROR) << "expand the key material with hkdf error";
+        return false;
+    }
+
+    return true;
+
+}
+
+}
+}
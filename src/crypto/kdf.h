@@ -0,0 +1,23 @@
+#ifndef PROXY_CRYPTO_KDF_H_H_H
+#define PROXY_CRYPTO_KDF_H_H_H
+
+#include <string>
+
+#include <stddef.h>
+
+namespace proxy {
+namespace crypto {
+
+class ProxyCryptoKdf {
+
+public:
+    // hkdf-sha256 of the secret, the salt and the info, the output has the given length
+    static bool hkdf(const std::string &, const std::string &, const std::string &, size_t,
+        std::string &);
+
+};
+
+}
+}
+
+#endif
@@ -1,3 +1,5 @@
+#include <exception>
+
 #include "string.h"
 #include "crypto/rsa.h"
 
@@ -9,6 +11,114 @@ namespace proxy {
 namespace crypto {
 
 const int ProxyCryptoRsa::RSA_KEY_SIZE = 1024;
+const size_t ProxyCryptoRsa::FINGERPRINT_SIZE = 8;
+
+ProxyCryptoRsaKeypair::ProxyCryptoRsaKeypair(const std::string &pub, const std::string &pri) :
+    _pub(pub), _pri(pri), _fingerprint(ProxyCryptoRsa::fingerprint(pub)) {}
+
+ProxyCryptoRsaPublicKey::ProxyCryptoRsaPublicKey(const std::string &pem,
+    const std::shared_ptr<EVP_PKEY> &pkey) : _pem(pem),
+    _fingerprint(ProxyCryptoRsa::fingerprint(pem)), _pkey(pkey) {}
+
+std::shared_ptr<ProxyCryptoRsaPublicKey> ProxyCryptoRsaPublicKey::parse(const std::string &pem) {
+
+    EVP_PKEY *tmp = NULL;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    // the pem holds the pkcs#1 structure written by PEM_write_bio_RSAPublicKey
+    std::shared_ptr<OSSL_DECODER_CTX> dctx(OSSL_DECODER_CTX_new_for_pkey(&tmp, "PEM",
+        "type-specific", "RSA", EVP_PKEY_PUBLIC_KEY, NULL, NULL),
+        [](OSSL_DECODER_CTX *c) {OSSL_DECODER_CTX_free(c);});
+    if(!dctx) {
+        LOG(ERROR) << "create the decoder of the rsa public key error";
+        return nullptr;
+    }
+
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(pem.data());
+    size_t len = pem.size();
+    if(!OSSL_DECODER_from_data(dctx.get(), &data, &len) || !tmp) {
+        LOG(ERROR) << "read the public key in pem format to the key structure error";
+        return nullptr;
+    }
+#else
+    std::shared_ptr<BIO> bio(BIO_new_mem_buf(reinterpret_cast<const void *>(pem.data()),
+        static_cast<int>(pem.size())), [](BIO *b) {BIO_free_all(b);});
+    if(!bio) {
+        LOG(ERROR) << "create the memory bio using the public key buffer error";
+        return nullptr;
+    }
+
+    RSA *rsa = NULL;
+    if(!PEM_read_bio_RSAPublicKey(bio.get(), &rsa, NULL, NULL)) {
+        LOG(ERROR) << "read the public key in pem format from bio to rsa structure error";
+        return nullptr;
+    }
+
+    if(!(tmp = EVP_PKEY_new()) || !EVP_PKEY_assign_RSA(tmp, rsa)) {
+        LOG(ERROR) << "wrap the rsa public key error";
+        EVP_PKEY_free(tmp);
+        RSA_free(rsa);
+        return nullptr;
+    }
+#endif
+
+    std::shared_ptr<EVP_PKEY> pkey(tmp, [](EVP_PKEY *k) {EVP_PKEY_free(k);});
+
+    try {
+        return std::make_shared<ProxyCryptoRsaPublicKey>(pem, pkey);
+    } catch(const std::exception &ex) {
+        LOG(ERROR) << "create the rsa public key error: " << ex.what();
+        return nullptr;
+    }
+
+}
+
+bool ProxyCryptoRsaPublicKey::encrypt(std::shared_ptr<ProxyBuffer> &from,
+    std::shared_ptr<ProxyBuffer> &to) const {
+
+    std::shared_ptr<EVP_PKEY_CTX> ctx(EVP_PKEY_CTX_new(_pkey.get(), NULL),
+        [](EVP_PKEY_CTX *c) {EVP_PKEY_CTX_free(c);});
+    if(!ctx || EVP_PKEY_encrypt_init(ctx.get()) <= 0 ||
+        EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_PKCS1_PADDING) <= 0) {
+        LOG(ERROR) << "create the context of the rsa encryption error";
+        return false;
+    }
+
+    size_t rsa_size = static_cast<size_t>(EVP_PKEY_size(_pkey.get()));
+    if(rsa_size >= to->size - to->cur) {
+        LOG(ERROR) << "the buffer size of the encrypted data is too small";
+        return false;
+    }
+    memset(to->buffer + to->cur, 0, rsa_size);
+
+    size_t encrypted_result_length = rsa_size;
+    if(EVP_PKEY_encrypt(ctx.get(), reinterpret_cast<unsigned char *>(to->buffer + to->cur),
+        &encrypted_result_length,
+        reinterpret_cast<const unsigned char *>(from->buffer + from->start),
+        from->cur - from->start) <= 0) {
+        LOG(ERROR) << "the encrypt operation error";
+        return false;
+    }
+
+    to->cur += encrypted_result_length;
+
+    return true;
+
+}
+
+std::string ProxyCryptoRsa::fingerprint(const std::string &pem) {
+
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    if(!EVP_Digest(pem.data(), pem.size(), md, &len, EVP_sha256(), NULL) ||
+        len < ProxyCryptoRsa::FINGERPRINT_SIZE) {
+        LOG(ERROR) << "digest the rsa public key error";
+        return std::string();
+    }
+
+    return std::string(reinterpret_cast<const char *>(md), ProxyCryptoRsa::FINGERPRINT_SIZE);
+
+}
 
 std::shared_ptr<ProxyCryptoRsaKeypair> ProxyCryptoRsa::generate_key_pair() {
 
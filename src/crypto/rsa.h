@@ -6,9 +6,13 @@
 
 #include <stdlib.h>
 
+#include "openssl/evp.h"
 #include "openssl/rsa.h"
 #include "openssl/bio.h"
 #include "openssl/pem.h"
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include "openssl/decoder.h"
+#endif
 
 #include "core/buffer.h"
 
@@ -18,7 +22,7 @@ namespace crypto {
 
 class ProxyCryptoRsaKeypair {
 public:
-    ProxyCryptoRsaKeypair(const std::string &pub, const std::string &pri) : _pub(pub), _pri(pri) {}
+    ProxyCryptoRsaKeypair(const std::string &pub, const std::string &pri);
     const std::string &pub() const {
         return _pub;
     }
@@ -31,9 +35,36 @@ public:
     void pri(const std::string &p) {
         _pri = p;
     }
+    const std::string &fingerprint() const {
+        return _fingerprint;
+    }
 private:
     std::string _pub;
     std::string _pri;
+    std::string _fingerprint;
+};
+
+// a public key of the peer parsed once, which the encryption server keeps per remote
+class ProxyCryptoRsaPublicKey {
+public:
+    // nullptr when the pem is broken
+    static std::shared_ptr<ProxyCryptoRsaPublicKey> parse(const std::string &);
+
+    ProxyCryptoRsaPublicKey(const std::string &pem, const std::shared_ptr<EVP_PKEY> &pkey);
+
+    bool encrypt(std::shared_ptr<proxy::core::ProxyBuffer> &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &) const;
+
+    const std::string &pem() const {
+        return _pem;
+    }
+    const std::string &fingerprint() const {
+        return _fingerprint;
+    }
+private:
+    std::string _pem;
+    std::string _fingerprint;
+    std::shared_ptr<EVP_PKEY> _pkey;
 };
 
 class ProxyCryptoRsa {
@@ -46,6 +77,11 @@ public:
     static bool rsa_decrypt(std::shared_ptr<proxy::core::ProxyBuffer> &,
             std::shared_ptr<proxy::core::ProxyBuffer> &, const std::string &);
 
+    // the first FINGERPRINT_SIZE bytes of the sha256 of the pem public key
+    static std::string fingerprint(const std::string &);
+
+    static const size_t FINGERPRINT_SIZE;
+
 private:
     static const int RSA_KEY_SIZE;
 
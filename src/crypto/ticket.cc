@@ -0,0 +1,142 @@
+#include "crypto/ticket.h"
+
+#include <exception>
+
+#include <arpa/inet.h>
+
+#include "openssl/evp.h"
+#include "openssl/rand.h"
+
+#include "crypto/kdf.h"
+#include "glog/logging.h"
+
+namespace proxy {
+namespace crypto {
+
+const size_t ProxyCryptoTicketKeys::SECRET_SIZE = 32;
+const size_t ProxyCryptoTicketKeys::IV_SIZE = 12;
+const size_t ProxyCryptoTicketKeys::TAG_SIZE = 16;
+
+std::shared_ptr<ProxyCryptoTicketKeys> ProxyCryptoTicketKeys::generate(time_t lifetime) {
+
+    std::string secret(ProxyCryptoTicketKeys::SECRET_SIZE, '\0');
+    if(RAND_bytes(reinterpret_cast<unsigned char *>(&secret[0]),
+        static_cast<int>(secret.size())) != 1) {
+        LOG(ERROR) << "generate the secret of the ticket keys error";
+        return nullptr;
+    }
+
+    try {
+        return std::make_shared<ProxyCryptoTicketKeys>(secret, lifetime);
+    } catch(const std::exception &ex) {
+        LOG(ERROR) << "create the ticket keys error: " << ex.what();
+        return nullptr;
+    }
+
+}
+
+bool ProxyCryptoTicketKeys::_key(uint32_t epoch, std::string &key) const {
+    return ProxyCryptoKdf::hkdf(_secret, std::string(), "proxy ticket " + std::to_string(epoch),
+        32, key);
+}
+
+bool ProxyCryptoTicketKeys::seal(const std::string &plain, time_t now,
+    std::string &ticket) const {
+
+    uint32_t epoch = static_cast<uint32_t>(now / _lifetime);
+    std::string key;
+    if(!_key(epoch, key)) {
+        return false;
+    }
+
+    uint32_t e = htonl(epoch);
+    ticket.assign(reinterpret_cast<const char *>(&e), 4);
+    ticket.append(ProxyCryptoTicketKeys::IV_SIZE, '\0');
+    if(RAND_bytes(reinterpret_cast<unsigned char *>(&ticket[4]),
+        static_cast<int>(ProxyCryptoTicketKeys::IV_SIZE)) != 1) {
+        LOG(ERROR) << "generate the iv of the ticket error";
+        return false;
+    }
+
+    std::shared_ptr<EVP_CIPHER_CTX> ctx(EVP_CIPHER_CTX_new(),
+        [](EVP_CIPHER_CTX *c){EVP_CIPHER_CTX_free(c);});
+    const unsigned char *k = reinterpret_cast<const unsigned char *>(key.data());
+    const unsigned char *iv = reinterpret_cast<const unsigned char *>(ticket.data() + 4);
+    if(!ctx || !EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_gcm(), NULL, k, iv)) {
+        LOG(ERROR) << "create the context to seal the ticket error";
+        return false;
+    }
+
+    // the epoch is authenticated along with the content
+    int n = 0;
+    size_t head = ticket.size();
+    ticket.append(plain.size() + ProxyCryptoTicketKeys::TAG_SIZE, '\0');
+    unsigned char *out = reinterpret_cast<unsigned char *>(&ticket[head]);
+    if(!EVP_EncryptUpdate(ctx.get(), NULL, &n,
+        reinterpret_cast<const unsigned char *>(ticket.data()), 4) ||
+        !EVP_EncryptUpdate(ctx.get(), out, &n,
+        reinterpret_cast<const unsigned char *>(plain.data()), static_cast<int>(plain.size())) ||
+        !EVP_EncryptFinal_ex(ctx.get(), out + n, &n) ||
+        !EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG,
+        static_cast<int>(ProxyCryptoTicketKeys::TAG_SIZE), out + plain.size())) {
+        LOG(ERROR) << "seal the ticket error";
+        return false;
+    }
+
+    return true;
+
+}
+
+bool ProxyCryptoTicketKeys::open(const std::string &ticket, time_t now,
+    std::string &plain) const {
+
+    size_t overhead = 4 + ProxyCryptoTicketKeys::IV_SIZE + ProxyCryptoTicketKeys::TAG_SIZE;
+    if(ticket.size() < overhead) {
+        return false;
+    }
+
+    // only the keys of this epoch and the last one, older tickets are expired anyway
+    uint32_t epoch = ntohl(*reinterpret_cast<const uint32_t *>(ticket.data()));
+    uint32_t current = static_cast<uint32_t>(now / _lifetime);
+    if(epoch != current && epoch + 1 != current) {
+        return false;
+    }
+
+    std::string key;
+    if(!_key(epoch, key)) {
+        return false;
+    }
+
+    std::shared_ptr<EVP_CIPHER_CTX> ctx(EVP_CIPHER_CTX_new(),
+        [](EVP_CIPHER_CTX *c){EVP_CIPHER_CTX_free(c);});
+    const unsigned char *k = reinterpret_cast<const unsigned char *>(key.data());
+    const unsigned char *iv = reinterpret_cast<const unsigned char *>(ticket.data() + 4);
+    if(!ctx || !EVP_DecryptInit_ex(ctx.get(), EVP_aes_256_gcm(), NULL, k, iv)) {
+        LOG(ERROR) << "create the context to open the ticket error";
+        return false;
+    }
+
+    size_t len = ticket.size() - overhead;
+    const unsigned char *in = reinterpret_cast<const unsigned char *>(ticket.data()) + 4 +
+        ProxyCryptoTicketKeys::IV_SIZE;
+    std::string tag = ticket.substr(ticket.size() - ProxyCryptoTicketKeys::TAG_SIZE);
+
+    int n = 0;
+    plain.assign(len, '\0');
+    unsigned char *out = reinterpret_cast<unsigned char *>(&plain[0]);
+    if(!EVP_DecryptUpdate(ctx.get(), NULL, &n,
+        reinterpret_cast<const unsigned char *>(ticket.data()), 4) ||
+        !EVP_DecryptUpdate(ctx.get(), out, &n, in, static_cast<int>(len)) ||
+        !EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG,
+        static_cast<int>(ProxyCryptoTicketKeys::TAG_SIZE), &tag[0]) ||
+        EVP_DecryptFinal_ex(ctx.get(), out + n, &n) <= 0) {
+        plain.clear();
+        return false;
+    }
+
+    return true;
+
+}
+
+}
+}
@@ -0,0 +1,70 @@
+#ifndef PROXY_CRYPTO_TICKET_H_H_H
+#define PROXY_CRYPTO_TICKET_H_H_H
+
+#include <memory>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace proxy {
+namespace crypto {
+
+/*
+ * the resumption tickets are sealed with aes-256-gcm by the key of the epoch they are
+ * issued in, an epoch lasts one lifetime and the keys of the current and the last epoch
+ * open a ticket, the keys come from a secret made before forking, so every worker opens
+ * the tickets of the others and nothing is shared at run time
+ *
+ *   +---------+--------+------------+---------+
+ *   |  EPOCH  |   IV   | CIPHERTEXT |   TAG   |
+ *   +---------+--------+------------+---------+
+ *   | 4bytes  | 12bytes|            | 16bytes |
+ *   +---------+--------+------------+---------+
+ */
+class ProxyCryptoTicketKeys {
+
+public:
+    // nullptr when the random secret is not available
+    static std::shared_ptr<ProxyCryptoTicketKeys> generate(time_t);
+
+    ProxyCryptoTicketKeys(const std::string &secret, time_t lifetime) : _secret(secret),
+        _lifetime(lifetime) {}
+
+    bool seal(const std::string &, time_t, std::string &) const;
+    bool open(const std::string &, time_t, std::string &) const;
+
+    time_t lifetime() const {
+        return _lifetime;
+    }
+
+    static const size_t SECRET_SIZE;
+    static const size_t IV_SIZE;
+    static const size_t TAG_SIZE;
+
+private:
+    bool _key(uint32_t, std::string &) const;
+
+    std::string _secret;
+    time_t _lifetime;
+
+};
+
+// a ticket kept by the encryption server, with the secret it resumes and its expiry
+class ProxyCryptoTicket {
+
+public:
+    ProxyCryptoTicket(const std::string &t, const std::string &s, time_t e) : ticket(t),
+        secret(s), expires(e) {}
+
+    std::string ticket;
+    std::string secret;
+    time_t expires;
+
+};
+
+}
+}
+
+#endif
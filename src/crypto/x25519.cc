@@ -0,0 +1,86 @@
+#include "crypto/x25519.h"
+
+#include <memory>
+
+#include "glog/logging.h"
+
+namespace proxy {
+namespace crypto {
+
+const size_t ProxyCryptoX25519::KEY_SIZE = 32;
+
+bool ProxyCryptoX25519::generate_key_pair(std::string &pri, std::string &pub) {
+
+    std::shared_ptr<EVP_PKEY_CTX> ctx(EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL),
+        [](EVP_PKEY_CTX *c){EVP_PKEY_CTX_free(c);});
+    if(!ctx || EVP_PKEY_keygen_init(ctx.get()) <= 0) {
+        LOG(ERROR) << "create the x25519 key generation context error";
+        return false;
+    }
+
+    EVP_PKEY *tmp = NULL;
+    if(EVP_PKEY_keygen(ctx.get(), &tmp) <= 0) {
+        LOG(ERROR) << "generate the x25519 key pair error";
+        return false;
+    }
+    std::shared_ptr<EVP_PKEY> key(tmp, [](EVP_PKEY *k){EVP_PKEY_free(k);});
+
+    size_t prilen = ProxyCryptoX25519::KEY_SIZE;
+    size_t publen = ProxyCryptoX25519::KEY_SIZE;
+    pri.assign(prilen, '\0');
+    pub.assign(publen, '\0');
+    if(!EVP_PKEY_get_raw_private_key(key.get(), reinterpret_cast<unsigned char *>(&pri[0]),
+        &prilen) || !EVP_PKEY_get_raw_public_key(key.get(),
+        reinterpret_cast<unsigned char *>(&pub[0]), &publen) ||
+        prilen != ProxyCryptoX25519::KEY_SIZE || publen != ProxyCryptoX25519::KEY_SIZE) {
+        LOG(ERROR) << "export the raw x25519 key pair error";
+        return false;
+    }
+
+    return true;
+
+}
+
+bool ProxyCryptoX25519::derive(const std::string &pri, const std::string &peer,
+    std::string &secret) {
+
+    if(pri.size() != ProxyCryptoX25519::KEY_SIZE || peer.size() != ProxyCryptoX25519::KEY_SIZE) {
+        LOG(ERROR) << "the length of the x25519 key error: " << pri.size() << " "
+            << peer.size();
+        return false;
+    }
+
+    std::shared_ptr<EVP_PKEY> key(EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL,
+        reinterpret_cast<const unsigned char *>(pri.data()), pri.size()),
+        [](EVP_PKEY *k){EVP_PKEY_free(k);});
+    std::shared_ptr<EVP_PKEY> peer_key(EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL,
+        reinterpret_cast<const unsigned char *>(peer.data()), peer.size()),
+        [](EVP_PKEY *k){EVP_PKEY_free(k);});
+    if(!key || !peer_key) {
+        LOG(ERROR) << "load the raw x25519 keys error";
+        return false;
+    }
+
+    std::shared_ptr<EVP_PKEY_CTX> ctx(EVP_PKEY_CTX_new(key.get(), NULL),
+        [](EVP_PKEY_CTX *c){EVP_PKEY_CTX_free(c);});
+    if(!ctx || EVP_PKEY_derive_init(ctx.get()) <= 0 ||
+        EVP_PKEY_derive_set_peer(ctx.get(), peer_key.get()) <= 0) {
+        LOG(ERROR) << "create the x25519 derivation context error";
+        return false;
+    }
+
+    // a public key of a small order gives the all zero secret, which fails here
+    size_t len = ProxyCryptoX25519::KEY_SIZE;
+    secret.assign(len, '\0');
+    if(EVP_PKEY_derive(ctx.get(), reinterpret_cast<unsigned char *>(&secret[0]), &len) <= 0 ||
+        len != ProxyCryptoX25519::KEY_SIZE) {
+        LOG(ERROR) << "derive the x25519 shared secret error";
+        return false;
+    }
+
+    return true;
+
+}
+
+}
+}
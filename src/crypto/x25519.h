@@ -0,0 +1,34 @@
+#ifndef PROXY_CRYPTO_X25519_H_H_H
+#define PROXY_CRYPTO_X25519_H_H_H
+
+#include <string>
+
+#include <stddef.h>
+
+#include "openssl/evp.h"
+
+namespace proxy {
+namespace crypto {
+
+/*
+ * the ephemeral elliptic curve key exchange of the tunnels, the keys live for one
+ * handshake only, and the shared secret is expanded to the key and the iv of every
+ * direction with hkdf-sha256
+ */
+class ProxyCryptoX25519 {
+
+public:
+    // a fresh key pair, both in the raw 32 bytes form
+    static bool generate_key_pair(std::string &, std::string &);
+
+    // the shared secret of our private key and the public key of the peer
+    static bool derive(const std::string &, const std::string &, std::string &);
+
+    static const size_t KEY_SIZE;
+
+};
+
+}
+}
+
+#endif
@@ -30,21 +30,22 @@ bool ProxyProtoAck::on_ack_send(std::shared_ptr<ProxyTunnel> &tunnel, ProxyProto
     buf->buffer[0] = 0xf;
     buf->cur = 1;
 
-    ssize_t nwrite;
+    // staged, it goes out with whatever the tunnel sends next in the flight
+    bool staged;
     switch(d) {
         case ProxyProtoAckDirect::PROXY_PROTO_ACK_EP0:
-            nwrite = tunnel->write_ep0_eq(1, buf);
+            staged = tunnel->stage_ep0(buf);
             break;
         case ProxyProtoAckDirect::PROXY_PROTO_ACK_EP1:
-            nwrite = tunnel->write_ep1_eq(1, buf);
+            staged = tunnel->stage_ep1(buf);
             break;
         default:
             LOG(ERROR) << "unknown ack direction of " << tunnel->ep0_ep1_string();
             return false;
     }
 
-    if(nwrite != 1) {
-        LOG(ERROR) << tunnel->ep0_ep1_string() << ": send the ack byte error: " << strerror(errno);
+    if(!staged) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": send the ack byte error";
         return false;
     }
 
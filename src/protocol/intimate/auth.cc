@@ -3,9 +3,11 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/socket.h>
 
 #include "core/server.h"
 #include "protocol/intimate/auth.h"
+#include "protocol/intimate/resume.h"
 #include "core/buffer.h"
 #include "core/config.h"
 #include "crypto/aes.h"
@@ -16,6 +18,7 @@ using proxy::core::ProxyStmEvent;
 using proxy::core::ProxyTunnel;
 using proxy::core::ProxyBuffer;
 using proxy::core::ProxyConfig;
+using proxy::core::ProxyTraffic;
 
 
 namespace proxy {
@@ -67,7 +70,7 @@ ProxyStmEvent ProxyProtoAuthenticate::on_identification_send(
 
     buf0->cur = 8 + ulen + plen;
 
-    if(!proxy::crypto::ProxyCryptoAes::aes_cfb_encrypt(tunnel->aes_ctx(), buf0, buf1)) {
+    if(!proxy::crypto::ProxyCryptoAes::encrypt(tunnel->aes_ctx(), buf0, buf1)) {
         LOG(ERROR) << tunnel->ep0_ep1_string() << ": encrypt the authentication message error";
         return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL;
     }
@@ -78,11 +81,38 @@ ProxyStmEvent ProxyProtoAuthenticate::on_identification_send(
         return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL;
     }
 
-    size_t towrite = buf1->cur;
-    ssize_t nwrite = tunnel->write_ep1_eq(towrite, buf1);
-    if(nwrite < 0 || towrite != static_cast<size_t>(nwrite)) {
+    if(!tunnel->stage_ep1(buf1)) {
         LOG(ERROR) << tunnel->ep0_ep1_string()
-            << ": send the encrypted identification data error: " << strerror(errno);
+            << ": send the encrypted identification data error";
+        return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL;
+    }
+
+    // the client speaks first and its greeting is usually waiting by now, so it is ciphered
+    // after the identification and both go out in one write
+    buf0->clear();
+    ssize_t nread = tunnel->ep0()->read_nonblock(buf0);
+    if(nread == 0) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": ep0 closed during the authentication";
+        return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL;
+    }
+    if(nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": read the first bytes of ep0 error: "
+            << strerror(errno);
+        return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL;
+    }
+    if(nread > 0) {
+        if(!proxy::crypto::ProxyCryptoAes::encrypt(tunnel->aes_ctx(), buf0) ||
+            !tunnel->stage_ep1(buf0)) {
+            LOG(ERROR) << tunnel->ep0_ep1_string() << ": stage the first bytes of ep0 error";
+            return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL;
+        }
+        tunnel->add_bytes(nread);
+        ProxyTraffic::add_read(true);
+    }
+
+    // the ticket comes ahead of any relayed data
+    if(tunnel->server()->config().crypto_resumption() &&
+        !ProxyProtoResume::on_ticket_receive(tunnel)) {
         return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL;
     }
 
@@ -142,6 +172,10 @@ ProxyStmEvent ProxyProtoAuthenticate::on_identification_receive(
         return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL;
     }
 
+    if(tunnel->ticket_wanted() && !ProxyProtoResume::on_ticket_send(tunnel, username)) {
+        return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_FAIL;
+    }
+
     return ProxyStmEvent::PROXY_STM_EVENT_AUTHENTICATING_OK;
 
 }
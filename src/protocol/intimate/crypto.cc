@@ -1,24 +1,40 @@
+#include <algorithm>
 #include <exception>
+#include <vector>
 
 #include "errno.h"
 #include "string.h"
 
 #include "protocol/intimate/crypto.h"
+#include "protocol/intimate/resume.h"
 #include "protocol/intimate/ack.h"
 #include "core/buffer.h"
+#include "core/event.h"
 #include "core/server.h"
+#include "core/thread_pool.h"
 #include "crypto/rsa.h"
 #include "crypto/aes.h"
+#include "crypto/cipher.h"
+#include "crypto/kdf.h"
+#include "crypto/x25519.h"
 #include "glog/logging.h"
 
 using proxy::core::ProxyStmEvent;
 using proxy::core::ProxyTunnel;
 using proxy::core::ProxyBuffer;
+using proxy::core::ProxyEvent;
+using proxy::core::ProxyThreadPool;
+using proxy::crypto::ProxyCryptoCipher;
+using proxy::crypto::ProxyCryptoCipherSuite;
+using proxy::crypto::ProxyCryptoKdf;
+using proxy::crypto::ProxyCryptoX25519;
 
 namespace proxy {
 namespace protocol {
 namespace intimate {
 
+const long long ProxyProtoCryptoNegotiate::_RSA_RETRY_INTERVAL = 1000;
+
 ProxyStmEvent ProxyProtoCryptoNegotiate::on_rsa_pubkey_request(
     std::shared_ptr<ProxyTunnel> &tunnel) {
 
@@ -42,55 +58,84 @@ ProxyStmEvent ProxyProtoCryptoNegotiate::on_rsa_pubkey_request(
         return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
     }
 
-    buf->buffer[0] = 0xf;
-    buf->buffer[1] = 0xa;
-    buf->cur = 2;
+    /*
+    **  the cipher offer goes ahead of the request unless aes-128-cfb is the only allowed
+    **  suite, the ids are in the order of preference
+    **    +------+-------+----------+
+    **    | TYPE | COUNT |   IDS    |
+    **    +------+-------+----------+
+    **    | 0xd  | 1byte | 1 to 255 |
+    **    +------+-------+----------+
+    */
 
-    if(2 != tunnel->write_ep1_eq(2, buf)) {
-        LOG(ERROR) << tunnel->ep0_ep1_string()
-            << ": send the rsa public key request message error: " << strerror(errno);
-        return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+    const std::vector<ProxyCryptoCipherSuite> &ciphers =
+        tunnel->server()->config().crypto_ciphers();
+    bool offer = _offers_ciphers(tunnel);
+
+    if(offer) {
+        buf->buffer[0] = 0xd;
+        buf->buffer[1] = static_cast<char>(ciphers.size());
+        buf->cur = 2;
+        for(ProxyCryptoCipherSuite suite : ciphers) {
+            buf->buffer[buf->cur++] = static_cast<char>(suite);
+        }
+        if(!tunnel->stage_ep1(buf)) {
+            LOG(ERROR) << tunnel->ep0_ep1_string() << ": send the cipher offer error";
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+        buf->clear();
     }
 
-    buf->clear();
-
     /*
-    ** the response message type is 0xe,
-    ** the length is the length of rsa public key(in byte),
-    ** the content is the rsa public key
-    **    +------+--------+-------------+
-    **    | TYPE | LENGTH |   CONTENT   |
-    **    +------+----------------------+
-    **    | 0xe  | 4byte  | RSA PUB KEY |
-    **    +------+--------+-------------+
+    **  with the public key of the peer in the cache, the fingerprint of it replaces the
+    **  request, the aes material encrypted by it follows in the same flight, and the answers
+    **  are read after it
+    **    +------+------+-------------+
+    **    | TYPE | BITS | FINGERPRINT |
+    **    +------+------+-------------+
+    **    | 0xb  | 0xa  |   8bytes    |
+    **    +------+------+-------------+
     */
 
-    if(5 != tunnel->read_ep1_eq(5, buf)) {
-        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the meta of the rsa response error: "
-            << strerror(errno);
-        return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+    std::shared_ptr<proxy::crypto::ProxyCryptoRsaPublicKey> cached;
+    if(tunnel->server()->config().crypto_rsa_key_cache()) {
+        cached = tunnel->server()->rsa_key_cache(remote(tunnel));
     }
 
-    if(*buf->get_charp_at(0) != 0xe) {
-        LOG(ERROR) << tunnel->ep1_ep0_string() << ": the type of the rsa response error: "
-            << (*buf->get_charp_at(0));
-        return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+    if(cached) {
+        buf->buffer[0] = 0xb;
+        buf->buffer[1] = 0xa;
+        buf->cur = 2;
+        for(size_t i = 0; i < cached->fingerprint().size(); ++i) {
+            buf->buffer[buf->cur++] = cached->fingerprint()[i];
+        }
+        if(!tunnel->stage_ep1(buf)) {
+            LOG(ERROR) << tunnel->ep0_ep1_string() << ": send the rsa key fingerprint error";
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+        tunnel->rsa_pubkey(cached, true);
+        return ProxyStmEvent::PROXY_STM_EVENT_RSA_PUBKEY_RECEIVE;
     }
 
-    uint32_t key_len = ntohl(*(reinterpret_cast<uint32_t *>(buf->get_charp_at(1))));
-    if(key_len == 0) {
-        LOG(ERROR) << tunnel->ep1_ep0_string() << ": the length of the rsa public key error: 0";
+    buf->buffer[0] = 0xf;
+    buf->buffer[1] = 0xa;
+    buf->cur = 2;
+
+    if(!tunnel->stage_ep1(buf)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string()
+            << ": send the rsa public key request message error";
         return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
     }
 
-    ssize_t nread = tunnel->read_ep1_eq(key_len, buf);
-    if(nread < 0 || static_cast<uint32_t>(nread) != key_len) {
-        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the rsa public key error: "
-            << strerror(errno);
+    buf->clear();
+
+    if(offer && !_read_cipher_answer(tunnel, buf)) {
         return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
     }
 
-    tunnel->rsa_key(std::string(buf->get_charp_at(5), key_len));
+    if(!_read_pubkey(tunnel, buf)) {
+        return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+    }
 
     return ProxyStmEvent::PROXY_STM_EVENT_RSA_PUBKEY_RECEIVE;
 
@@ -126,8 +171,82 @@ ProxyStmEvent ProxyProtoCryptoNegotiate::on_rsa_pubkey_response(
     }
 
     char ty = *buf->get_charp_at(0);
-    if(ty != 0xf) {
-        LOG(ERROR) << "the request type of rsa request need to be 0xf, but " << ty
+
+    // the ticket request and the resumption go ahead of the key exchange
+    while(ty == 0x9 || ty == 0x8) {
+        if(ty == 0x9) {
+            tunnel->ticket_wanted(true);
+        } else {
+            bool accepted = false;
+            if(!ProxyProtoResume::on_resume_response(tunnel, buf, accepted)) {
+                return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL;
+            }
+            if(accepted) {
+                return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_OK;
+            }
+        }
+        buf->clear();
+        if(2 != tunnel->read_ep0_eq(2, buf)) {
+            LOG(ERROR) << "read the key exchange from " << tunnel->ep0()->to_string()
+                << " error: " << strerror(errno);
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+        ty = *buf->get_charp_at(0);
+    }
+
+    if(ty == 0xc) {
+        return _ecdh_response(tunnel, buf);
+    }
+
+    const std::vector<ProxyCryptoCipherSuite> &ciphers =
+        tunnel->server()->config().crypto_ciphers();
+
+    if(ty == 0xd) {
+
+        // the offer of the cipher suites ahead of the request
+        size_t n = static_cast<uint8_t>(*buf->get_charp_at(1));
+        ssize_t nread = tunnel->read_ep0_eq(n, buf);
+        if(!n || nread < 0 || static_cast<size_t>(nread) != n) {
+            LOG(ERROR) << "read the cipher offer from " << tunnel->ep0()->to_string()
+                << " error: " << strerror(errno);
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+
+        if(!pick_cipher(tunnel, buf->get_charp_at(2), n)) {
+            LOG(ERROR) << "none of the ciphers offered by " << tunnel->ep0()->to_string()
+                << " is allowed by crypto.ciphers";
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+
+        buf->clear();
+        buf->buffer[0] = 0xd;
+        buf->buffer[1] = static_cast<char>(tunnel->cipher());
+        buf->cur = 2;
+        if(!tunnel->stage_ep0(buf)) {
+            LOG(ERROR) << "send the cipher answer to " << tunnel->ep0()->to_string() << " error";
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+
+        buf->clear();
+        if(2 != tunnel->read_ep0_eq(2, buf)) {
+            LOG(ERROR) << "read rsa public key request from " << tunnel->ep0()->to_string()
+                << " error: " << strerror(errno);
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+        ty = *buf->get_charp_at(0);
+
+    } else if(std::find(ciphers.begin(), ciphers.end(),
+        ProxyCryptoCipherSuite::AES_128_CFB) == ciphers.end()) {
+
+        // an old peer without the offer talks aes-128-cfb
+        LOG(ERROR) << tunnel->ep0()->to_string() << " offers no cipher, and aes-128-cfb "
+            << "is not allowed by crypto.ciphers";
+        return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+
+    }
+
+    if(ty != 0xf && ty != 0xb) {
+        LOG(ERROR) << "the request type of rsa request need to be 0xf or 0xb, but " << ty
             << "received from " << tunnel->ep0()->to_string();
         return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
     }
@@ -139,6 +258,44 @@ ProxyStmEvent ProxyProtoCryptoNegotiate::on_rsa_pubkey_response(
         return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
     }
 
+    if(ty == 0xb) {
+
+        // the peer sent the aes material with its cached key, which is still ours unless
+        // we restarted since, the verdict is 0 then and 1 with the new key
+        size_t len = proxy::crypto::ProxyCryptoRsa::FINGERPRINT_SIZE;
+        ssize_t nread = tunnel->read_ep0_eq(len, buf);
+        if(nread < 0 || static_cast<size_t>(nread) != len) {
+            LOG(ERROR) << "read the rsa key fingerprint from " << tunnel->ep0()->to_string()
+                << " error: " << strerror(errno);
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+
+        const std::string &fingerprint = tunnel->server()->rsa_keypair()->fingerprint();
+        bool fresh = !fingerprint.empty() &&
+            std::string(buf->get_charp_at(2), len) == fingerprint;
+
+        buf->clear();
+        if(!fresh && !_drop_aes_key_iv(tunnel, buf)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+
+        buf->clear();
+        buf->buffer[0] = 0xb;
+        buf->buffer[1] = fresh ? 0x0 : 0x1;
+        buf->cur = 2;
+        if(!tunnel->stage_ep0(buf)) {
+            LOG(ERROR) << "send the rsa key verdict to " << tunnel->ep0()->to_string()
+                << " error";
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
+        }
+
+        if(fresh) {
+            tunnel->rsa_key(tunnel->server()->rsa_keypair()->pub());
+            return ProxyStmEvent::PROXY_STM_EVENT_RSA_PUBKEY_SEND;
+        }
+
+    }
+
     /*
     ** the response message type is 0xe,
     ** the length is the length of rsa public key(in byte),
@@ -162,11 +319,8 @@ ProxyStmEvent ProxyProtoCryptoNegotiate::on_rsa_pubkey_response(
     buf->cur = 5 + key.size();
     buf->cur = (buf->cur < buf->size) ? buf->cur : buf->size;
 
-    size_t towrite = buf->cur - buf->start;
-    ssize_t nwrite = tunnel->write_ep0_eq(towrite, buf);
-    if(nwrite < 0 || static_cast<size_t>(nwrite) != towrite) {
-        LOG(ERROR) << "write the rsa public key to " << tunnel->ep0()->to_string() << " error: "
-            << strerror(errno);
+    if(!tunnel->stage_ep0(buf)) {
+        LOG(ERROR) << "write the rsa public key to " << tunnel->ep0()->to_string() << " error";
         return ProxyStmEvent::PROXY_STM_EVENT_RSA_NEGOTIATING_FAIL;
     }
 
@@ -176,6 +330,414 @@ ProxyStmEvent ProxyProtoCryptoNegotiate::on_rsa_pubkey_response(
 
 }
 
+ProxyStmEvent ProxyProtoCryptoNegotiate::on_ecdh_request(std::shared_ptr<ProxyTunnel> &tunnel) {
+
+    /*
+    **  the public key of an ephemeral x25519 key pair follows the cipher offer, the keys
+    **  of both directions come from the shared secret, so the identification goes out
+    **  right after the answer
+    **    +------+-------+----------+------------+
+    **    | TYPE | COUNT |   IDS    |  PUB KEY   |
+    **    +------+-------+----------+------------+
+    **    | 0xc  | 1byte | 1 to 255 |  32bytes   |
+    **    +------+-------+----------+------------+
+    */
+
+    std::shared_ptr<ProxyBuffer> buf;
+
+    try {
+        buf = std::make_shared<ProxyBuffer>(512);
+    } catch(const std::exception &ex) {
+        LOG(ERROR) << tunnel->ep0_ep1_string()
+            << ": create the buffer for the x25519 exchange error: " << ex.what();
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    std::string pri;
+    std::string pub;
+    if(!ProxyCryptoX25519::generate_key_pair(pri, pub)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": generate the x25519 key pair error";
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    const std::vector<ProxyCryptoCipherSuite> &ciphers =
+        tunnel->server()->config().crypto_ciphers();
+
+    buf->buffer[0] = 0xc;
+    buf->buffer[1] = static_cast<char>(ciphers.size());
+    buf->cur = 2;
+    for(ProxyCryptoCipherSuite suite : ciphers) {
+        buf->buffer[buf->cur++] = static_cast<char>(suite);
+    }
+    for(size_t i = 0; i < pub.size(); ++i) {
+        buf->buffer[buf->cur++] = pub[i];
+    }
+
+    std::string request(buf->get_charp_at(0), buf->cur);
+    if(!tunnel->stage_ep1(buf)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": send the x25519 request error";
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    /*
+    **  the answer carries the picked suite and the public key of the decryption server
+    **    +------+------+------------+
+    **    | TYPE |  ID  |  PUB KEY   |
+    **    +------+------+------------+
+    **    | 0xc  | 1byte|  32bytes   |
+    **    +------+------+------------+
+    */
+
+    buf->clear();
+    size_t len = 2 + ProxyCryptoX25519::KEY_SIZE;
+    ssize_t nread = tunnel->read_ep1_eq(len, buf);
+    if(nread < 0 || static_cast<size_t>(nread) != len) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the x25519 answer error, the peer "
+            << "may not know the exchange and needs crypto.key_exchange=rsa: "
+            << strerror(errno);
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    ProxyCryptoCipherSuite suite;
+    if(*buf->get_charp_at(0) != 0xc || !ProxyCryptoCipher::from_id(
+        static_cast<uint8_t>(*buf->get_charp_at(1)), suite) ||
+        std::find(ciphers.begin(), ciphers.end(), suite) == ciphers.end()) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": unexpected x25519 answer: "
+            << static_cast<int>(*buf->get_charp_at(0)) << " "
+            << static_cast<int>(*buf->get_charp_at(1));
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+    tunnel->cipher(suite);
+
+    std::string answer(buf->get_charp_at(0), len);
+    std::string secret;
+    // both messages salt the expansion, so a tampered offer or answer gives other keys
+    if(!ProxyCryptoX25519::derive(pri, answer.substr(2), secret) ||
+        !expand_keys(tunnel, secret, request + answer, "proxy x25519", true)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": derive the keys of the x25519 exchange error";
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    tunnel->server()->add_x25519();
+
+    return ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_RECEIVE;
+
+}
+
+ProxyStmEvent ProxyProtoCryptoNegotiate::_ecdh_response(std::shared_ptr<ProxyTunnel> &tunnel,
+    std::shared_ptr<ProxyBuffer> &buf) {
+
+    // the type and the count are in the buffer already, the ids and the key follow
+    size_t n = static_cast<uint8_t>(*buf->get_charp_at(1));
+    size_t len = n + ProxyCryptoX25519::KEY_SIZE;
+    ssize_t nread = tunnel->read_ep0_eq(len, buf);
+    if(!n || nread < 0 || static_cast<size_t>(nread) != len) {
+        LOG(ERROR) << "read the x25519 request from " << tunnel->ep0()->to_string()
+            << " error: " << strerror(errno);
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    if(!pick_cipher(tunnel, buf->get_charp_at(2), n)) {
+        LOG(ERROR) << "none of the ciphers offered by " << tunnel->ep0()->to_string()
+            << " is allowed by crypto.ciphers";
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    std::string request(buf->get_charp_at(0), 2 + len);
+
+    std::string pri;
+    std::string pub;
+    std::string secret;
+    if(!ProxyCryptoX25519::generate_key_pair(pri, pub) ||
+        !ProxyCryptoX25519::derive(pri, request.substr(2 + n), secret)) {
+        LOG(ERROR) << "the x25519 exchange with " << tunnel->ep0()->to_string() << " error";
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    buf->clear();
+    buf->buffer[0] = 0xc;
+    buf->buffer[1] = static_cast<char>(tunnel->cipher());
+    buf->cur = 2;
+    for(size_t i = 0; i < pub.size(); ++i) {
+        buf->buffer[buf->cur++] = pub[i];
+    }
+
+    std::string answer(buf->get_charp_at(0), buf->cur);
+    if(!expand_keys(tunnel, secret, request + answer, "proxy x25519", false)) {
+        LOG(ERROR) << "derive the keys of the x25519 exchange with "
+            << tunnel->ep0()->to_string() << " error";
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    if(!tunnel->stage_ep0(buf)) {
+        LOG(ERROR) << "send the x25519 answer to " << tunnel->ep0()->to_string() << " error";
+        return ProxyStmEvent::PROXY_STM_EVENT_ECDH_NEGOTIATING_FAIL;
+    }
+
+    tunnel->server()->add_x25519();
+
+    return ProxyStmEvent::PROXY_STM_EVENT_ECDH_KEY_SEND;
+
+}
+
+bool ProxyProtoCryptoNegotiate::expand_keys(std::shared_ptr<ProxyTunnel> &tunnel,
+    const std::string &secret, const std::string &salt, const std::string &label,
+    bool encryption) {
+
+    using proxy::crypto::ProxyCryptoAes;
+    using proxy::crypto::ProxyCryptoAesContextType;
+
+    size_t len = ProxyCryptoAes::AES_KEY_SIZE + ProxyCryptoAes::AES_IV_SIZE;
+
+    std::string up;
+    std::string down;
+    if(!ProxyCryptoKdf::hkdf(secret, salt, label + " up", len, up) ||
+        !ProxyCryptoKdf::hkdf(secret, salt, label + " down", len, down)) {
+        return false;
+    }
+
+    // up is the direction from the encryption server to the decryption server
+    const std::string &own = encryption ? up : down;
+    const std::string &peer = encryption ? down : up;
+
+    tunnel->aes_key(own.substr(0, ProxyCryptoAes::AES_KEY_SIZE));
+    tunnel->aes_iv(own.substr(ProxyCryptoAes::AES_KEY_SIZE));
+    tunnel->aes_key_peer(peer.substr(0, ProxyCryptoAes::AES_KEY_SIZE));
+    tunnel->aes_iv_peer(peer.substr(ProxyCryptoAes::AES_KEY_SIZE));
+
+    return tunnel->aes_ctx_setup(ProxyCryptoAesContextType::AES_CONTEXT_ENCRYPT_TYPE) &&
+        tunnel->aes_ctx_peer_setup(ProxyCryptoAesContextType::AES_CONTEXT_DECRYPT_TYPE);
+
+}
+
+bool ProxyProtoCryptoNegotiate::_drop_aes_key_iv(std::shared_ptr<ProxyTunnel> &tunnel,
+    std::shared_ptr<ProxyBuffer> &buf) {
+
+    // the aes material encrypted by a stale key is read and thrown away, the peer sends it
+    // again with the new key
+    if(4 != tunnel->read_ep0_eq(4, buf)) {
+        LOG(ERROR) << "read the length of the stale aes material from "
+            << tunnel->ep0()->to_string() << " error: " << strerror(errno);
+        return false;
+    }
+
+    uint32_t len = ntohl(*reinterpret_cast<uint32_t *>(buf->get_charp_at(0)));
+    if(len == 0 || len > buf->size - buf->cur) {
+        LOG(ERROR) << "the length of the stale aes material from " << tunnel->ep0()->to_string()
+            << " error: " << len;
+        return false;
+    }
+
+    ssize_t nread = tunnel->read_ep0_eq(len, buf);
+    if(nread < 0 || static_cast<uint32_t>(nread) != len) {
+        LOG(ERROR) << "read the stale aes material from " << tunnel->ep0()->to_string()
+            << " error: " << strerror(errno);
+        return false;
+    }
+
+    return true;
+
+}
+
+bool ProxyProtoCryptoNegotiate::_offers_ciphers(std::shared_ptr<ProxyTunnel> &tunnel) {
+
+    // the cipher offer goes ahead of the request unless aes-128-cfb is the only allowed suite
+    const std::vector<ProxyCryptoCipherSuite> &ciphers =
+        tunnel->server()->config().crypto_ciphers();
+    return !(ciphers.size() == 1 && ciphers[0] == ProxyCryptoCipherSuite::AES_128_CFB);
+
+}
+
+std::string ProxyProtoCryptoNegotiate::remote(std::shared_ptr<ProxyTunnel> &tunnel) {
+    const proxy::core::ProxyConfig &config = tunnel->server()->config();
+    return config.remote_host() + ":" + std::to_string(config.remote_port());
+}
+
+bool ProxyProtoCryptoNegotiate::_read_cipher_answer(std::shared_ptr<ProxyTunnel> &tunnel,
+    std::shared_ptr<ProxyBuffer> &buf) {
+
+    /*
+    **  the answer to the offer is the suite picked by the decryption server
+    **    +------+------+
+    **    | TYPE |  ID  |
+    **    +------+------+
+    **    | 0xd  | 1byte|
+    **    +------+------+
+    */
+
+    const std::vector<ProxyCryptoCipherSuite> &ciphers =
+        tunnel->server()->config().crypto_ciphers();
+
+    if(2 != tunnel->read_ep1_eq(2, buf)) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the cipher answer error, the "
+            << "peer may not know the negotiation and needs crypto.ciphers=aes-128-cfb: "
+            << strerror(errno);
+        return false;
+    }
+
+    ProxyCryptoCipherSuite suite;
+    if(*buf->get_charp_at(0) != 0xd || !ProxyCryptoCipher::from_id(
+        static_cast<uint8_t>(*buf->get_charp_at(1)), suite) ||
+        std::find(ciphers.begin(), ciphers.end(), suite) == ciphers.end()) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": unexpected cipher answer: "
+            << static_cast<int>(*buf->get_charp_at(0)) << " "
+            << static_cast<int>(*buf->get_charp_at(1));
+        return false;
+    }
+
+    tunnel->cipher(suite);
+    buf->clear();
+
+    return true;
+
+}
+
+bool ProxyProtoCryptoNegotiate::_read_pubkey(std::shared_ptr<ProxyTunnel> &tunnel,
+    std::shared_ptr<ProxyBuffer> &buf) {
+
+    /*
+    ** the response message type is 0xe,
+    ** the length is the length of rsa public key(in byte),
+    ** the content is the rsa public key
+    **    +------+--------+-------------+
+    **    | TYPE | LENGTH |   CONTENT   |
+    **    +------+----------------------+
+    **    | 0xe  | 4byte  | RSA PUB KEY |
+    **    +------+--------+-------------+
+    */
+
+    if(5 != tunnel->read_ep1_eq(5, buf)) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the meta of the rsa response error: "
+            << strerror(errno);
+        return false;
+    }
+
+    if(*buf->get_charp_at(0) != 0xe) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": the type of the rsa response error: "
+            << (*buf->get_charp_at(0));
+        return false;
+    }
+
+    uint32_t key_len = ntohl(*(reinterpret_cast<uint32_t *>(buf->get_charp_at(1))));
+    if(key_len == 0) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": the length of the rsa public key error: 0";
+        return false;
+    }
+
+    ssize_t nread = tunnel->read_ep1_eq(key_len, buf);
+    if(nread < 0 || static_cast<uint32_t>(nread) != key_len) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the rsa public key error: "
+            << strerror(errno);
+        return false;
+    }
+
+    // parsed once here, every later tunnel to the remote encrypts with the cached object
+    std::string pem(buf->get_charp_at(5), key_len);
+    std::shared_ptr<proxy::crypto::ProxyCryptoRsaPublicKey> key =
+        proxy::crypto::ProxyCryptoRsaPublicKey::parse(pem);
+    if(!key) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": parse the rsa public key error";
+        return false;
+    }
+
+    tunnel->rsa_key(std::move(pem));
+    tunnel->rsa_pubkey(key, false);
+    if(tunnel->server()->config().crypto_rsa_key_cache()) {
+        tunnel->server()->rsa_key_cache(remote(tunnel), key);
+    }
+    buf->clear();
+
+    return true;
+
+}
+
+bool ProxyProtoCryptoNegotiate::_confirm_cached_key(std::shared_ptr<ProxyTunnel> &tunnel,
+    std::shared_ptr<ProxyBuffer> &material, std::shared_ptr<ProxyBuffer> &buf) {
+
+    /*
+    **  the answers to the optimistic flight, the cipher answer first if offered, then the
+    **  verdict on the fingerprint, a stale one is followed by the 0xe response with the new
+    **  key and the aes material is sent again
+    **    +------+--------+
+    **    | TYPE | STATUS |
+    **    +------+--------+
+    **    | 0xb  | 0 or 1 |
+    **    +------+--------+
+    */
+
+    if(_offers_ciphers(tunnel) && !_read_cipher_answer(tunnel, buf)) {
+        return false;
+    }
+
+    if(2 != tunnel->read_ep1_eq(2, buf)) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the rsa key verdict error, the peer "
+            << "may not know the cached key and needs crypto.rsa_key_cache=0: "
+            << strerror(errno);
+        return false;
+    }
+
+    char ty = *buf->get_charp_at(0);
+    char status = *buf->get_charp_at(1);
+    buf->clear();
+
+    if(ty != 0xb || (status != 0x0 && status != 0x1)) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": unexpected rsa key verdict: "
+            << static_cast<int>(ty) << " " << static_cast<int>(status);
+        return false;
+    }
+
+    tunnel->server()->add_rsa_key_cache(status == 0x0);
+
+    if(status == 0x1) {
+
+        LOG(INFO) << tunnel->ep1_ep0_string() << ": the rsa public key of the peer changed";
+
+        if(!_read_pubkey(tunnel, buf)) {
+            return false;
+        }
+
+        buf->cur += 4;
+        if(!tunnel->rsa_pubkey()->encrypt(material, buf)) {
+            LOG(ERROR) << tunnel->ep0_ep1_string() << ": encrypt the aes key and iv error";
+            return false;
+        }
+        uint32_t *p = reinterpret_cast<uint32_t *>(buf->get_charp_at(0));
+        *p = htonl(static_cast<uint32_t>(buf->cur - 4));
+
+        if(!tunnel->stage_ep1(buf)) {
+            LOG(ERROR) << tunnel->ep0_ep1_string() << ": write the aes key and iv error";
+            return false;
+        }
+
+    }
+
+    // the suite is known only now, so the contexts are set up again
+    using proxy::crypto::ProxyCryptoAesContextType;
+    return tunnel->aes_ctx_setup(ProxyCryptoAesContextType::AES_CONTEXT_ENCRYPT_TYPE) &&
+        tunnel->aes_ctx_peer_setup(ProxyCryptoAesContextType::AES_CONTEXT_DECRYPT_TYPE);
+
+}
+
+bool ProxyProtoCryptoNegotiate::pick_cipher(std::shared_ptr<ProxyTunnel> &tunnel,
+    const char *ids, size_t n) {
+
+    // the first of our own list in the offer, the unknown ids are skipped
+    const std::vector<ProxyCryptoCipherSuite> &ciphers =
+        tunnel->server()->config().crypto_ciphers();
+
+    for(size_t i = 0; i < ciphers.size(); ++i) {
+        for(size_t j = 0; j < n; ++j) {
+            if(static_cast<uint8_t>(ids[j]) == static_cast<uint8_t>(ciphers[i])) {
+                tunnel->cipher(ciphers[i]);
+                return true;
+            }
+        }
+    }
+
+    return false;
+
+}
+
 ProxyStmEvent ProxyProtoCryptoNegotiate::on_aes_key_iv_send(
     std::shared_ptr<ProxyTunnel> &tunnel, ProxyProtoCryptoNegotiateDirect d) {
 
@@ -228,7 +790,7 @@ ProxyStmEvent ProxyProtoCryptoNegotiate::on_aes_key_iv_send(
     }
 
     buf1->cur += 4;
-    if(!proxy::crypto::ProxyCryptoRsa::rsa_encrypt(buf0, buf1, tunnel->rsa_key())) {
+    if(!tunnel->rsa_pubkey() || !tunnel->rsa_pubkey()->encrypt(buf0, buf1)) {
         LOG(ERROR) << tunnel->ep0_ep1_string() << ": encrypt the aes key and iv error";
         return ProxyStmEvent::PROXY_STM_EVENT_AES_NEGOTIATING_FAIL;
     }
@@ -237,20 +799,25 @@ ProxyStmEvent ProxyProtoCryptoNegotiate::on_aes_key_iv_send(
     *p = htonl(static_cast<uint32_t>(buf1->cur - 4));
 
 
-    size_t towrite = buf1->cur - buf1->start;
-
-    ssize_t nwrite = 0;
+    bool staged = false;
     if(d == ProxyProtoCryptoNegotiateDirect::PROXY_PROTO_CRYPTO_NEGOTIATE_EP0) {
-        nwrite = tunnel->write_ep0_eq(towrite, buf1);
+        staged = tunnel->stage_ep0(buf1);
     } else {
-        nwrite = tunnel->write_ep1_eq(towrite, buf1);
+        staged = tunnel->stage_ep1(buf1);
     }
-    if(nwrite < 0 || static_cast<size_t>(nwrite) != towrite) {
-        LOG(ERROR) << tunnel->ep0_ep1_string() << ": write the aes key and iv to error: "
-            << strerror(errno);
+    if(!staged) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": write the aes key and iv error";
         return ProxyStmEvent::PROXY_STM_EVENT_AES_NEGOTIATING_FAIL;
     }
 
+    if(tunnel->rsa_cached()) {
+        buf1->clear();
+        if(!_confirm_cached_key(tunnel, buf0, buf1)) {
+            LOG(ERROR) << tunnel->ep0_ep1_string() << ": confirm the cached rsa key error";
+            return ProxyStmEvent::PROXY_STM_EVENT_AES_NEGOTIATING_FAIL;
+        }
+    }
+
     /* receive ack here */
     bool ack = false;
     if(d == ProxyProtoCryptoNegotiateDirect::PROXY_PROTO_CRYPTO_NEGOTIATE_EP0) {
@@ -325,10 +892,9 @@ ProxyStmEvent ProxyProtoCryptoNegotiate::on_aes_key_iv_receive(
         return ProxyStmEvent::PROXY_STM_EVENT_AES_NEGOTIATING_FAIL;
     }
 
-    std::string key = tunnel->server()->rsa_keypair()->pri();
     buf0->start += 4;
 
-    if(!proxy::crypto::ProxyCryptoRsa::rsa_decrypt(buf0, buf1, key)) {
+    if(!_rsa_decrypt(tunnel, buf0, buf1)) {
         LOG(ERROR) << tunnel->ep0_ep1_string() << ": decrypt the aes key and iv error";
         return ProxyStmEvent::PROXY_STM_EVENT_AES_NEGOTIATING_FAIL;
     }
@@ -373,6 +939,39 @@ ProxyStmEvent ProxyProtoCryptoNegotiate::on_aes_key_iv_receive(
 }
 
 
+bool ProxyProtoCryptoNegotiate::_rsa_decrypt(std::shared_ptr<ProxyTunnel> &tunnel,
+    std::shared_ptr<ProxyBuffer> &from, std::shared_ptr<ProxyBuffer> &to) {
+
+    const std::string &key = tunnel->server()->rsa_keypair()->pri();
+    const std::shared_ptr<ProxyThreadPool> &pool = tunnel->server()->rsa_pool();
+
+    if(!pool) {
+        return proxy::crypto::ProxyCryptoRsa::rsa_decrypt(from, to, key);
+    }
+
+    std::shared_ptr<ProxyEvent> event;
+    try {
+        event = std::make_shared<ProxyEvent>();
+    } catch (const std::exception &ex) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": create the rsa event error: " << ex.what();
+        return false;
+    }
+
+    // the private key operation runs in the rsa threads, a full queue parks the handshake
+    // instead of the whole scheduler
+    bool ok = false;
+    while(!pool->call([&from, &to, &key, &ok]() {
+        ok = proxy::crypto::ProxyCryptoRsa::rsa_decrypt(from, to, key);
+    }, *event)) {
+        co_usleep(ProxyProtoCryptoNegotiate::_RSA_RETRY_INTERVAL);
+    }
+
+    tunnel->server()->add_rsa_offloaded();
+
+    return ok;
+
+}
+
 }
 }
 }
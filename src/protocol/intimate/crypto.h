@@ -2,7 +2,9 @@
 #define PROXY_PROTOCOL_INTIMATE_CRYPTO_H_H_H
 
 #include <memory>
+#include <string>
 
+#include "core/buffer.h"
 #include "core/tunnel.h"
 #include "core/stm.h"
 
@@ -23,11 +25,45 @@ public:
     static proxy::core::ProxyStmEvent on_rsa_pubkey_response(
         std::shared_ptr<proxy::core::ProxyTunnel> &);
 
+    // the encryption side of the x25519 exchange, the decryption side is picked by the
+    // first byte in on_rsa_pubkey_response
+    static proxy::core::ProxyStmEvent on_ecdh_request(
+        std::shared_ptr<proxy::core::ProxyTunnel> &);
+
     static proxy::core::ProxyStmEvent on_aes_key_iv_send(
         std::shared_ptr<proxy::core::ProxyTunnel> &, ProxyProtoCryptoNegotiateDirect);
     static proxy::core::ProxyStmEvent on_aes_key_iv_receive(
         std::shared_ptr<proxy::core::ProxyTunnel> &, ProxyProtoCryptoNegotiateDirect);
 
+    // the host:port of the decryption server, which keys the caches of the encryption server
+    static std::string remote(std::shared_ptr<proxy::core::ProxyTunnel> &);
+
+    // the first suite of crypto.ciphers among the offered ids
+    static bool pick_cipher(std::shared_ptr<proxy::core::ProxyTunnel> &, const char *, size_t);
+
+    // the keys and the ivs of both directions expanded from the secret, the label tells the
+    // exchanges apart, flag as the encryption side
+    static bool expand_keys(std::shared_ptr<proxy::core::ProxyTunnel> &, const std::string &,
+        const std::string &, const std::string &, bool);
+
+private:
+    static proxy::core::ProxyStmEvent _ecdh_response(std::shared_ptr<proxy::core::ProxyTunnel> &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &);
+    static bool _drop_aes_key_iv(std::shared_ptr<proxy::core::ProxyTunnel> &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &);
+    static bool _offers_ciphers(std::shared_ptr<proxy::core::ProxyTunnel> &);
+    static bool _read_cipher_answer(std::shared_ptr<proxy::core::ProxyTunnel> &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &);
+    static bool _read_pubkey(std::shared_ptr<proxy::core::ProxyTunnel> &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &);
+    static bool _confirm_cached_key(std::shared_ptr<proxy::core::ProxyTunnel> &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &, std::shared_ptr<proxy::core::ProxyBuffer> &);
+
+    static bool _rsa_decrypt(std::shared_ptr<proxy::core::ProxyTunnel> &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &, std::shared_ptr<proxy::core::ProxyBuffer> &);
+
+    static const long long _RSA_RETRY_INTERVAL;
+
 };
 
 
@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <exception>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "openssl/rand.h"
+
+#include "protocol/intimate/resume.h"
+#include "protocol/intimate/crypto.h"
+#include "core/config.h"
+#include "core/server.h"
+#include "crypto/aes.h"
+#include "crypto/cipher.h"
+#include "crypto/ticket.h"
+#include "glog/logging.h"
+
+using proxy::core::ProxyStmEvent;
+using proxy::core::ProxyTunnel;
+using proxy::core::ProxyBuffer;
+using proxy::core::ProxyConfig;
+using proxy::crypto::ProxyCryptoCipher;
+using proxy::crypto::ProxyCryptoCipherSuite;
+using proxy::crypto::ProxyCryptoTicket;
+
+namespace proxy {
+namespace protocol {
+namespace intimate {
+
+const size_t ProxyProtoResume::_SECRET_SIZE = 32;
+const size_t ProxyProtoResume::_NONCE_SIZE = 32;
+const size_t ProxyProtoResume::_TICKET_MAX_SIZE = 512;
+
+bool ProxyProtoResume::on_ticket_request(std::shared_ptr<ProxyTunnel> &tunnel) {
+
+    /*
+    **  the ticket request goes ahead of the key exchange
+    **    +------+------+
+    **    | TYPE | FLAG |
+    **    +------+------+
+    **    | 0x9  | 0x1  |
+    **    +------+------+
+    */
+
+    std::shared_ptr<ProxyBuffer> buf;
+
+    try {
+        buf = std::make_shared<ProxyBuffer>(2);
+    } catch(const std::exception &ex) {
+        LOG(ERROR) << tunnel->ep0_ep1_string()
+            << ": create the buffer for the ticket request error: " << ex.what();
+        return false;
+    }
+
+    buf->buffer[0] = 0x9;
+    buf->buffer[1] = 0x1;
+    buf->cur = 2;
+
+    if(!tunnel->stage_ep1(buf)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": send the ticket request error";
+        return false;
+    }
+
+    return true;
+
+}
+
+bool ProxyProtoResume::on_ticket_send(std::shared_ptr<ProxyTunnel> &tunnel,
+    const std::string &username) {
+
+    /*
+    **  the ticket is encrypted along with the stream right after the identification, the
+    **  length is 0 and the secret is left out when the server issues no tickets
+    **    +----------+----------+----------+----------+
+    **    | LIFETIME |  LENGTH  |  TICKET  |  SECRET  |
+    **    +----------+----------+----------+----------+
+    **    |  4bytes  |  2bytes  |          |  32bytes |
+    **    +----------+----------+----------+----------+
+    **  the secret is random, and the sealed content keeps a copy of it
+    **    +----------+----------+----------+----------+
+    **    |  ISSUED  |  SECRET  |   ULEN   | USERNAME |
+    **    +----------+----------+----------+----------+
+    **    |  8bytes  |  32bytes |  1byte   |          |
+    **    +----------+----------+----------+----------+
+    */
+
+    const std::shared_ptr<proxy::crypto::ProxyCryptoTicketKeys> &keys =
+        tunnel->server()->ticket_keys();
+    time_t now = time(NULL);
+
+    std::string ticket;
+    std::string secret(ProxyProtoResume::_SECRET_SIZE, '\0');
+    if(keys && username.size() <= 0xff &&
+        RAND_bytes(reinterpret_cast<unsigned char *>(&secret[0]),
+            static_cast<int>(secret.size())) == 1) {
+        std::string plain;
+        uint64_t issued = static_cast<uint64_t>(now);
+        for(int i = 7; i >= 0; --i) {
+            plain.push_back(static_cast<char>((issued >> (i * 8)) & 0xff));
+        }
+        plain += secret;
+        plain.push_back(static_cast<char>(username.size()));
+        plain += username;
+        if(!keys->seal(plain, now, ticket) || ticket.size() > ProxyProtoResume::_TICKET_MAX_SIZE) {
+            ticket.clear();
+        }
+    }
+
+    std::shared_ptr<ProxyBuffer> buf;
+
+    try {
+        buf = std::make_shared<ProxyBuffer>(6 + ticket.size() + secret.size());
+    } catch(const std::exception &ex) {
+        LOG(ERROR) << tunnel->ep0_ep1_string()
+            << ": create the buffer for the ticket error: " << ex.what();
+        return false;
+    }
+
+    uint32_t lifetime = htonl(static_cast<uint32_t>(ticket.empty() ? 0 : keys->lifetime()));
+    uint16_t len = htons(static_cast<uint16_t>(ticket.size()));
+    memcpy(buf->buffer, &lifetime, 4);
+    memcpy(buf->buffer + 4, &len, 2);
+    buf->cur = 6;
+    if(!ticket.empty()) {
+        memcpy(buf->buffer + buf->cur, ticket.data(), ticket.size());
+        buf->cur += ticket.size();
+        memcpy(buf->buffer + buf->cur, secret.data(), secret.size());
+        buf->cur += secret.size();
+    }
+
+    if(!proxy::crypto::ProxyCryptoAes::encrypt(tunnel->aes_ctx(), buf) ||
+        !tunnel->stage_ep0(buf)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": send the ticket error";
+        return false;
+    }
+
+    if(!ticket.empty()) {
+        tunnel->server()->add_ticket_issued();
+    }
+
+    return true;
+
+}
+
+bool ProxyProtoResume::on_ticket_receive(std::shared_ptr<ProxyTunnel> &tunnel) {
+
+    uint32_t lifetime;
+    std::string len;
+    if(!tunnel->read_decrypted_4bytes_from_ep1(lifetime) ||
+        !tunnel->read_decrypted_string_from_ep1(2, len)) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the meta of the ticket error";
+        return false;
+    }
+
+    size_t n = (static_cast<size_t>(static_cast<uint8_t>(len[0])) << 8) |
+        static_cast<uint8_t>(len[1]);
+    if(n > ProxyProtoResume::_TICKET_MAX_SIZE) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": the length of the ticket error: " << n;
+        return false;
+    }
+
+    std::string ticket;
+    std::string secret;
+    if(n && (!tunnel->read_decrypted_string_from_ep1(n, ticket) ||
+        !tunnel->read_decrypted_string_from_ep1(ProxyProtoResume::_SECRET_SIZE, secret))) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the ticket error";
+        return false;
+    }
+
+    if(n && lifetime) {
+        tunnel->server()->ticket(ProxyProtoCryptoNegotiate::remote(tunnel),
+            ProxyCryptoTicket(ticket, secret, time(NULL) + static_cast<time_t>(lifetime)));
+    }
+
+    return true;
+
+}
+
+ProxyStmEvent ProxyProtoResume::on_resume_request(std::shared_ptr<ProxyTunnel> &tunnel) {
+
+    /*
+    **  the ticket and a fresh nonce, the keys come from the secret in the ticket and both
+    **  messages, so every resumed tunnel has its own keys
+    **    +------+-------+----------+--------+----------+---------+
+    **    | TYPE | COUNT |   IDS    | LENGTH |  TICKET  |  NONCE  |
+    **    +------+-------+----------+--------+----------+---------+
+    **    | 0x8  | 1byte | 1 to 255 | 2bytes |          | 32bytes |
+    **    +------+-------+----------+--------+----------+---------+
+    */
+
+    std::string remote = ProxyProtoCryptoNegotiate::remote(tunnel);
+    const ProxyCryptoTicket *cached = tunnel->server()->ticket(remote);
+    if(!cached) {
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_REJECT;
+    }
+    if(cached->expires <= time(NULL)) {
+        tunnel->server()->drop_ticket(remote);
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_REJECT;
+    }
+
+    // copied, the cache may change while the coroutine waits
+    std::string ticket = cached->ticket;
+    std::string secret = cached->secret;
+
+    std::shared_ptr<ProxyBuffer> buf;
+
+    try {
+        buf = std::make_shared<ProxyBuffer>(1024);
+    } catch(const std::exception &ex) {
+        LOG(ERROR) << tunnel->ep0_ep1_string()
+            << ": create the buffer for the resumption error: " << ex.what();
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL;
+    }
+
+    const std::vector<ProxyCryptoCipherSuite> &ciphers =
+        tunnel->server()->config().crypto_ciphers();
+
+    buf->buffer[0] = 0x8;
+    buf->buffer[1] = static_cast<char>(ciphers.size());
+    buf->cur = 2;
+    for(ProxyCryptoCipherSuite suite : ciphers) {
+        buf->buffer[buf->cur++] = static_cast<char>(suite);
+    }
+    uint16_t len = htons(static_cast<uint16_t>(ticket.size()));
+    memcpy(buf->buffer + buf->cur, &len, 2);
+    buf->cur += 2;
+    memcpy(buf->buffer + buf->cur, ticket.data(), ticket.size());
+    buf->cur += ticket.size();
+    if(RAND_bytes(reinterpret_cast<unsigned char *>(buf->buffer + buf->cur),
+        static_cast<int>(ProxyProtoResume::_NONCE_SIZE)) != 1) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": generate the resumption nonce error";
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL;
+    }
+    buf->cur += ProxyProtoResume::_NONCE_SIZE;
+
+    std::string request(buf->get_charp_at(0), buf->cur);
+    if(!tunnel->stage_ep1(buf)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": send the resumption request error";
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL;
+    }
+
+    /*
+    **  the answer, a rejected ticket has the status 1 and nothing else
+    **    +------+--------+------+---------+
+    **    | TYPE | STATUS |  ID  |  NONCE  |
+    **    +------+--------+------+---------+
+    **    | 0x8  |  0x0   | 1byte| 32bytes |
+    **    +------+--------+------+---------+
+    */
+
+    buf->clear();
+    if(2 != tunnel->read_ep1_eq(2, buf)) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the resumption answer error, the "
+            << "peer may not know the tickets and needs crypto.resumption=0: "
+            << strerror(errno);
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL;
+    }
+
+    if(*buf->get_charp_at(0) != 0x8) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": unexpected resumption answer: "
+            << static_cast<int>(*buf->get_charp_at(0));
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL;
+    }
+
+    if(*buf->get_charp_at(1) != 0x0) {
+        tunnel->server()->drop_ticket(remote);
+        tunnel->server()->add_resumption(false);
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_REJECT;
+    }
+
+    size_t rest = 1 + ProxyProtoResume::_NONCE_SIZE;
+    ssize_t nread = tunnel->read_ep1_eq(rest, buf);
+    if(nread < 0 || static_cast<size_t>(nread) != rest) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": read the resumption answer error: "
+            << strerror(errno);
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL;
+    }
+
+    ProxyCryptoCipherSuite suite;
+    if(!ProxyCryptoCipher::from_id(static_cast<uint8_t>(*buf->get_charp_at(2)), suite) ||
+        std::find(ciphers.begin(), ciphers.end(), suite) == ciphers.end()) {
+        LOG(ERROR) << tunnel->ep1_ep0_string() << ": unexpected cipher of the resumption: "
+            << static_cast<int>(*buf->get_charp_at(2));
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL;
+    }
+    tunnel->cipher(suite);
+
+    std::string answer(buf->get_charp_at(0), 2 + rest);
+    if(!ProxyProtoCryptoNegotiate::expand_keys(tunnel, secret, request + answer,
+        "proxy resume", true)) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": derive the keys of the resumption error";
+        return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_FAIL;
+    }
+
+    tunnel->server()->add_resumption(true);
+
+    return ProxyStmEvent::PROXY_STM_EVENT_RESUMPTION_OK;
+
+}
+
+bool ProxyProtoResume::on_resume_response(std::shared_ptr<ProxyTunnel> &tunnel,
+    std::shared_ptr<ProxyBuffer> &buf, bool &accepted) {
+
+    accepted = false;
+
+    size_t n = static_cast<uint8_t>(*buf->get_charp_at(1));
+    ssize_t nread = tunnel->read_ep0_eq(n + 2, buf);
+    if(!n || nread < 0 || static_cast<size_t>(nread) != n + 2) {
+        LOG(ERROR) << "read the resumption request from " << tunnel->ep0()->to_string()
+            << " error: " << strerror(errno);
+        return false;
+    }
+
+    uint16_t len;
+    memcpy(&len, buf->get_charp_at(2 + n), 2);
+    size_t tlen = ntohs(len);
+    size_t rest = tlen + ProxyProtoResume::_NONCE_SIZE;
+    if(tlen > ProxyProtoResume::_TICKET_MAX_SIZE) {
+        LOG(ERROR) << "the ticket of " << tunnel->ep0()->to_string() << " is too long: " << tlen;
+        return false;
+    }
+
+    nread = tunnel->read_ep0_eq(rest, buf);
+    if(nread < 0 || static_cast<size_t>(nread) != rest) {
+        LOG(ERROR) << "read the ticket from " << tunnel->ep0()->to_string() << " error: "
+            << strerror(errno);
+        return false;
+    }
+
+    std::string request(buf->get_charp_at(0), 4 + n + rest);
+    std::string secret;
+    bool valid = _open(tunnel, request.substr(4 + n, tlen), secret) &&
+        ProxyProtoCryptoNegotiate::pick_cipher(tunnel, request.data() + 2, n);
+    tunnel->server()->add_resumption(valid);
+
+    buf->clear();
+    buf->buffer[0] = 0x8;
+    buf->buffer[1] = valid ? 0x0 : 0x1;
+    buf->cur = 2;
+
+    if(valid) {
+        buf->buffer[buf->cur++] = static_cast<char>(tunnel->cipher());
+        if(RAND_bytes(reinterpret_cast<unsigned char *>(buf->buffer + buf->cur),
+            static_cast<int>(ProxyProtoResume::_NONCE_SIZE)) != 1) {
+            LOG(ERROR) << "generate the resumption nonce for " << tunnel->ep0()->to_string()
+                << " error";
+            return false;
+        }
+        buf->cur += ProxyProtoResume::_NONCE_SIZE;
+
+        std::string answer(buf->get_charp_at(0), buf->cur);
+        if(!ProxyProtoCryptoNegotiate::expand_keys(tunnel, secret, request + answer,
+            "proxy resume", false)) {
+            LOG(ERROR) << "derive the keys of the resumption with "
+                << tunnel->ep0()->to_string() << " error";
+            return false;
+        }
+    }
+
+    if(!tunnel->stage_ep0(buf)) {
+        LOG(ERROR) << "send the resumption answer to " << tunnel->ep0()->to_string()
+            << " error";
+        return false;
+    }
+
+    accepted = valid;
+
+    return true;
+
+}
+
+bool ProxyProtoResume::_open(std::shared_ptr<ProxyTunnel> &tunnel, const std::string &ticket,
+    std::string &secret) {
+
+    const std::shared_ptr<proxy::crypto::ProxyCryptoTicketKeys> &keys =
+        tunnel->server()->ticket_keys();
+    time_t now = time(NULL);
+
+    std::string plain;
+    if(!keys || !keys->open(ticket, now, plain) || plain.size() < 8 + _SECRET_SIZE + 1) {
+        return false;
+    }
+
+    uint64_t issued = 0;
+    for(size_t i = 0; i < 8; ++i) {
+        issued = (issued << 8) | static_cast<uint8_t>(plain[i]);
+    }
+    if(static_cast<time_t>(issued) > now || now - static_cast<time_t>(issued) > keys->lifetime()) {
+        return false;
+    }
+
+    // the ticket stops working once the credentials change
+    size_t ulen = static_cast<uint8_t>(plain[8 + _SECRET_SIZE]);
+    if(plain.size() != 8 + _SECRET_SIZE + 1 + ulen ||
+        plain.substr(8 + _SECRET_SIZE + 1) != tunnel->server()->config().username()) {
+        return false;
+    }
+
+    secret = plain.substr(8, _SECRET_SIZE);
+
+    return true;
+
+}
+
+}
+}
+}
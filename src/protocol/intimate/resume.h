@@ -0,0 +1,50 @@
+#ifndef PROXY_PROTOCOL_INTIMATE_RESUME_H_H_H
+#define PROXY_PROTOCOL_INTIMATE_RESUME_H_H_H
+
+#include <memory>
+#include <string>
+
+#include "core/buffer.h"
+#include "core/tunnel.h"
+#include "core/stm.h"
+
+namespace proxy {
+namespace protocol {
+namespace intimate {
+
+/*
+ * the decryption server hands a ticket to the peers which authenticated with a full
+ * handshake, and a later tunnel presents it instead of the key exchange and the
+ * identification, a rejected ticket goes on with the full handshake on the same connection
+ */
+class ProxyProtoResume {
+
+public:
+    // the encryption side asks for a ticket ahead of the key exchange
+    static bool on_ticket_request(std::shared_ptr<proxy::core::ProxyTunnel> &);
+    // the decryption side answers it after the identification
+    static bool on_ticket_send(std::shared_ptr<proxy::core::ProxyTunnel> &, const std::string &);
+    static bool on_ticket_receive(std::shared_ptr<proxy::core::ProxyTunnel> &);
+
+    // the encryption side presents its ticket, rejected without one
+    static proxy::core::ProxyStmEvent on_resume_request(
+        std::shared_ptr<proxy::core::ProxyTunnel> &);
+    // the decryption side, the type and the count are in the buffer already
+    static bool on_resume_response(std::shared_ptr<proxy::core::ProxyTunnel> &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &, bool &);
+
+private:
+    static bool _open(std::shared_ptr<proxy::core::ProxyTunnel> &, const std::string &,
+        std::string &);
+
+    static const size_t _SECRET_SIZE;
+    static const size_t _NONCE_SIZE;
+    static const size_t _TICKET_MAX_SIZE;
+
+};
+
+}
+}
+}
+
+#endif
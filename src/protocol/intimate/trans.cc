@@ -1,5 +1,11 @@
+#include <algorithm>
 #include <exception>
 
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "core/memory.h"
 #include "core/server.h"
 #include "protocol/intimate/trans.h"
 
@@ -9,89 +15,77 @@
 using proxy::core::ProxyStmEvent;
 using proxy::core::ProxyTunnel;
 using proxy::core::ProxyBuffer;
+using proxy::core::ProxyEvent;
+using proxy::core::ProxyIdlePoller;
+using proxy::core::ProxyMemoryBudget;
+using proxy::core::ProxyMemoryPressure;
+using proxy::core::ProxyRelayRing;
+using proxy::core::ProxyServerType;
+using proxy::core::ProxySocket;
+using proxy::core::ProxyThreadPool;
+using proxy::core::ProxyTraffic;
+using proxy::crypto::ProxyCryptoAes;
+using proxy::crypto::ProxyCryptoAesContext;
 
 namespace proxy {
 namespace protocol {
 namespace intimate {
 
 const size_t ProxyProtoTransmit::_TRANSMIT_BUFFER_SIZE = 131072;
+const size_t ProxyProtoTransmit::_TRANSMIT_BUFFER_MIN_SIZE = 4096;
+const uint32_t ProxyProtoTransmit::_TRANSMIT_SHRINK_READS = 16;
 
 void *ProxyProtoTransmit::on_enc_mode_transmit_ep0_ep1(void *args) {
-
-    ProxyProtoTransmitArgs *p = reinterpret_cast<ProxyProtoTransmitArgs *>(args);
-    std::shared_ptr<ProxyTunnel> tunnel = p->tunnel;
-
-    try {
-        ProxyProtoTransmit::_on_enc_mode_transmit(tunnel, true);
-    } catch (const std::exception &ex) {
-        LOG(ERROR) << "unexpected exception: " << ex.what();
-    }
-    return nullptr;
-
+    return _relay(args, ProxyProtoTransmit::_on_enc_mode_transmit, true);
 }
 
 void *ProxyProtoTransmit::on_enc_mode_transmit_ep1_ep0(void *args) {
-
-    ProxyProtoTransmitArgs *p = reinterpret_cast<ProxyProtoTransmitArgs *>(args);
-    std::shared_ptr<ProxyTunnel> tunnel = p->tunnel;
-    try {
-        ProxyProtoTransmit::_on_enc_mode_transmit(tunnel, false);
-    } catch (const std::exception &ex) {
-        LOG(ERROR) << "unexpected exception: " << ex.what();
-    }
-    return nullptr;
-
+    return _relay(args, ProxyProtoTransmit::_on_enc_mode_transmit, false);
 }
 
 void *ProxyProtoTransmit::on_dec_mode_transmit_ep0_ep1(void *args) {
-
-    ProxyProtoTransmitArgs *p = reinterpret_cast<ProxyProtoTransmitArgs *>(args);
-    std::shared_ptr<ProxyTunnel> tunnel = p->tunnel;
-    try {
-        ProxyProtoTransmit::_on_dec_mode_transmit(tunnel, true);
-    } catch (const std::exception &ex) {
-        LOG(ERROR) << "unexpected exception: " << ex.what();
-    }
-
-    return nullptr;
-
+    return _relay(args, ProxyProtoTransmit::_on_dec_mode_transmit, true);
 }
 
 void *ProxyProtoTransmit::on_dec_mode_transmit_ep1_ep0(void *args) {
-
-    ProxyProtoTransmitArgs *p = reinterpret_cast<ProxyProtoTransmitArgs *>(args);
-    std::shared_ptr<ProxyTunnel> tunnel = p->tunnel;
-    try {
-        ProxyProtoTransmit::_on_dec_mode_transmit(tunnel, false);
-    } catch (const std::exception &ex) {
-        LOG(ERROR) << "unexpected exception: " << ex.what();
-    }
-    return nullptr;
-
+    return _relay(args, ProxyProtoTransmit::_on_dec_mode_transmit, false);
 }
 
 void *ProxyProtoTransmit::on_trans_mode_transmit_ep0_ep1(void *args) {
+    return _relay(args, ProxyProtoTransmit::_on_trans_mode_transmit, true);
+}
 
-    ProxyProtoTransmitArgs *p = reinterpret_cast<ProxyProtoTransmitArgs *>(args);
-    std::shared_ptr<ProxyTunnel> tunnel = p->tunnel;
-    try {
-        ProxyProtoTransmit::_on_trans_mode_transmit(tunnel, true);
-    } catch (const std::exception &ex) {
-        LOG(ERROR) << "unexpected exception: " << ex.what();
-    }
-    return nullptr;
+void *ProxyProtoTransmit::on_trans_mode_transmit_ep1_ep0(void *args) {
+    return _relay(args, ProxyProtoTransmit::_on_trans_mode_transmit, false);
+}
 
+void *ProxyProtoTransmit::on_ring_transmit_ep0_ep1(void *args) {
+    return _relay(args, ProxyProtoTransmit::_on_ring_transmit, true);
 }
 
-void *ProxyProtoTransmit::on_trans_mode_transmit_ep1_ep0(void *args) {
+void *ProxyProtoTransmit::on_ring_transmit_ep1_ep0(void *args) {
+    return _relay(args, ProxyProtoTransmit::_on_ring_transmit, false);
+}
+
+void *ProxyProtoTransmit::_relay(void *args,
+    ProxyStmEvent (*transmit)(std::shared_ptr<ProxyTunnel> &, bool), bool flag) {
 
     ProxyProtoTransmitArgs *p = reinterpret_cast<ProxyProtoTransmitArgs *>(args);
-    std::shared_ptr<ProxyTunnel> tunnel = p->tunnel;
+    std::shared_ptr<ProxyTunnel> tunnel = std::move(p->tunnel);
+    delete p;
+
+    ProxyStmEvent ret = ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
     try {
-      ProxyProtoTransmit::_on_trans_mode_transmit(tunnel, false);
+        ret = transmit(tunnel, flag);
     } catch (const std::exception &ex) {
         LOG(ERROR) << "unexpected exception: " << ex.what();
     }
+
+    // a parked direction is resumed by the idle poller with a new coroutine
+    if(ret != ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_IDLE) {
+        proxy::core::ProxyStm::relay_end(tunnel);
+    }
+
     return nullptr;
 
 }
@@ -106,60 +100,76 @@ ProxyStmEvent ProxyProtoTransmit::_on_enc_mode_transmit(std::shared_ptr<ProxyTun
      *
      */
 
-    std::shared_ptr<ProxyBuffer> buf0;
-    std::shared_ptr<ProxyBuffer> buf1;
-
-    try {
-        buf0 = std::make_shared<ProxyBuffer>(_TRANSMIT_BUFFER_SIZE);
-        buf1 = std::make_shared<ProxyBuffer>(_TRANSMIT_BUFFER_SIZE);
-    } catch (const std::exception &ex) {
-        LOG(ERROR) << tunnel->ep0_ep1_string() << ": create the buffer for transmission error: "
-            << ex.what();
-        return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
-    }
+    std::shared_ptr<ProxyBuffer> buf;
+    std::shared_ptr<ProxyEvent> event;
+    ProxyProtoTransmitBudget budget;
 
     while(1) {
 
-        buf0->clear();
-        buf1->clear();
+        if(tunnel->migrate_to() >= 0 && tunnel->server()->migrate(tunnel, flag)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK;
+        }
+
+        // the buffer is only attached while the data flows, and the cipher runs in place
+        if(!buf && _park(tunnel, flag)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_IDLE;
+        }
+        if(!_attach(tunnel, flag, buf)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+        }
+
+        buf->clear();
 
         if(flag) {
 
-            ssize_t nread = tunnel->ep0()->read(buf0);
+            ssize_t nread = _read(tunnel, true, buf);
             if(nread < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             } else if(nread == 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK;
             }
 
-            proxy::crypto::ProxyCryptoAes::aes_cfb_encrypt(tunnel->aes_ctx(), buf0, buf1);
+            _crypt(tunnel, true, true, tunnel->aes_ctx(), buf, event);
 
-            ssize_t nwrite = tunnel->ep1()->write_eq(buf1->cur - buf1->start, buf1);
+            ssize_t nwrite = tunnel->ep1()->write_eq(buf->cur - buf->start, buf);
             if(nwrite < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             }
 
-            tunnel->server()->add_ep0_ep1_data_amount(static_cast<int64_t>(nwrite));
+            ProxyTraffic::add_write(true);
+            ProxyTraffic::add_bytes(true, static_cast<uint64_t>(nwrite));
+
+            _charge(tunnel, budget, static_cast<size_t>(nwrite));
 
         } else {
 
-            ssize_t nread = tunnel->ep1()->read(buf0);
+            ssize_t nread = _read(tunnel, false, buf);
             if(nread < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             } else if(nread == 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK;
             }
 
-            proxy::crypto::ProxyCryptoAes::aes_cfb_decrypt(tunnel->aes_ctx_peer(), buf0, buf1);
+            _crypt(tunnel, false, false, tunnel->aes_ctx_peer(), buf, event);
 
-            ssize_t nwrite = tunnel->ep0()->write_eq(buf1->cur - buf1->start, buf1);
+            ssize_t nwrite = tunnel->ep0()->write_eq(buf->cur - buf->start, buf);
             if(nwrite < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             }
 
-            tunnel->server()->add_ep1_ep0_data_amount(static_cast<int64_t>(nwrite));
+            ProxyTraffic::add_write(false);
+            ProxyTraffic::add_bytes(false, static_cast<uint64_t>(nwrite));
+
+            _charge(tunnel, budget, static_cast<size_t>(nwrite));
 
         }
+
+        _resize(tunnel, flag, buf);
+
+        // a short read drained the socket
+        if(!buf->full() && tunnel->server()->idle_poller()) {
+            buf.reset();
+        }
     
     }
 
@@ -170,60 +180,76 @@ ProxyStmEvent ProxyProtoTransmit::_on_enc_mode_transmit(std::shared_ptr<ProxyTun
 ProxyStmEvent ProxyProtoTransmit::_on_dec_mode_transmit(std::shared_ptr<ProxyTunnel> &tunnel,
     bool flag) {
 
-    std::shared_ptr<ProxyBuffer> buf0;
-    std::shared_ptr<ProxyBuffer> buf1;
-
-    try {
-        buf0 = std::make_shared<ProxyBuffer>(_TRANSMIT_BUFFER_SIZE);
-        buf1 = std::make_shared<ProxyBuffer>(_TRANSMIT_BUFFER_SIZE);
-    } catch (const std::exception &ex) {
-        LOG(ERROR) << tunnel->ep0_ep1_string() << ": create the buffer for transmission error: "
-            << ex.what();
-        return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
-    }
+    std::shared_ptr<ProxyBuffer> buf;
+    std::shared_ptr<ProxyEvent> event;
+    ProxyProtoTransmitBudget budget;
 
     while(1) {
 
-        buf0->clear();
-        buf1->clear();
+        if(tunnel->migrate_to() >= 0 && tunnel->server()->migrate(tunnel, flag)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK;
+        }
+
+        // the buffer is only attached while the data flows, and the cipher runs in place
+        if(!buf && _park(tunnel, flag)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_IDLE;
+        }
+        if(!_attach(tunnel, flag, buf)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+        }
+
+        buf->clear();
 
         if(flag) {
 
-            ssize_t nread = tunnel->ep0()->read(buf0);
+            ssize_t nread = _read(tunnel, true, buf);
             if(nread < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             } else if(nread == 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK;
             }
 
-            proxy::crypto::ProxyCryptoAes::aes_cfb_decrypt(tunnel->aes_ctx_peer(), buf0, buf1);
+            _crypt(tunnel, true, false, tunnel->aes_ctx_peer(), buf, event);
 
-            ssize_t nwrite = tunnel->ep1()->write_eq(buf1->cur - buf1->start, buf1);
+            ssize_t nwrite = tunnel->ep1()->write_eq(buf->cur - buf->start, buf);
             if(nwrite < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             }
 
-            tunnel->server()->add_ep0_ep1_data_amount(static_cast<int64_t>(nwrite));
+            ProxyTraffic::add_write(true);
+            ProxyTraffic::add_bytes(true, static_cast<uint64_t>(nwrite));
+
+            _charge(tunnel, budget, static_cast<size_t>(nwrite));
 
         } else {
 
-            ssize_t nread = tunnel->ep1()->read(buf0);
+            ssize_t nread = _read(tunnel, false, buf);
             if(nread < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             } else if(nread == 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK;
             }
 
-            proxy::crypto::ProxyCryptoAes::aes_cfb_encrypt(tunnel->aes_ctx(), buf0, buf1);
+            _crypt(tunnel, false, true, tunnel->aes_ctx(), buf, event);
 
-            ssize_t nwrite = tunnel->ep0()->write_eq(buf1->cur - buf1->start, buf1);
+            ssize_t nwrite = tunnel->ep0()->write_eq(buf->cur - buf->start, buf);
             if(nwrite < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             }
 
-            tunnel->server()->add_ep1_ep0_data_amount(static_cast<int64_t>(nwrite));
+            ProxyTraffic::add_write(false);
+            ProxyTraffic::add_bytes(false, static_cast<uint64_t>(nwrite));
+
+            _charge(tunnel, budget, static_cast<size_t>(nwrite));
 
         }
+
+        _resize(tunnel, flag, buf);
+
+        // a short read drained the socket
+        if(!buf->full() && tunnel->server()->idle_poller()) {
+            buf.reset();
+        }
     
     }
 
@@ -231,26 +257,213 @@ ProxyStmEvent ProxyProtoTransmit::_on_dec_mode_transmit(std::shared_ptr<ProxyTun
 
 }
 
-ProxyStmEvent ProxyProtoTransmit::_on_trans_mode_transmit(std::shared_ptr<ProxyTunnel> &tunnel,
-    bool flag) {
+ssize_t ProxyProtoTransmit::_read(std::shared_ptr<ProxyTunnel> &tunnel, bool flag,
+    std::shared_ptr<ProxyBuffer> &buf) {
 
-    std::shared_ptr<ProxyBuffer> buf;
+    // near the memory budget the sources are slowed down, which lets the writes drain
+    if(ProxyMemoryBudget::pressure() != ProxyMemoryPressure::Normal) {
+        ProxyMemoryBudget::add_read_throttle();
+        co_usleep(ProxyMemoryBudget::READ_PAUSE);
+    }
+
+    ssize_t nread = flag ? tunnel->ep0()->read(buf) : tunnel->ep1()->read(buf);
 
+    if(nread > 0) {
+        tunnel->add_bytes(static_cast<int64_t>(nread));
+        ProxyTraffic::add_read(flag);
+    }
+
+    return nread;
+
+}
+
+bool ProxyProtoTransmit::_park(std::shared_ptr<ProxyTunnel> &tunnel, bool flag) {
+
+    const std::shared_ptr<ProxyIdlePoller> &poller = tunnel->server()->idle_poller();
+    if(!poller) {
+        return false;
+    }
+
+    // peek without parking: the data or the eos goes on to the read
+    char c;
+    int fd = flag ? tunnel->ep0()->fileno() : tunnel->ep1()->fileno();
+    if(recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 || errno != EAGAIN) {
+        return false;
+    }
+
+    return poller->park(tunnel, flag);
+
+}
+
+bool ProxyProtoTransmit::_attach(std::shared_ptr<ProxyTunnel> &tunnel, bool flag,
+    std::shared_ptr<ProxyBuffer> &buf) {
+
+    // near the memory budget every direction starts over with the smallest buffer
+    size_t size = tunnel->relay_size(flag);
+    if(!size || (size > _TRANSMIT_BUFFER_MIN_SIZE &&
+        ProxyMemoryBudget::pressure() != ProxyMemoryPressure::Normal)) {
+        size = _TRANSMIT_BUFFER_MIN_SIZE;
+        tunnel->relay_size(flag, size);
+    }
+
+    if(buf && buf->size == size) {
+        return true;
+    }
+
+    // the buffer is empty between two chunks, so it is simply replaced
     try {
-        buf = std::make_shared<ProxyBuffer>(_TRANSMIT_BUFFER_SIZE);
+        buf = std::allocate_shared<ProxyBuffer>(proxy::core::ProxyArenaAllocator<ProxyBuffer>(),
+            size);
     } catch (const std::exception &ex) {
-        LOG(ERROR) << tunnel->ep0_ep1_string()
-            << ": create the buffer for ordinary transmission error: " << ex.what();
-        return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": create the buffer for transmission error: "
+            << ex.what();
+        return false;
+    }
+
+    tunnel->server()->add_relay_buffer(size);
+
+    return true;
+
+}
+
+void ProxyProtoTransmit::_resize(std::shared_ptr<ProxyTunnel> &tunnel, bool flag,
+    const std::shared_ptr<ProxyBuffer> &buf) {
+
+    /*
+     * a read which fills the buffer means more data is waiting, so the next buffer doubles
+     * up to the largest size, and a run of reads using no more than a quarter of it halves
+     * the next buffer down to the smallest size
+     */
+
+    uint32_t &small = tunnel->small_reads(flag);
+
+    if(buf->full()) {
+        small = 0;
+        if(buf->size < _TRANSMIT_BUFFER_SIZE &&
+            ProxyMemoryBudget::pressure() == ProxyMemoryPressure::Normal) {
+            tunnel->relay_size(flag, std::min(buf->size * 2, _TRANSMIT_BUFFER_SIZE));
+        }
+        return;
+    }
+
+    if(buf->cur > buf->size / 4) {
+        small = 0;
+        return;
+    }
+
+    if(++small >= _TRANSMIT_SHRINK_READS && buf->size > _TRANSMIT_BUFFER_MIN_SIZE) {
+        small = 0;
+        tunnel->relay_size(flag, std::max(buf->size / 2, _TRANSMIT_BUFFER_MIN_SIZE));
     }
 
+}
+
+void ProxyProtoTransmit::_charge(std::shared_ptr<ProxyTunnel> &tunnel,
+    ProxyProtoTransmitBudget &budget, size_t n) {
+
+    /*
+     * a socket which always has data never parks the coroutine, so give the others a turn
+     * once the bytes or the time are used up, like the quantum of the deficit round robin
+     */
+
+    const proxy::core::ProxyConfig &config = tunnel->server()->config();
+    co_time_t now = co_get_current_time();
+
+    // a long gap since the last chunk means the coroutine was parked, which starts a new turn
+    if(!budget.last || (config.relay_budget_time() &&
+        now - budget.last >= static_cast<co_time_t>(config.relay_budget_time()))) {
+        budget.bytes = 0;
+        budget.since = now;
+    }
+    budget.last = now;
+    budget.bytes += n;
+
+    bool over = (config.relay_budget() && budget.bytes >= config.relay_budget()) ||
+        (config.relay_budget_time() &&
+        now - budget.since >= static_cast<co_time_t>(config.relay_budget_time()));
+    if(!over) {
+        return;
+    }
+
+    tunnel->server()->add_budget_hit();
+    co_usleep(0);
+
+    budget.bytes = 0;
+    budget.since = budget.last = co_get_current_time();
+
+}
+
+bool ProxyProtoTransmit::_crypt(std::shared_ptr<ProxyTunnel> &tunnel, bool flag,
+    bool encrypt, ProxyCryptoAesContext &ctx, std::shared_ptr<ProxyBuffer> &buf,
+    std::shared_ptr<ProxyEvent> &event) {
+
+    /*
+     * the large chunks are handed to the crypto threads while the coroutine parks on its
+     * event, the next chunk of the same direction is not read before the event fires, so
+     * the cipher stream keeps its order
+     */
+
+    // the time is counted by the thread which runs the cipher
+    auto crypt = [&ctx, &buf, flag, encrypt]() -> bool {
+        uint64_t begin = ProxyTraffic::now_ns();
+        bool ok = encrypt ? ProxyCryptoAes::encrypt(ctx, buf) :
+            ProxyCryptoAes::decrypt(ctx, buf);
+        ProxyTraffic::add_crypto_ns(flag, ProxyTraffic::now_ns() - begin);
+        return ok;
+    };
+
+    const std::shared_ptr<ProxyThreadPool> &pool = tunnel->server()->crypto_pool();
+
+    if(pool && buf->cur - buf->start >= tunnel->server()->config().crypto_offload_threshold()) {
+
+        if(!event) {
+            try {
+                event = std::make_shared<ProxyEvent>();
+            } catch (const std::exception &ex) {
+                LOG(ERROR) << tunnel->ep0_ep1_string() << ": create the crypto event error: "
+                    << ex.what();
+            }
+        }
+
+        bool ok = false;
+
+        if(event && pool->call([&crypt, &ok]() {
+            ok = crypt();
+        }, *event)) {
+            tunnel->server()->add_crypto_offloaded();
+            return ok;
+        }
+
+    }
+
+    return crypt();
+
+}
+
+ProxyStmEvent ProxyProtoTransmit::_on_trans_mode_transmit(std::shared_ptr<ProxyTunnel> &tunnel,
+    bool flag) {
+
+    std::shared_ptr<ProxyBuffer> buf;
+    ProxyProtoTransmitBudget budget;
+
     while(1) {
 
+        if(tunnel->migrate_to() >= 0 && tunnel->server()->migrate(tunnel, flag)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK;
+        }
+
+        if(!buf && _park(tunnel, flag)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_IDLE;
+        }
+        if(!_attach(tunnel, flag, buf)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+        }
+
         buf->clear();
 
         if(flag) {
 
-            ssize_t nread = tunnel->ep0()->read(buf);
+            ssize_t nread = _read(tunnel, true, buf);
             if(nread < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             } else if(nread == 0) {
@@ -262,11 +475,14 @@ ProxyStmEvent ProxyProtoTransmit::_on_trans_mode_transmit(std::shared_ptr<ProxyT
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             }
 
-            tunnel->server()->add_ep0_ep1_data_amount(static_cast<int64_t>(nwrite));
+            ProxyTraffic::add_write(true);
+            ProxyTraffic::add_bytes(true, static_cast<uint64_t>(nwrite));
+
+            _charge(tunnel, budget, static_cast<size_t>(nwrite));
 
         } else {
 
-            ssize_t nread = tunnel->ep1()->read(buf);
+            ssize_t nread = _read(tunnel, false, buf);
             if(nread < 0) {
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             } else if(nread == 0) {
@@ -278,8 +494,18 @@ ProxyStmEvent ProxyProtoTransmit::_on_trans_mode_transmit(std::shared_ptr<ProxyT
                 return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
             }
 
-            tunnel->server()->add_ep1_ep0_data_amount(static_cast<int64_t>(nwrite));
+            ProxyTraffic::add_write(false);
+            ProxyTraffic::add_bytes(false, static_cast<uint64_t>(nwrite));
+
+            _charge(tunnel, budget, static_cast<size_t>(nwrite));
+
+        }
+
+        _resize(tunnel, flag, buf);
 
+        // a short read drained the socket
+        if(!buf->full() && tunnel->server()->idle_poller()) {
+            buf.reset();
         }
     
     }
@@ -288,6 +514,178 @@ ProxyStmEvent ProxyProtoTransmit::_on_trans_mode_transmit(std::shared_ptr<ProxyT
 
 }
 
+ProxyStmEvent ProxyProtoTransmit::_on_ring_transmit(std::shared_ptr<ProxyTunnel> &tunnel,
+    bool flag) {
+
+    /*
+     * the cipher of the direction:
+     *   encryption: ep0 -> ep1 encrypts with aes_ctx, ep1 -> ep0 decrypts with aes_ctx_peer
+     *   decryption: ep0 -> ep1 decrypts with aes_ctx_peer, ep1 -> ep0 encrypts with aes_ctx
+     *   transmission: none
+     *
+     */
+
+    bool encrypt = false;
+    ProxyCryptoAesContext *ctx = nullptr;
+
+    switch(tunnel->server()->config().mode()) {
+        case ProxyServerType::Encryption:
+            encrypt = flag;
+            ctx = flag ? &tunnel->aes_ctx() : &tunnel->aes_ctx_peer();
+            break;
+        case ProxyServerType::Decryption:
+            encrypt = !flag;
+            ctx = flag ? &tunnel->aes_ctx_peer() : &tunnel->aes_ctx();
+            break;
+        default:
+            break;
+    }
+
+    std::shared_ptr<ProxyRelayRing> ring;
+    ProxyProtoTransmitWriterArgs *args = nullptr;
+    try {
+        ring = std::make_shared<ProxyRelayRing>(tunnel->server()->config().relay_ring_slots());
+        args = new ProxyProtoTransmitWriterArgs{tunnel, ring, flag};
+    } catch (const std::exception &ex) {
+        LOG(ERROR) << tunnel->ep0_ep1_string() << ": create the relay ring error: "
+            << ex.what();
+        return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+    }
+
+    // the writer is one more relay of the tunnel, which ends after the ring is drained
+    tunnel->add_relay();
+    co_thread_t *c;
+    if(!(c = coroutine_create(ProxyProtoTransmit::_ring_writer, reinterpret_cast<void *>(args)))) {
+        LOG(ERROR) << (flag ? tunnel->ep0_ep1_string() : tunnel->ep1_ep0_string())
+            << ": create the writer coroutine error: " << strerror(errno);
+        delete args;
+        proxy::core::ProxyStm::relay_end(tunnel);
+        return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+    }
+    coroutine_setdetachstate(c, COROUTINE_FLAG_NONJOINABLE);
+
+    ProxyStmEvent ret = _ring_read(tunnel, flag, ring, encrypt, ctx);
+    ring->finish();
+
+    return ret;
+
+}
+
+ProxyStmEvent ProxyProtoTransmit::_ring_read(std::shared_ptr<ProxyTunnel> &tunnel, bool flag,
+    std::shared_ptr<ProxyRelayRing> &ring, bool encrypt,
+    ProxyCryptoAesContext *ctx) {
+
+    std::shared_ptr<ProxyEvent> event;
+
+    while(1) {
+
+        // the backpressure: a full ring stops the reading until the writer frees a slot
+        while(ring->full() && !ring->aborted()) {
+            if(!ring->wait_space()) {
+                LOG(ERROR) << tunnel->ep0_ep1_string() << ": wait on the relay ring error: "
+                    << strerror(errno);
+                return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+            }
+        }
+        if(ring->aborted()) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+        }
+
+        std::shared_ptr<ProxyBuffer> &buf = ring->back();
+        if(!_attach(tunnel, flag, buf)) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+        }
+
+        buf->clear();
+
+        ssize_t nread = _read(tunnel, flag, buf);
+        if(nread < 0) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+        } else if(nread == 0) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK;
+        }
+
+        // the writer may have failed while the reader waited for the data
+        if(ring->aborted()) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+        }
+
+        if(ctx) {
+            _crypt(tunnel, flag, encrypt, *ctx, buf, event);
+        }
+
+        _resize(tunnel, flag, buf);
+        ring->push();
+
+    }
+
+    return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+
+}
+
+void *ProxyProtoTransmit::_ring_writer(void *args) {
+
+    ProxyProtoTransmitWriterArgs *p = reinterpret_cast<ProxyProtoTransmitWriterArgs *>(args);
+    std::shared_ptr<ProxyTunnel> tunnel = std::move(p->tunnel);
+    std::shared_ptr<ProxyRelayRing> ring = std::move(p->ring);
+    bool flag = p->flag;
+    delete p;
+
+    ProxyStmEvent ret = ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+    try {
+        ret = _ring_write(tunnel, flag, ring);
+    } catch (const std::exception &ex) {
+        LOG(ERROR) << "unexpected exception: " << ex.what();
+    }
+
+    if(ret != ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK) {
+        ring->abort();
+    }
+
+    proxy::core::ProxyStm::relay_end(tunnel);
+
+    return nullptr;
+
+}
+
+ProxyStmEvent ProxyProtoTransmit::_ring_write(std::shared_ptr<ProxyTunnel> &tunnel, bool flag,
+    std::shared_ptr<ProxyRelayRing> &ring) {
+
+    const std::shared_ptr<ProxySocket> &ep = flag ? tunnel->ep1() : tunnel->ep0();
+    ProxyProtoTransmitBudget budget;
+
+    while(1) {
+
+        while(ring->empty()) {
+            if(ring->finished()) {
+                return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_OK;
+            }
+            if(!ring->wait_data()) {
+                LOG(ERROR) << tunnel->ep0_ep1_string() << ": wait on the relay ring error: "
+                    << strerror(errno);
+                return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+            }
+        }
+
+        std::shared_ptr<ProxyBuffer> &buf = ring->front();
+        ssize_t nwrite = ep->write_eq(buf->cur - buf->start, buf);
+        if(nwrite < 0) {
+            return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+        }
+
+        ProxyTraffic::add_write(flag);
+        ProxyTraffic::add_bytes(flag, static_cast<uint64_t>(nwrite));
+
+        ring->pop();
+
+        _charge(tunnel, budget, static_cast<size_t>(nwrite));
+
+    }
+
+    return ProxyStmEvent::PROXY_STM_EVENT_TRANSMISSION_FAIL;
+
 }
+
 }
 }
+}
\ No newline at end of file
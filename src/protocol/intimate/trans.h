@@ -3,20 +3,59 @@
 
 #include <memory>
 
+#include "core/buffer.h"
+#include "core/event.h"
+#include "core/ring.h"
+#include "core/slab.h"
 #include "core/stm.h"
 #include "core/tunnel.h"
+#include "crypto/aes.h"
+
+extern "C" {
+#include "coroutine/coroutine.h"
+}
 
 namespace proxy {
 namespace protocol {
 namespace intimate {
 
-class ProxyProtoTransmitArgs {
+class ProxyProtoTransmitArgs : public proxy::core::ProxySlabObject<ProxyProtoTransmitArgs> {
 
 public:
+    explicit ProxyProtoTransmitArgs(const std::shared_ptr<proxy::core::ProxyTunnel> &t) :
+        tunnel(t) {}
+
     std::shared_ptr<proxy::core::ProxyTunnel> tunnel;
 
 };
 
+// the writer coroutine of a direction which relays through a ring
+class ProxyProtoTransmitWriterArgs :
+    public proxy::core::ProxySlabObject<ProxyProtoTransmitWriterArgs> {
+
+public:
+    ProxyProtoTransmitWriterArgs(const std::shared_ptr<proxy::core::ProxyTunnel> &t,
+        const std::shared_ptr<proxy::core::ProxyRelayRing> &r, bool f) :
+        tunnel(t), ring(r), flag(f) {}
+
+    std::shared_ptr<proxy::core::ProxyTunnel> tunnel;
+    std::shared_ptr<proxy::core::ProxyRelayRing> ring;
+    bool flag;
+
+};
+
+// what a relay coroutine consumed since it was last parked or yielded
+class ProxyProtoTransmitBudget {
+
+public:
+    ProxyProtoTransmitBudget() : bytes(0), since(0), last(0) {}
+
+    size_t bytes;
+    co_time_t since;
+    co_time_t last;
+
+};
+
 class ProxyProtoTransmit {
 
 public:
@@ -26,15 +65,41 @@ public:
     static void *on_dec_mode_transmit_ep1_ep0(void *);
     static void *on_trans_mode_transmit_ep0_ep1(void *);
     static void *on_trans_mode_transmit_ep1_ep0(void *);
+    static void *on_ring_transmit_ep0_ep1(void *);
+    static void *on_ring_transmit_ep1_ep0(void *);
 
 private:
+    static void *_relay(void *, proxy::core::ProxyStmEvent (*)(
+        std::shared_ptr<proxy::core::ProxyTunnel> &, bool), bool);
     static proxy::core::ProxyStmEvent _on_enc_mode_transmit(
         std::shared_ptr<proxy::core::ProxyTunnel> &, bool);
     static proxy::core::ProxyStmEvent _on_dec_mode_transmit(
         std::shared_ptr<proxy::core::ProxyTunnel> &, bool);
     static proxy::core::ProxyStmEvent _on_trans_mode_transmit(
         std::shared_ptr<proxy::core::ProxyTunnel> &, bool);
+    static proxy::core::ProxyStmEvent _on_ring_transmit(
+        std::shared_ptr<proxy::core::ProxyTunnel> &, bool);
+    static proxy::core::ProxyStmEvent _ring_read(std::shared_ptr<proxy::core::ProxyTunnel> &,
+        bool, std::shared_ptr<proxy::core::ProxyRelayRing> &, bool,
+        proxy::crypto::ProxyCryptoAesContext *);
+    static void *_ring_writer(void *);
+    static proxy::core::ProxyStmEvent _ring_write(std::shared_ptr<proxy::core::ProxyTunnel> &,
+        bool, std::shared_ptr<proxy::core::ProxyRelayRing> &);
+    static ssize_t _read(std::shared_ptr<proxy::core::ProxyTunnel> &, bool,
+        std::shared_ptr<proxy::core::ProxyBuffer> &);
+    static bool _park(std::shared_ptr<proxy::core::ProxyTunnel> &, bool);
+    static bool _attach(std::shared_ptr<proxy::core::ProxyTunnel> &, bool,
+        std::shared_ptr<proxy::core::ProxyBuffer> &);
+    static void _resize(std::shared_ptr<proxy::core::ProxyTunnel> &, bool,
+        const std::shared_ptr<proxy::core::ProxyBuffer> &);
+    static void _charge(std::shared_ptr<proxy::core::ProxyTunnel> &, ProxyProtoTransmitBudget &,
+        size_t);
+    static bool _crypt(std::shared_ptr<proxy::core::ProxyTunnel> &, bool, bool,
+        proxy::crypto::ProxyCryptoAesContext &,
+        std::shared_ptr<proxy::core::ProxyBuffer> &, std::shared_ptr<proxy::core::ProxyEvent> &);
     static const size_t _TRANSMIT_BUFFER_SIZE;
+    static const size_t _TRANSMIT_BUFFER_MIN_SIZE;
+    static const uint32_t _TRANSMIT_SHRINK_READS;
 
 };
 
@@ -11,6 +11,7 @@
 
 using proxy::core::ProxyTunnel;
 using proxy::core::ProxyBuffer;
+using proxy::core::ProxySlabAllocator;
 using proxy::core::ProxyTcpSocket;
 using proxy::protocol::dns::ProxyProtoDnsUnblockResolver;
 
@@ -112,12 +113,12 @@ bool ProxyProtoSocks5::on_handshake(std::shared_ptr<ProxyTunnel> &tunnel) {
     buf0->buffer[1] = 0x00;
     buf0->cur +=2;
 
-    if(!proxy::crypto::ProxyCryptoAes::aes_cfb_encrypt(tunnel->aes_ctx(), buf0, buf1)) {
+    if(!proxy::crypto::ProxyCryptoAes::encrypt(tunnel->aes_ctx(), buf0, buf1)) {
         LOG(ERROR) << tunnel->ep0_ep1_string() << ": encrypt the socks5 handshake response error";
         return false;
     }
 
-    if(2 != tunnel->write_ep0_eq(2, buf1)) {
+    if(!tunnel->stage_ep0(buf1)) {
         LOG(ERROR) << tunnel->ep0_ep1_string() << ": write back the handshake response error";
         return false;
     }
@@ -321,7 +322,8 @@ bool ProxyProtoSocks5::on_request(std::shared_ptr<ProxyTunnel> &tunnel) {
     }
 
     try {
-        tunnel->ep1(std::make_shared<ProxyTcpSocket>(AF_INET, 0));
+        tunnel->ep1(std::allocate_shared<ProxyTcpSocket>(
+            ProxySlabAllocator<ProxyTcpSocket>(), AF_INET, 0));
         tunnel->ep1()->host(address);
         tunnel->ep1()->port(port);
     } catch(const std::exception &ex) {
@@ -367,12 +369,12 @@ bool ProxyProtoSocks5::on_request(std::shared_ptr<ProxyTunnel> &tunnel) {
     buf0->buffer[9] = port % 256;
     buf0->cur = 10;
 
-    if(!proxy::crypto::ProxyCryptoAes::aes_cfb_encrypt(tunnel->aes_ctx(), buf0, buf1)) {
+    if(!proxy::crypto::ProxyCryptoAes::encrypt(tunnel->aes_ctx(), buf0, buf1)) {
         LOG(ERROR) << tunnel->ep0_ep1_string() << ": encrypt the connecting response error";
         return false;
     }
 
-    if(10 != tunnel->write_ep0_eq(10, buf1)) {
+    if(!tunnel->stage_ep0(buf1)) {
         LOG(ERROR) << tunnel->ep0_ep1_string() << ": write back the connecting response error";
         return false;
     }